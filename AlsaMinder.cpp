@@ -1,5 +1,13 @@
 #include "AlsaMinder.hpp"
 
+// ALSA format for each SampleFormat::Code
+static const snd_pcm_format_t alsaFormats[SampleFormat::NUM_FORMATS] = {
+  SND_PCM_FORMAT_S16_LE,
+  SND_PCM_FORMAT_S24_3LE,
+  SND_PCM_FORMAT_S32_LE,
+  SND_PCM_FORMAT_FLOAT_LE
+};
+
 void AlsaMinder::delete_privates() {
   if (pcm) {
     snd_pcm_drop(pcm);
@@ -29,7 +37,7 @@ int AlsaMinder::hw_open() {
   if ((snd_pcm_open(& pcm, devName.c_str(), SND_PCM_STREAM_CAPTURE, 0))
       || snd_pcm_hw_params_any(pcm, params)
       || snd_pcm_hw_params_set_access_mask(pcm, params, mask)
-      || snd_pcm_hw_params_set_format(pcm, params, SND_PCM_FORMAT_S16_LE)
+      || setFormat(params)
       || snd_pcm_hw_params_set_channels(pcm, params, numChan)
       || snd_pcm_hw_params_set_rate_resample(pcm, params, 0)
       || snd_pcm_hw_params_set_rate_last(pcm, params, & hwRate, & rateDir)
@@ -42,7 +50,11 @@ int AlsaMinder::hw_open() {
 #ifdef RPI
       || snd_pcm_sw_params_set_tstamp_type(pcm, swparams, SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY)
 #endif
-      || snd_pcm_sw_params_set_period_event(pcm, swparams, 1)
+      // in adaptive mode, we don't wake on every period, but only once
+      // wake_frames are available; the period and buffer sizes have been
+      // set by now, so wakeFramesFor() can use them
+      || snd_pcm_sw_params_set_period_event(pcm, swparams, adaptivePeriod ? 0 : 1)
+      || (adaptivePeriod && snd_pcm_sw_params_set_avail_min(pcm, swparams, wake_frames = wakeFramesFor(lowLatency)))
       // get the ring buffer boundary, and
       || snd_pcm_sw_params_get_boundary	(swparams, &boundary)
       || snd_pcm_sw_params_set_stop_threshold (pcm, swparams, boundary)
@@ -55,6 +67,32 @@ int AlsaMinder::hw_open() {
   return 0;
 };
 
+int AlsaMinder::setFormat(snd_pcm_hw_params_t *params) {
+  // Set the requested sample format or, if none was requested, the first
+  // format in order of preference which the device supports.  S16_LE is
+  // preferred, as it is the most compact, but a device which doesn't
+  // support it natively (e.g. a 24-bit interface opened as hw:...) is
+  // then captured in its own format rather than through the plug layer.
+  // Once a format has been chosen, we stick with it across reopens, so
+  // attached plugins and raw listeners see a consistent format.
+
+  if (requestedFormat == SampleFormat::AUTO) {
+    for (int i = 0; i < SampleFormat::NUM_FORMATS; ++i) {
+      if (! snd_pcm_hw_params_test_format(pcm, params, alsaFormats[i])) {
+        requestedFormat = (SampleFormat::Code) i;
+        break;
+      }
+    }
+    if (requestedFormat == SampleFormat::AUTO)
+      return 1;
+  }
+  if (snd_pcm_hw_params_set_format(pcm, params, alsaFormats[requestedFormat]))
+    return 1;
+  sampleFormat = requestedFormat;
+  maxSampleAbs = SampleFormat::maxAbs(sampleFormat);
+  return 0;
+};
+
 bool AlsaMinder::hw_is_open() {
   return pcm != 0;
 };
@@ -87,12 +125,16 @@ int AlsaMinder::hw_do_restart() {
   return 0;
 };
 
-AlsaMinder::AlsaMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now):
-  DevMinder(devName, rate, numChan, 32768, label, now, BUFFER_FRAMES),
+AlsaMinder::AlsaMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now, int periodFrames, int bufferFrames, bool adaptivePeriod, SampleFormat::Code sampleFormat):
+  DevMinder(devName, rate, numChan, 32768, label, now, bufferFrames > 0 ? bufferFrames : BUFFER_FRAMES),
   revents(0),
   pcm(0),
-  buffer_frames(BUFFER_FRAMES),
-  period_frames(PERIOD_FRAMES)
+  buffer_frames(bufferFrames > 0 ? bufferFrames : BUFFER_FRAMES),
+  period_frames(periodFrames > 0 ? periodFrames : adaptivePeriod ? ADAPTIVE_PERIOD_FRAMES : PERIOD_FRAMES),
+  adaptivePeriod(adaptivePeriod),
+  lowLatency(false),
+  wake_frames(0),
+  requestedFormat(sampleFormat)
 {
 };
 
@@ -135,7 +177,7 @@ int AlsaMinder::hw_handleEvents ( struct pollfd *pollfds, bool timedOut) {
   return 0;
 };
 
-int AlsaMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp) {
+int AlsaMinder::hw_getFrames (float *buf, int numFrames, double & frameTimestamp) {
   // get most recent period timestamp from ALSA
   snd_htimestamp_t ts;
   snd_pcm_uframes_t av;
@@ -151,31 +193,28 @@ int AlsaMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimesta
   if (errcode)
     return errcode > 0 ? -errcode : errcode;
 
-  int16_t *src0, *src1=0; // avoid compiler warning
-  int step;
-
   /*
     copy available samples to buf
   */
 
-  // FIXME: assumes interleaved channels
-  src0 = (int16_t *) (((unsigned char *) areas[0].addr) + areas[0].first / 8);
-  step = areas[0].step / 16; // FIXME:  hardcoding S16_LE assumption
-  src0 += step * offset;
-
-  if (numChan == 2) {
-    src1 = (int16_t *) (((unsigned char *) areas[1].addr) + areas[1].first / 8);
-    src1 += step * offset;
-    for (unsigned i=0; i < have * numChan; ++i) {
-      *buf++ = *src0;
-      *buf++ = *src1;
-      src0 += step;
-      src1 += step;
-    }
+  int bytes = SampleFormat::bytes(sampleFormat);
+  int step = areas[0].step / 8; // bytes between consecutive frames
+  unsigned char *src = ((unsigned char *) areas[0].addr) + areas[0].first / 8 + step * offset;
+
+  if (step == (int) numChan * bytes && areas[numChan - 1].first == areas[0].first + 8 * bytes * (numChan - 1)) {
+    // usual case: channels are interleaved without padding, so the frames
+    // are contiguous and in the same layout as buf, and we can convert
+    // them in one pass
+    SampleFormat::toFloat(sampleFormat, src, buf, have * numChan);
   } else {
-    for (unsigned i=0; i < have * numChan; ++i) {
-      *buf++ = *src0;
-      src0 += step;
+    unsigned char *srcs[MAX_CHANNELS];
+    for (unsigned c = 0; c < numChan; ++c)
+      srcs[c] = ((unsigned char *) areas[c].addr) + areas[c].first / 8 + step * offset;
+    for (unsigned i = 0; i < have; ++i) {
+      for (unsigned c = 0; c < numChan; ++c) {
+        SampleFormat::toFloat(sampleFormat, srcs[c], buf++, 1);
+        srcs[c] += step;
+      }
     }
   }
   errcode = snd_pcm_mmap_commit (pcm, offset, have);
@@ -186,3 +225,63 @@ int AlsaMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimesta
   }
   return (have);
 };
+
+snd_pcm_uframes_t AlsaMinder::wakeFramesFor(bool lowLatency) {
+  // In adaptive mode, a low-latency consumer gets data every period.
+  // Otherwise, we let a fraction of the ring buffer fill before waking,
+  // rounded down to a whole number of periods, leaving the rest of the
+  // buffer as headroom against overrun if the poll loop is held up.
+
+  if (lowLatency)
+    return period_frames;
+  snd_pcm_uframes_t periods = buffer_frames / HIGH_LATENCY_BUFFER_FRACTION / period_frames;
+  return std::max(periods, (snd_pcm_uframes_t) 1) * period_frames;
+};
+
+int AlsaMinder::setWakeFrames(snd_pcm_uframes_t frames) {
+  snd_pcm_sw_params_t *swparams;
+  snd_pcm_sw_params_alloca( & swparams);
+
+  if (snd_pcm_sw_params_current(pcm, swparams)
+      || snd_pcm_sw_params_set_avail_min(pcm, swparams, frames)
+      || snd_pcm_sw_params(pcm, swparams))
+    return 1;
+  wake_frames = frames;
+  return 0;
+};
+
+void AlsaMinder::hw_setLowLatency(bool lowLatency) {
+  if (! adaptivePeriod || lowLatency == this->lowLatency)
+    return;
+  this->lowLatency = lowLatency;
+  // sw params can be changed on a running stream, so there's no need
+  // to stop the device; if it isn't open, hw_open() will use the new value
+  if (pcm && setWakeFrames(wakeFramesFor(lowLatency))) {
+    std::ostringstream msg;
+    msg << "\"event\":\"devProblem\",\"error\":\"unable to set avail_min\",\"devLabel\":\"" << label << "\"";
+    Pollable::asyncMsg(msg.str());
+  }
+};
+
+string AlsaMinder::hw_toJSON() {
+  ostringstream s;
+  s << ",\"periodFrames\":" << period_frames
+    << ",\"bufferFrames\":" << buffer_frames
+    << ",\"adaptivePeriod\":" << (adaptivePeriod ? "true" : "false")
+    << ",\"wakeFrames\":" << (adaptivePeriod ? wake_frames : period_frames);
+  return s.str();
+};
+
+string AlsaMinder::hw_configJSON() {
+  // period and buffer as negotiated with ALSA, so a device reopened from
+  // these asks for the sizes it got last time
+  ostringstream s;
+  s << ",\"period\":";
+  if (adaptivePeriod)
+    s << (period_frames == LOW_LATENCY_PERIOD_FRAMES ? "\"lowlatency\"" : "\"auto\"");
+  else
+    s << period_frames;
+  s << ",\"buffer\":" << buffer_frames
+    << ",\"format\":\"" << (requestedFormat == SampleFormat::AUTO ? "auto" : SampleFormat::name(requestedFormat)) << "\"";
+  return s.str();
+};
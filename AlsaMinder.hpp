@@ -18,6 +18,9 @@ public:
 
   static const int  PERIOD_FRAMES         = 4800;   // 40 periods per second for FCD Pro +; 20 periods per second for FCD Pro
   static const int  BUFFER_FRAMES         = 131072; // 128K appears to be max buffer size in frames; this is 0.683 s for FCD Pro+, 1.365 s for FCD Pro
+  static const int  ADAPTIVE_PERIOD_FRAMES = 1024;  // default period in adaptive mode; wakeups are batched into multiples of this
+  static const int  LOW_LATENCY_PERIOD_FRAMES = 256; // period for the low-latency profile (adaptive mode with small periods)
+  static const int  HIGH_LATENCY_BUFFER_FRACTION = 4; // in adaptive mode with no low-latency consumers, wake when this fraction of the buffer is full
 
 protected:
 
@@ -29,13 +32,19 @@ protected:
                                       // it)
   snd_pcm_uframes_t period_frames;    // period size given to us by ALSA (we attempt to specify
                                       // it)
+  bool              adaptivePeriod;   // if true, choose number of frames per wakeup according
+                                      // to the latency needs of consumers
+  bool              lowLatency;       // in adaptive mode, is there a consumer needing low latency?
+  snd_pcm_uframes_t wake_frames;      // in adaptive mode, frames available before poll() wakes us
+  SampleFormat::Code requestedFormat; // sample format to use; AUTO means choose from what
+                                      // the device supports
 public:
 
   virtual int hw_open();
 
   virtual bool hw_is_open();
 
-  AlsaMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now);
+  AlsaMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now, int periodFrames = 0, int bufferFrames = 0, bool adaptivePeriod = false, SampleFormat::Code sampleFormat = SampleFormat::AUTO);
 
   ~AlsaMinder();
 
@@ -45,7 +54,11 @@ public:
 
   virtual int hw_handleEvents ( struct pollfd *pollfds, bool timedOut);
 
-  virtual int hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp);
+  virtual int hw_getFrames (float *buf, int numFrames, double & frameTimestamp);
+
+  virtual string hw_toJSON();
+
+  virtual string hw_configJSON();
 
 protected:
 
@@ -54,6 +67,10 @@ protected:
   virtual int hw_do_stop();
   virtual int hw_do_restart();
   virtual bool hw_running(double timeNow);
+  virtual void hw_setLowLatency(bool lowLatency);
+  snd_pcm_uframes_t wakeFramesFor(bool lowLatency); // frames per wakeup in adaptive mode
+  int setWakeFrames(snd_pcm_uframes_t frames); // set avail_min on an open device; return 0 on success
+  int setFormat(snd_pcm_hw_params_t *params); // choose and set sample format; return 0 on success
 };
 
 #endif // ALSAMINDER_HPP
@@ -0,0 +1,102 @@
+#include "ClockModel.hpp"
+
+ClockModel::ClockModel(double nominalRate) :
+  nominalRate(nominalRate),
+  numRejected(0),
+  numResyncs(0)
+{
+  reset();
+};
+
+void ClockModel::reset() {
+  frame0 = 0;
+  ts0 = 0;
+  lastY = 0;
+  W = 0;
+  mx = my = 0;
+  Cxx = Cxy = 0;
+  slope = 1.0 / nominalRate;
+  resVar = 0;
+  numAccepted = 0;
+  outlierRun = 0;
+};
+
+void ClockModel::setNominalRate(double rate) {
+  nominalRate = rate;
+  reset();
+};
+
+double ClockModel::observe(long long frame, double ts) {
+  if (numAccepted == 0) {
+    // first observation since reset defines the origin
+    frame0 = frame;
+    ts0 = ts;
+    W = 1;
+    numAccepted = 1;
+    return ts;
+  }
+
+  double x = frame - frame0;
+  double y = ts - ts0;
+  double r = y - predict(x);
+
+  // until the model is valid, we only reject grossly wrong timestamps,
+  // using the nominal rate as a prior on the slope
+
+  double thresh = isValid() ? std::max(OUTLIER_SIGMAS * sqrt(resVar), RESIDUAL_FLOOR_USEC * 1.0e-6)
+    : WARMUP_TOLERANCE_MSEC * 1.0e-3;
+
+  if (fabs(r) > thresh) {
+    ++numRejected;
+    if (++outlierRun >= MAX_OUTLIER_RUN) {
+      // the device clock or system clock has apparently stepped
+      // (e.g. frames lost to an overrun, or NTP correction), so
+      // start over with this observation
+      ++numResyncs;
+      reset();
+      return observe(frame, ts);
+    }
+    return isValid() ? timeOf(frame) : ts;
+  }
+  outlierRun = 0;
+
+  // exponentially down-weight old observations, by the time elapsed since
+  // the previous accepted one
+
+  double lambda = y > lastY ? exp((lastY - y) / WINDOW_SECONDS) : 1.0;
+  lastY = y;
+
+  // weighted incremental update of means and (co)variance; working
+  // with deviations from the means keeps this numerically stable even
+  // for very large frame counts
+
+  W = lambda * W + 1;
+  double dx = x - mx;
+  double dy = y - my;
+  mx += dx / W;
+  my += dy / W;
+  Cxx = lambda * Cxx + dx * (x - mx);
+  Cxy = lambda * Cxy + dx * (y - my);
+
+  // don't believe slopes implying an absurd clock offset; these can
+  // only occur while the observations span a short interval
+
+  double s = Cxx > 0 ? Cxy / Cxx : 0;
+  if (fabs(s * nominalRate - 1.0) < MAX_PPM * 1.0e-6)
+    slope = s;
+
+  resVar += (r * r - resVar) / W;
+  ++numAccepted;
+
+  return isValid() ? timeOf(frame) : ts;
+};
+
+double ClockModel::timeOf(long long frame) {
+  return ts0 + predict(frame - frame0);
+};
+
+double ClockModel::ppm() {
+  if (! isValid())
+    return 0;
+  return (1.0 / (slope * nominalRate) - 1.0) * 1.0e6;
+};
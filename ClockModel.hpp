@@ -0,0 +1,65 @@
+#ifndef CLOCKMODEL_HPP
+#define CLOCKMODEL_HPP
+
+/*
+  Model of a device's sample clock against system time.
+
+  Each batch of frames read from a device comes with a timestamp for
+  its first frame (from snd_pcm_htimestamp, or from rtl_tcp segment
+  headers).  These timestamps are jittery, so we fit a running,
+  exponentially-weighted linear regression of system time against
+  frame count, rejecting outliers, and use the fitted line to
+  timestamp frames.  The slope of the line gives the offset of the
+  device clock from its nominal rate, in parts per million.
+*/
+
+#include <cmath>
+#include <algorithm>
+
+class ClockModel {
+
+public:
+
+  static const int WINDOW_SECONDS        = 300;  // time constant for exponential down-weighting of old observations
+  static const int MIN_POINTS            = 16;   // don't use the model until this many observations have been accepted
+  static const int OUTLIER_SIGMAS        = 5;    // reject observations whose residual exceeds this many residual SDs
+  static const int RESIDUAL_FLOOR_USEC   = 200;  // ...but never reject residuals smaller than this many microseconds
+  static const int MAX_OUTLIER_RUN       = 20;   // after this many consecutive outliers, assume a clock step and resync
+  static const int WARMUP_TOLERANCE_MSEC = 20;   // before the model is valid, reject residuals larger than this many milliseconds
+  static const int MAX_PPM               = 2000; // ignore fitted slopes implying a larger clock offset than this
+
+  ClockModel(double nominalRate = 1.0);
+
+  void reset();                             // forget all observations (e.g. after device restart or overrun)
+  void setNominalRate(double rate);         // set nominal frame rate; resets the model
+  double observe(long long frame, double ts); // add observation of timestamp ts for frame; returns fitted timestamp for frame
+  double timeOf(long long frame);           // fitted timestamp for frame; only meaningful if isValid()
+  bool isValid() {return numAccepted >= MIN_POINTS;};
+  double ppm();                             // offset of device frame rate from nominal, in parts per million
+  double residualRMS() {return sqrt(resVar);}; // RMS of timestamp residuals, in seconds
+  long long getNumAccepted() {return numAccepted;};
+  long long getNumRejected() {return numRejected;};
+  long long getNumResyncs() {return numResyncs;};
+
+protected:
+
+  double      nominalRate;  // nominal frames per second
+  long long   frame0;       // frame number of first observation since reset; x values are relative to this
+  double      ts0;          // timestamp of first observation since reset; y values are relative to this
+  double      lastY;        // y value of most recent accepted observation, for computing decay
+  double      W;            // sum of weights
+  double      mx;           // weighted mean of x (frames since frame0)
+  double      my;           // weighted mean of y (seconds since ts0)
+  double      Cxx;          // weighted sum of squared deviations of x
+  double      Cxy;          // weighted sum of cross deviations of x and y
+  double      slope;        // fitted seconds per frame
+  double      resVar;       // exponentially weighted variance of accepted residuals (secs^2)
+  long long   numAccepted;  // observations accepted since reset
+  long long   numRejected;  // observations rejected as outliers, total
+  long long   numResyncs;   // times the model was reset due to a run of outliers
+  int         outlierRun;   // number of consecutive outliers
+
+  double predict(double x) {return my + slope * (x - mx);};
+};
+
+#endif // CLOCKMODEL_HPP
@@ -0,0 +1,301 @@
+#include "Config.hpp"
+#include "DevMinder.hpp"
+#include "AlsaMinder.hpp"
+#include "PluginCache.hpp"
+#include "WavFileWriter.hpp"
+#include "DeviceGroup.hpp"
+#include "CrossCorrelator.hpp"
+#include "VampAlsaHost.hpp"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+#include <cmath>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+
+using boost::property_tree::ptree;
+
+std::string Config::snapshotFile;
+
+typedef std::vector < std::pair < string, string > > LibraryList; // (soname, plugin id)
+
+static void openDevice(DevMinder * dev, int * result) {
+  // runs on its own thread
+  * result = dev->open();
+};
+
+static void loadLibraries(LibraryList libs) {
+  // runs on its own thread; PluginCache serializes loads, but they
+  // overlap with the device opens
+  std::vector < string > keys;
+  for (size_t i = 0; i < libs.size(); ++i)
+    PluginCache::preload(libs[i].first, libs[i].second, keys);
+};
+
+static bool report(const string &what, const string &label, const string &reply) {
+  // report an error reply from runCommand; returns true if there was one
+  if (reply.compare(0, 8, "{\"error\"") != 0)
+    return false;
+  std::cerr << "config: " << what << " '" << label << "': " << reply.substr(0, reply.find_last_not_of('\n') + 1) << std::endl;
+  return true;
+};
+
+static string listField(const ptree &p, const string &name) {
+  // a list given either as a JSON array or as a comma-separated string
+  const ptree & f = p.get_child(name, ptree());
+  if (f.empty())
+    return f.data();
+  string s;
+  for (ptree::const_iterator it = f.begin(); it != f.end(); ++it)
+    s += (s.length() ? "," : "") + it->second.data();
+  return s;
+};
+
+int Config::load(const std::string &filename) {
+  ptree conf;
+  try {
+    read_json(filename, conf);
+  } catch (boost::property_tree::json_parser_error e) {
+    throw std::runtime_error(string("unable to read config file ") + e.what());
+  }
+
+  int errors = 0;
+  double now = VampAlsaHost::now();
+  const ptree none;
+
+  // create devices, without opening them
+
+  std::vector < DevMinder * > devs;
+  std::vector < bool > startDev;
+  const ptree & devices = conf.get_child("devices", none);
+  for (ptree::const_iterator it = devices.begin(); it != devices.end(); ++it) {
+    const ptree & d = it->second;
+    string label = d.get < string > ("label", "");
+    try {
+      if (label == "" || Pollable::lookupByName(label))
+        throw std::runtime_error("missing or duplicate label");
+      string period = d.get < string > ("period", "");
+      int periodFrames = 0;
+      bool adaptivePeriod = false;
+      if (period == "auto") {
+        adaptivePeriod = true;
+      } else if (period == "lowlatency") {
+        adaptivePeriod = true;
+        periodFrames = AlsaMinder::LOW_LATENCY_PERIOD_FRAMES;
+      } else {
+        periodFrames = atoi(period.c_str());
+      }
+      bool start = d.get < bool > ("start", true);
+      bool fm = d.get < bool > ("fm", false);
+      double statsWindow = d.get < double > ("statsWindow", DevMinder::DEFAULT_STATS_WINDOW);
+      double noiseWindow = d.get < double > ("noiseWindow", DevMinder::DEFAULT_NOISE_WINDOW);
+      DevMinder * dev = DevMinder::newDevMinder(d.get < string > ("device"), d.get < int > ("rate"), d.get < int > ("channels"), label, now,
+                                                periodFrames, d.get < int > ("buffer", 0), adaptivePeriod,
+                                                SampleFormat::fromName(d.get < string > ("format", "auto")));
+      try {
+        dev->setDemodFMForRaw(fm);
+        dev->setStatsWindows(statsWindow, noiseWindow);
+      } catch (std::runtime_error e) {
+        // a rejected device must not be opened and started with the rest
+        Pollable::remove(label);
+        throw;
+      }
+      devs.push_back(dev);
+      startDev.push_back(start);
+    } catch (std::runtime_error e) {
+      std::cerr << "config: device '" << label << "': " << e.what() << std::endl;
+      ++errors;
+    }
+  }
+
+  // open all devices, and load all plugin libraries, in parallel
+
+  LibraryList libs;
+  const ptree & plugins = conf.get_child("plugins", none);
+  for (ptree::const_iterator it = plugins.begin(); it != plugins.end(); ++it)
+    libs.push_back(std::make_pair(it->second.get < string > ("library", ""), it->second.get < string > ("plugin", "")));
+
+  std::vector < int > opened(devs.size(), 1);
+  boost::thread_group threads;
+  for (size_t i = 0; i < devs.size(); ++i)
+    threads.create_thread(boost::bind(openDevice, devs[i], & opened[i]));
+  threads.create_thread(boost::bind(loadLibraries, libs));
+  threads.join_all();
+
+  for (size_t i = 0; i < devs.size(); ++i) {
+    if (opened[i]) {
+      std::cerr << "config: device '" << devs[i]->label << "': Could not open source device or could not set required parameters" << std::endl;
+      ++errors;
+      Pollable::remove(devs[i]->label);
+      devs[i] = 0;
+    }
+  }
+
+  // device groups, as if by group commands, so plugins can be attached to them
+
+  const ptree & groups = conf.get_child("groups", none);
+  for (ptree::const_iterator it = groups.begin(); it != groups.end(); ++it) {
+    string label = it->second.get < string > ("label", "");
+    string members = listField(it->second, "devices");
+    for (size_t i = 0; i < members.size(); ++i)
+      if (members[i] == ',')
+        members[i] = ' ';
+    if (report("group", label, VampAlsaHost::runCommand("group " + label + " " + members, "")))
+      ++errors;
+  }
+
+  // attach plugins, as if by attach commands; the libraries are now cached
+
+  for (ptree::const_iterator it = plugins.begin(); it != plugins.end(); ++it) {
+    const ptree & p = it->second;
+    string label = p.get < string > ("label", "");
+    ostringstream cmd;
+    cmd << "attach " << p.get < string > ("device", "");
+    string channels = listField(p, "channels");
+    if (channels.length() > 0)
+      cmd << ":" << channels;
+    cmd << " " << label << " " << p.get < string > ("library", "") << " " << p.get < string > ("plugin", "") << " " << p.get < string > ("output", "");
+    const ptree & params = p.get_child("params", none);
+    for (ptree::const_iterator ip = params.begin(); ip != params.end(); ++ip)
+      cmd << " " << ip->first << " " << ip->second.data();
+
+    if (report("plugin", label, VampAlsaHost::runCommand(cmd.str(), ""))) {
+      ++errors;
+      continue;
+    }
+    string schedule = p.get < string > ("schedule", "");
+    if (schedule.length() > 0 && report("plugin", label, VampAlsaHost::runCommand("schedule " + label + " " + schedule, "")))
+      ++errors;
+    if (p.get < bool > ("lowLatency", false) && report("plugin", label, VampAlsaHost::runCommand("lowLatency " + label + " on", "")))
+      ++errors;
+    const ptree & state = p.get_child("state", none);
+    PluginRunner * pr = dynamic_cast < PluginRunner * > (Pollable::lookupByName(label));
+    if (pr && ! state.empty())
+      pr->restoreCounters(state.get < long long > ("totalFrames", 0), state.get < long long > ("totalFeatures", 0), state.get < long long > ("framesSkipped", 0));
+  }
+
+  // cross-correlators, as if by xcorr commands
+
+  const ptree & correlators = conf.get_child("correlators", none);
+  for (ptree::const_iterator it = correlators.begin(); it != correlators.end(); ++it) {
+    const ptree & x = it->second;
+    string label = x.get < string > ("label", "");
+    ostringstream cmd;
+    cmd << "xcorr " << x.get < string > ("device", "");
+    string channels = listField(x, "channels");
+    if (channels.length() > 0)
+      cmd << ":" << channels;
+    cmd << " " << label << " " << x.get < string > ("blockFrames", "") << " " << x.get < string > ("maxLag", "");
+    if (report("correlator", label, VampAlsaHost::runCommand(cmd.str(), "")))
+      ++errors;
+  }
+
+  // raw file writers, as if by rawFile commands, but allowing an empty path,
+  // which is a writer waiting for its next rawFile command
+
+  const ptree & rawFiles = conf.get_child("rawFiles", none);
+  for (ptree::const_iterator it = rawFiles.begin(); it != rawFiles.end(); ++it) {
+    const ptree & r = it->second;
+    string devLabel = r.get < string > ("device", "");
+    try {
+      DevMinder * dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(devLabel));
+      if (! dev)
+        throw std::runtime_error("LABEL does not specify a known open device");
+      string wavLabel = devLabel + "_FileWriter";
+      if (Pollable::lookupByName(wavLabel))
+        throw std::runtime_error("device already has a raw file writer");
+      int rate = r.get < int > ("rate");
+      string path = r.get < string > ("path", "");
+      WavFileWriter * wav = new WavFileWriter (devLabel, wavLabel, const_cast < char * > (path.c_str()), r.get < uint32_t > ("frames"), rate, dev->numChan, dev->sampleFormat);
+      dev->addRawListener(wavLabel, round(dev->hwRate / rate));
+      const ptree & state = r.get_child("state", none);
+      if (! state.empty())
+        wav->restoreCounters(state.get < uint32_t > ("totalFilesWritten", 0), state.get < uint64_t > ("totalSecondsWritten", 0),
+                             state.get < double > ("prevFileTimestamp", -1), state.get < double > ("currFileTimestamp", -1),
+                             state.get < double > ("prevSecondsWritten", 0));
+    } catch (std::runtime_error e) {
+      std::cerr << "config: raw file for device '" << devLabel << "': " << e.what() << std::endl;
+      ++errors;
+    }
+  }
+
+  // any other commands
+
+  const ptree & commands = conf.get_child("commands", none);
+  for (ptree::const_iterator it = commands.begin(); it != commands.end(); ++it)
+    if (report("command", it->second.data(), VampAlsaHost::runCommand(it->second.data(), "")))
+      ++errors;
+
+  // and start devices; they join the poll loop on its first pass
+
+  for (size_t i = 0; i < devs.size(); ++i) {
+    if (devs[i] && startDev[i] && devs[i]->start(now)) {
+      std::cerr << "config: device '" << devs[i]->label << "': unable to start" << std::endl;
+      ++errors;
+    }
+  }
+  Pollable::requestPollFDRegen();
+
+  return errors;
+};
+
+int Config::save(const std::string &filename) {
+  std::ostringstream devices, groups, plugins, correlators, rawFiles;
+  int n = 0;
+  for (PollableSet::iterator ip = Pollable::pollables.begin(); ip != Pollable::pollables.end(); ++ip) {
+    Pollable * p = ip->second.get();
+    DevMinder * dev = dynamic_cast < DevMinder * > (p);
+    PluginRunner * pr = dynamic_cast < PluginRunner * > (p);
+    WavFileWriter * wav = dynamic_cast < WavFileWriter * > (p);
+    DeviceGroup * group = dynamic_cast < DeviceGroup * > (p);
+    CrossCorrelator * xc = dynamic_cast < CrossCorrelator * > (p);
+    if (dev)
+      devices << (devices.tellp() > 0 ? ",\n    " : "") << dev->configJSON();
+    else if (group)
+      groups << (groups.tellp() > 0 ? ",\n    " : "") << group->configJSON();
+    else if (pr)
+      plugins << (plugins.tellp() > 0 ? ",\n    " : "") << pr->configJSON();
+    else if (xc)
+      correlators << (correlators.tellp() > 0 ? ",\n    " : "") << xc->configJSON();
+    else if (wav)
+      rawFiles << (rawFiles.tellp() > 0 ? ",\n    " : "") << wav->configJSON();
+    else
+      continue;
+    ++n;
+  }
+
+  // write to a temporary file and rename it, so that a crash while
+  // saving leaves the previous snapshot intact
+
+  string tmp = filename + ".tmp";
+  {
+    std::ofstream f(tmp.c_str());
+    f << "{\n"
+      << "  \"snapshotTime\": " << std::setprecision(14) << VampAlsaHost::now() << ",\n"
+      << "  \"devices\": [\n    " << devices.str() << "\n  ],\n"
+      << "  \"groups\": [\n    " << groups.str() << "\n  ],\n"
+      << "  \"plugins\": [\n    " << plugins.str() << "\n  ],\n"
+      << "  \"correlators\": [\n    " << correlators.str() << "\n  ],\n"
+      << "  \"rawFiles\": [\n    " << rawFiles.str() << "\n  ]\n"
+      << "}\n";
+    f.close();
+    if (! f)
+      throw std::runtime_error(string("unable to write snapshot file ") + tmp);
+  }
+  if (rename(tmp.c_str(), filename.c_str()))
+    throw std::runtime_error(string("unable to rename snapshot file to ") + filename);
+  return n;
+};
+
+void Config::saveSnapshot() {
+  if (snapshotFile.length() == 0)
+    return;
+  try {
+    save(snapshotFile);
+  } catch (std::runtime_error e) {
+    std::cerr << "snapshot: " << e.what() << std::endl;
+  }
+};
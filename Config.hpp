@@ -0,0 +1,92 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+/*
+  Startup configuration from a JSON file (the -c option).
+
+  Rather than have a supervisor replay open / attach / ... commands
+  over the socket after each start, the devices, plugins and any other
+  commands can be given in a file, e.g.:
+
+  {
+    "devices": [
+      {"label": "1", "device": "hw:CARD=V10", "rate": 48000, "channels": 2,
+       "period": "auto", "buffer": 0, "format": "auto", "start": true}
+    ],
+    "plugins": [
+      {"label": "pulse1", "device": "1", "channels": "0,1",
+       "library": "lotek-plugins.so", "plugin": "findpulsefdbatch", "output": "pulses",
+       "params": {"minsnr": 6}, "schedule": "always", "lowLatency": false}
+    ],
+    "commands": [
+      "rawFile 1 48000 2880000 \"/data/%Y-%m-%dT%H-%M-%S.wav\""
+    ]
+  }
+
+  Device fields are as for the open command, and only label, device,
+  rate and channels are required; plugin fields are as for attach,
+  schedule and lowLatency.  An optional "groups" list gives device
+  groups, as for the group command, e.g.
+  {"label": "df", "devices": ["1", "2"]}; groups are made after the
+  devices are opened, so plugins can be attached to them.  Likewise,
+  an optional "correlators" list gives cross-correlators, as for the
+  xcorr command, e.g.
+  {"label": "tdoa1", "device": "1", "channels": "0,1", "blockFrames": 4096, "maxLag": 64}
+
+  Commands are run after all devices and plugins are set up, as if
+  from a connection which then closes, so commands which send data to
+  their connection (e.g. rawStream) are of no use here.
+
+  Setting up is what takes the time: opening an ALSA device is a long
+  series of snd_pcm_*_params calls, and loading a plugin library means
+  searching the Vamp path.  So each device is opened on its own thread,
+  while another thread loads the plugin libraries into PluginCache.
+  Once all threads have finished, plugins are attached (from the cache)
+  and devices started on the main thread, before the first poll.
+
+  A snapshot (the snapshot command, and the -r option) is a config file
+  written by save(), describing what is running now: each device with
+  the period and buffer sizes it was given, plus "fm", "statsWindow" and
+  "noiseWindow"; each device group and cross-correlator; each plugin
+  with its current parameters and schedule; and a "rawFiles" list of
+  raw file writers, as for rawFile, e.g.:
+
+    "rawFiles": [
+      {"device": "1", "rate": 48000, "frames": 2880000, "path": "/data/%Y-%m-%dT%H-%M-%S.wav",
+       "state": {"totalFilesWritten": 12, "totalSecondsWritten": 720, "prevFileTimestamp": 1760000000.5,
+                 "currFileTimestamp": 1760000060.5, "prevSecondsWritten": 60}}
+    ]
+
+  Plugins and raw file writers have a "state" object of counters, so
+  that totals and the file timestamps used to estimate clock bias carry
+  over a restart.  A plugin's internal state can't be saved through the
+  Vamp API, so a restored plugin starts from scratch with the saved
+  parameters.  Connections, and whatever depends on them (rawStream,
+  spectrograms and plugin output listeners), are not saved, since their
+  clients must reconnect anyway.
+*/
+
+#include <string>
+
+class Config {
+
+public:
+
+  // set up from the file; returns the number of devices, plugins and
+  // commands which failed, each having been reported on stderr.
+  // Throws std::runtime_error if the file can't be read or parsed.
+  static int load(const std::string &filename);
+
+  // write a snapshot of the current devices, groups, plugins and raw
+  // file writers to the file, replacing it atomically; returns the number of
+  // objects saved.  Throws std::runtime_error if the file can't be written.
+  static int save(const std::string &filename);
+
+  // save() to snapshotFile, if set, reporting any error on stderr; called
+  // on exit
+  static void saveSnapshot();
+
+  static std::string snapshotFile; // default file for snapshots; set by the -r option
+};
+
+#endif // CONFIG_HPP
@@ -0,0 +1,222 @@
+#include "CrossCorrelator.hpp"
+#include "FFTPlanCache.hpp"
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+
+// as in PluginRunner: format a number onto the end of s, without
+// allocating unless s has to grow
+
+static void appendNumber(string &s, const char *fmt, double x) {
+  char num[64];
+  int n = snprintf(num, sizeof(num), fmt, x);
+  if (n > 0)
+    s.append(num, std::min(n, (int) sizeof(num) - 1));
+};
+
+// out = conj(a) * b, for n complex values.  Written over the interleaved
+// floats, with no dependence between iterations, so that the compiler
+// vectorizes it (we build with -O3 -ftree-vectorize)
+
+static void conjMultiply(const fftwf_complex *a, const fftwf_complex *b, fftwf_complex *out, int n) {
+  const float * x = (const float *) a;
+  const float * y = (const float *) b;
+  float * z = (float *) out;
+  for (int i = 0; i < 2 * n; i += 2) {
+    float xr = x[i], xi = x[i + 1], yr = y[i], yi = y[i + 1];
+    z[i]     = xr * yr + xi * yi;
+    z[i + 1] = xr * yi - xi * yr;
+  }
+};
+
+CrossCorrelator::CrossCorrelator(const string &label, const string &devLabel, int rate, int chanA, int chanB, unsigned int maxSampleAbs,
+                                 int blockFrames, int maxLag) :
+  Pollable(label),
+  devLabel(devLabel),
+  rate(rate),
+  chanA(chanA),
+  chanB(chanB),
+  scale(1.0 / maxSampleAbs),
+  blockFrames(blockFrames),
+  maxLag(maxLag),
+  windowFrames(blockFrames + 2 * maxLag),
+  bufA(blockFrames + 2 * maxLag),
+  bufB(blockFrames + 2 * maxLag),
+  framesInBuf(0),
+  bufTimestamp(0),
+  numBlocks(0),
+  lastTimestamp(0),
+  lastLag(0),
+  lastStrength(0)
+{
+  fftSize = 1;
+  while (fftSize < windowFrames)
+    fftSize *= 2;
+
+  // plans can only be made on the poll thread, so make ours now
+  fftInA = fftwf_alloc_real(fftSize);
+  fftInB = fftwf_alloc_real(fftSize);
+  specA = fftwf_alloc_complex(fftSize / 2 + 1);
+  specB = fftwf_alloc_complex(fftSize / 2 + 1);
+  xcorr = fftwf_alloc_real(fftSize);
+  forwardPlan = FFTPlanCache::forward(fftSize, fftInA, specA);
+  inversePlan = FFTPlanCache::inverse(fftSize, specB, xcorr);
+};
+
+CrossCorrelator::~CrossCorrelator() {
+  fftwf_free(fftInA);
+  fftwf_free(fftInB);
+  fftwf_free(specA);
+  fftwf_free(specB);
+  fftwf_free(xcorr);
+};
+
+void CrossCorrelator::checkSettings(int blockFrames, int maxLag) {
+  if (blockFrames < 1 || maxLag < 1)
+    throw std::runtime_error("block size and maximum lag must be positive");
+  if (blockFrames + 2 * maxLag > MAX_FFT_SIZE)
+    throw std::runtime_error("block size plus twice the maximum lag must be at most 1048576");
+};
+
+bool CrossCorrelator::addOutputListener(string label) {
+  Pollable * outl = lookupByName(label);
+  if (outl) {
+    outputListeners.add(label, outl);
+    return true;
+  } else {
+    return false;
+  }
+};
+
+void CrossCorrelator::handleData(long avail, float *src, int numDevChan, double frameTimestamp) {
+  // same block assembly as SpectralStage::handleData, except that
+  // consecutive blocks overlap by 2 * maxLag frames
+
+  bufTimestamp = frameTimestamp - (double) framesInBuf / rate;
+
+  while (avail > 0) {
+    int frames_to_copy = std::min((int) avail, windowFrames - framesInBuf);
+
+    for (int i = framesInBuf; i < framesInBuf + frames_to_copy; ++i, src += numDevChan) {
+      bufA[i] = src[chanA] * scale;
+      bufB[i] = src[chanB] * scale;
+    }
+    avail -= frames_to_copy;
+    framesInBuf += frames_to_copy;
+
+    if (framesInBuf == windowFrames) {
+      correlate();
+      int keep = windowFrames - blockFrames;
+      memmove(& bufA[0], & bufA[blockFrames], keep * sizeof(float));
+      memmove(& bufB[0], & bufB[blockFrames], keep * sizeof(float));
+      framesInBuf = keep;
+      bufTimestamp += (double) blockFrames / rate;
+    }
+  }
+};
+
+void CrossCorrelator::correlate() {
+  // A's block sits at offset maxLag in an otherwise empty array, so that
+  // xcorr[k] (or xcorr[fftSize + k] for negative k) is r[k]
+
+  memset(fftInA, 0, fftSize * sizeof(float));
+  memcpy(fftInA + maxLag, & bufA[maxLag], blockFrames * sizeof(float));
+  memcpy(fftInB, & bufB[0], windowFrames * sizeof(float));
+  memset(fftInB + windowFrames, 0, (fftSize - windowFrames) * sizeof(float));
+
+  fftwf_execute_dft_r2c(forwardPlan, fftInA, specA);
+  fftwf_execute_dft_r2c(forwardPlan, fftInB, specB);
+  conjMultiply(specA, specB, specB, fftSize / 2 + 1);
+  fftwf_execute_dft_c2r(inversePlan, specB, xcorr);
+
+  int peak = 0;
+  float peakAbs = -1;
+  for (int k = -maxLag; k <= maxLag; ++k) {
+    float v = fabsf(xcorr[k < 0 ? fftSize + k : k]);
+    if (v > peakAbs) {
+      peakAbs = v;
+      peak = k;
+    }
+  }
+  float y1 = xcorr[peak < 0 ? fftSize + peak : peak];
+
+  // refine the peak by fitting a parabola to it and its neighbours
+  double frac = 0;
+  if (peak > -maxLag && peak < maxLag) {
+    float y0 = xcorr[peak - 1 < 0 ? fftSize + peak - 1 : peak - 1];
+    float y2 = xcorr[peak + 1 < 0 ? fftSize + peak + 1 : peak + 1];
+    float d = y0 - 2 * y1 + y2;
+    if (d != 0)
+      frac = std::max(-0.5, std::min(0.5, 0.5 * (y0 - y2) / d));
+  }
+
+  // normalize by the energies of A's block, and of B's frames at the peak lag
+  double ea = 0, eb = 0;
+  const float * a = & bufA[maxLag];
+  const float * b = & bufB[maxLag + peak];
+  for (int i = 0; i < blockFrames; ++i) {
+    ea += a[i] * a[i];
+    eb += b[i] * b[i];
+  }
+  // the inverse transform is unnormalized, so xcorr is fftSize * r
+  double norm = sqrt(ea * eb) * fftSize;
+
+  ++numBlocks;
+  lastTimestamp = bufTimestamp + (double) maxLag / rate;
+  lastLag = peak + frac;
+  lastStrength = norm > 0 ? y1 / norm : 0;
+
+  textBuf.clear();
+  textBuf += label;
+  textBuf += ',';
+  appendNumber(textBuf, "%.4f", lastTimestamp);
+  textBuf += ',';
+  appendNumber(textBuf, "%.3f", lastLag);
+  textBuf += ',';
+  appendNumber(textBuf, "%.4f", lastStrength);
+  textBuf += '\n';
+
+  for (size_t i = 0; i < outputListeners.size(); /**/) {
+    if (Pollable * ptr = outputListeners.at(i)) {
+      ptr->queueOutput(textBuf.data(), textBuf.length());
+      ++i;
+    } else {
+      outputListeners.removeAt(i);
+    }
+  }
+};
+
+string CrossCorrelator::toJSON() {
+  ostringstream s;
+  s << "{"
+    << "\"type\":\"CrossCorrelator\","
+    << "\"devLabel\":\"" << devLabel << "\","
+    << "\"channels\":[" << chanA << "," << chanB << "],"
+    << "\"rate\":" << rate << ","
+    << "\"blockFrames\":" << blockFrames << ","
+    << "\"maxLag\":" << maxLag << ","
+    << "\"fftSize\":" << fftSize << ","
+    << "\"numBlocks\":" << numBlocks << ","
+    << std::setprecision(14)
+    << "\"lastTimestamp\":" << lastTimestamp << ","
+    << std::setprecision(6)
+    << "\"lastLag\":" << lastLag << ","
+    << "\"lastLagSeconds\":" << lastLag / rate << ","
+    << "\"lastStrength\":" << lastStrength
+    << "}";
+  return s.str();
+};
+
+string CrossCorrelator::configJSON() {
+  ostringstream s;
+  s << "{"
+    << "\"label\":\"" << label << "\","
+    << "\"device\":\"" << devLabel << "\","
+    << "\"channels\":\"" << chanA << "," << chanB << "\","
+    << "\"blockFrames\":" << blockFrames << ","
+    << "\"maxLag\":" << maxLag
+    << "}";
+  return s.str();
+};
@@ -0,0 +1,101 @@
+#ifndef CROSSCORRELATOR_HPP
+#define CROSSCORRELATOR_HPP
+
+/*
+  Streaming cross-correlation between two channels of a device, for
+  estimating the difference in arrival time of a signal at two
+  antennas, without recording the raw data.
+
+  Data are taken in blocks of blockFrames frames.  For each block, the
+  cross-correlation
+
+      r[k] = sum over the block of a[n] * b[n + k],  -maxLag <= k <= maxLag
+
+  is computed by overlap-save: the block of channel A, zero padded, and
+  blockFrames + 2 * maxLag frames of channel B centred on it, are
+  transformed with a real FFT of size fftSize (the smallest power of
+  two holding them), multiplied (A conjugated), and transformed back.
+  Only lags up to maxLag are kept, and those are free of wraparound, so
+  consecutive blocks of B overlap by 2 * maxLag frames and each block's
+  result is delayed by maxLag frames.
+
+  The peak is the lag with the largest |r[k]|, refined to a fraction
+  of a frame by fitting a parabola through it and its neighbours.  A
+  positive lag means the signal reached channel B after channel A.
+  Strength is r at the peak, normalized by the energies of the two
+  channels over the block, so it lies in [-1, 1].
+
+  For each block, a line
+
+      LABEL,TIMESTAMP,LAG_FRAMES,STRENGTH
+
+  is sent to each output listener, as for a plugin's text output;
+  TIMESTAMP is that of the first frame of the block.
+*/
+
+#include <string>
+#include <vector>
+#include <fftw3.h>
+
+#include "Pollable.hpp"
+
+class CrossCorrelator : public Pollable {
+
+public:
+
+  static const int MAX_FFT_SIZE = 1 << 20;
+
+  string             devLabel;         // label of device from which we receive input
+
+protected:
+  int                rate;             // frames per second
+  int                chanA;            // device channel of reference signal
+  int                chanB;            // device channel whose lag is measured
+  float              scale;            // scale factor from device units to [-1, 1]
+  int                blockFrames;      // frames per result
+  int                maxLag;           // largest lag, in frames, in either direction
+  int                fftSize;          // transform size; a power of two, at least blockFrames + 2 * maxLag
+  int                windowFrames;     // blockFrames + 2 * maxLag; frames of B used for each block
+  std::vector < float > bufA;          // recent frames of A; the block starts at bufA[maxLag]
+  std::vector < float > bufB;          // recent frames of B
+  int                framesInBuf;      // frames in bufA and bufB
+  double             bufTimestamp;     // timestamp of bufA[0]
+  float *            fftInA;           // zero-padded block of A
+  float *            fftInB;           // window of B
+  fftwf_complex *    specA;            // transform of fftInA
+  fftwf_complex *    specB;            // transform of fftInB; then the cross spectrum
+  float *            xcorr;            // inverse transform of the cross spectrum
+  fftwf_plan         forwardPlan;      // owned by FFTPlanCache
+  fftwf_plan         inversePlan;      // owned by FFTPlanCache
+  long long          numBlocks;        // blocks correlated
+  double             lastTimestamp;    // timestamp of most recent block
+  double             lastLag;          // peak lag of most recent block, in frames
+  double             lastStrength;     // normalized correlation at that lag
+  string             textBuf;          // output line; its storage is reused
+  ListenerTable < Pollable > outputListeners; // connections receiving our output
+
+public:
+
+  CrossCorrelator(const string &label, const string &devLabel, int rate, int chanA, int chanB, unsigned int maxSampleAbs,
+                  int blockFrames, int maxLag); // settings must have passed checkSettings()
+  ~CrossCorrelator();
+
+  static void checkSettings(int blockFrames, int maxLag); // throws std::runtime_error if invalid
+
+  void handleData(long avail, float *src, int numDevChan, double frameTimestamp); // src holds avail frames of numDevChan interleaved channels
+  bool addOutputListener(string connLabel);
+  string toJSON();
+  string configJSON(); // this correlator as an entry in the "correlators" list of a config file; see Config.hpp
+
+  int getNumPollFDs() {return 0;};
+  int getPollFDs (struct pollfd * pollfds) {return 0;};
+  int getOutputFD(){return 0;};
+  void handleEvents (struct pollfd *pollfds, bool timedOut, double timeNow) {};
+  void stop(double timeNow) {};
+  int start(double timeNow) {return 0;};
+
+protected:
+  void correlate(); // correlate the block in bufA and bufB, and send the result
+};
+
+#endif // CROSSCORRELATOR_HPP
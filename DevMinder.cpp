@@ -5,23 +5,44 @@
 #include "AlsaMinder.hpp"
 #include "RTLSDRMinder.hpp"
 
+const double DevMinder::DEFAULT_STATS_WINDOW = 1.0;
+const double DevMinder::DEFAULT_NOISE_WINDOW = 60.0;
+const double DevMinder::CLIP_LEVEL = 0.999;
+const double DevMinder::IDLE_RESUME_LEAD = 5.0;
+
+inline void DevMinder::accumStats(BatchStats &b, float x, float clipLevel) {
+  b.sum += x;
+  b.sumSquares += x * x;
+  float a = fabsf(x);
+  if (a > b.peak)
+    b.peak = a;
+  if (a >= clipLevel)
+    ++ b.clips;
+};
+
 void DevMinder::delete_privates() {
   if (Pollable::terminating)
     return;
-  for (PluginRunnerSet::iterator ip = plugins.begin(); ip != plugins.end(); /**/) {
-    Pollable::remove(ip->first);
-    PluginRunnerSet::iterator del = ip++;
-    plugins.erase(del);
-  }
+  for (size_t i = 0; i < plugins.size(); ++i)
+    Pollable::remove(plugins.labelAt(i));
+  plugins.clear();
+  for (size_t i = 0; i < spectrograms.size(); ++i)
+    Pollable::remove(spectrograms.labelAt(i));
+  spectrograms.clear();
+  for (size_t i = 0; i < correlators.size(); ++i)
+    Pollable::remove(correlators.labelAt(i));
+  correlators.clear();
 };
 
 int DevMinder::open() {
   int rv = hw_open();
   downSampleFactor = hwRate / rate;
+  clockModel.setNominalRate(hwRate);
   return rv;
 };
 
 void DevMinder::stop(double timeNow) {
+  endIdle(timeNow);
   shouldBeRunning = false;
   Pollable::requestPollFDRegen();
   hw_do_stop();
@@ -32,10 +53,12 @@ void DevMinder::stop(double timeNow) {
 int DevMinder::do_restart(double timeNow) {
   hasError = 0;
   startTimestamp = timeNow;
+  clockModel.reset();
   return hw_do_restart();
 }
 
 int DevMinder::start(double timeNow) {
+  endIdle(timeNow);
   shouldBeRunning = true;
   if (hw_running(timeNow))
     return 0;
@@ -45,6 +68,8 @@ int DevMinder::start(double timeNow) {
   int rv = hw_do_start();
   if (! rv) {
     stopped = false;
+    // frames are lost while stopped, so the clock model must start over
+    clockModel.reset();
     // set timestamps to:
     // - prevent warning about resuming after long pause
     // - allow us to notice no data has been received for too long after startup
@@ -54,18 +79,59 @@ int DevMinder::start(double timeNow) {
 };
 
 void DevMinder::addPluginRunner(std::string &label, shared_ptr < PluginRunner > pr) {
-  plugins[label] = pr;
+  if (pr && pr->isFrequencyDomain()) {
+    // share a spectral stage with any other plugin using the same block
+    // size, step size and channels; otherwise make a new one
+    shared_ptr < SpectralStage > stage;
+    for (size_t i = 0; i < spectralStages.size(); ++i)
+      if (spectralStages[i]->matches(pr->getBlockSize(), pr->getStepSize(), pr->getChannelMap())) {
+        stage = spectralStages[i];
+        break;
+      }
+    if (! stage) {
+      stage = shared_ptr < SpectralStage > (new SpectralStage(rate, pr->getBlockSize(), pr->getStepSize(), pr->getChannelMap(), 1.0 / maxSampleAbs));
+      spectralStages.push_back(stage);
+    }
+    pr->setSpectralStage(stage);
+  }
+  plugins.add(label, pr.get());
+  consumersChanged();
 };
 
 void DevMinder::removePluginRunner(std::string &label) {
   // remove plugin runner
-  plugins.erase(label);
+  plugins.remove(label);
+  pruneSpectralStages();
+  consumersChanged();
+};
+
+shared_ptr < RawChunk > DevMinder::getRawChunk() {
+  // a chunk held only by the pool has been written by all listeners;
+  // reusing it keeps its data buffer, so steady-state raw output doesn't
+  // allocate
+  for (size_t i = 0; i < rawChunkPool.size(); ++i)
+    if (rawChunkPool[i].use_count() == 1)
+      return rawChunkPool[i];
+  shared_ptr < RawChunk > chunk(new RawChunk());
+  if (rawChunkPool.size() < RAW_CHUNK_POOL_SIZE)
+    rawChunkPool.push_back(chunk);
+  return chunk;
+};
+
+void DevMinder::pruneSpectralStages() {
+  // a stage held only by this device has no plugins left
+  for (size_t i = 0; i < spectralStages.size(); /**/) {
+    if (spectralStages[i].use_count() == 1)
+      spectralStages.erase(spectralStages.begin() + i);
+    else
+      ++i;
+  }
 };
 
 void DevMinder::addRawListener(string &label, int downSampleFactor, bool writeWavHeader, bool downSampleUseAvg) {
 
-  shared_ptr < Pollable > sptr;
-  rawListeners[label] = sptr = Pollable::lookupByNameShared(label);
+  Pollable * ptr = Pollable::lookupByName(label);
+  rawListeners.add(label, ptr);
   if (rawListeners.size() == 1) {
     this->downSampleFactor = downSampleFactor;
     this->downSampleUseAvg = downSampleUseAvg;
@@ -74,23 +140,138 @@ void DevMinder::addRawListener(string &label, int downSampleFactor, bool writeWa
       downSampleCount[i] = downSampleFactor;
     }
   }
-  if (writeWavHeader) {
-    Pollable *ptr = sptr.get();
-    if (ptr) {
-      // default max possible frames in .WAV header
-      // FIXME: hardcoded S16_LE format
-      WavFileHeader hdr(hwRate / downSampleFactor, numChan, 0x7ffffffe / 2);
-      ptr->queueOutput(hdr.address(), hdr.size());
-    }
+  if (writeWavHeader && ptr) {
+    // default max possible frames in .WAV header
+    WavFileHeader hdr(hwRate / downSampleFactor, numChan, 0x7ffffffe / (numChan * SampleFormat::bytes(sampleFormat)),
+                      SampleFormat::bits(sampleFormat), SampleFormat::wavFmtCode(sampleFormat));
+    ptr->queueOutput(hdr.address(), hdr.size());
   }
+  consumersChanged();
 };
 
 void DevMinder::removeRawListener(string &label) {
-  rawListeners.erase(label);
+  rawListeners.remove(label);
+  consumersChanged();
 };
 
 void DevMinder::removeAllRawListeners() {
   rawListeners.clear();
+  consumersChanged();
+};
+
+void DevMinder::addSpectrogram(string &label, Spectrogram * sp) {
+  spectrograms.add(label, sp);
+};
+
+void DevMinder::removeSpectrogram(string &label) {
+  spectrograms.remove(label);
+};
+
+void DevMinder::addGroup(const string &label, DeviceGroup * g) {
+  groups.add(label, g);
+  consumersChanged();
+};
+
+void DevMinder::removeGroup(const string &label) {
+  groups.remove(label);
+  consumersChanged();
+};
+
+void DevMinder::addCorrelator(string &label, CrossCorrelator * xc) {
+  correlators.add(label, xc);
+};
+
+bool DevMinder::haveLowLatencyConsumer() {
+  for (size_t i = 0; i < rawListeners.size(); ++i) {
+    Pollable * ptr = rawListeners.at(i);
+    if (ptr && ptr->wantsLowLatency())
+      return true;
+  }
+  for (size_t i = 0; i < plugins.size(); ++i) {
+    PluginRunner * ptr = plugins.at(i);
+    if (ptr && ptr->wantsLowLatency())
+      return true;
+  }
+  for (size_t i = 0; i < groups.size(); ++i) {
+    DeviceGroup * ptr = groups.at(i);
+    if (ptr && ptr->wantsLowLatency())
+      return true;
+  }
+  return false;
+};
+
+bool DevMinder::haveActiveConsumer(double t) {
+  if (rawListeners.size() > 0 || spectrograms.size() > 0 || groups.size() > 0 || correlators.size() > 0 || plugins.size() == 0)
+    return true;
+  for (size_t i = 0; i < plugins.size(); ++i) {
+    PluginRunner * ptr = plugins.at(i);
+    if (ptr && ptr->isScheduledAt(t))
+      return true;
+  }
+  return false;
+};
+
+void DevMinder::endIdle(double timeNow) {
+  if (! idleStopped)
+    return;
+  countIdleFrames(timeNow);
+  idleStopped = false;
+  idleSeconds += timeNow - idleSince;
+};
+
+void DevMinder::countIdleFrames(double timeNow) {
+  // plugins get neither data nor skipData() while the device is stopped,
+  // so count the frames they would have had; otherwise their
+  // activeFraction would ignore time spent idle-stopped
+  long long frames = (long long) ((timeNow - idleCounted) * rate);
+  if (frames <= 0)
+    return;
+  idleCounted += (double) frames / rate;
+  for (size_t i = 0; i < plugins.size(); ++i)
+    if (PluginRunner * ptr = plugins.at(i))
+      ptr->skipData(frames);
+};
+
+void DevMinder::resumeIfScheduled(double timeNow) {
+  if (! idleStopped)
+    return;
+  // keep plugins' activeFraction current during a long idle stop
+  countIdleFrames(timeNow);
+  // start early enough that data are flowing when the schedule opens
+  if (! haveActiveConsumer(timeNow + IDLE_RESUME_LEAD))
+    return;
+  std::ostringstream msg;
+  if (start(timeNow)) {
+    // start() has ended the idle stop; resume it, so that the next
+    // check tries again, and report only the first failure of a run
+    shouldBeRunning = false;
+    idleStopped = true;
+    idleSince = timeNow;
+    if (++ resumeFailures == 1) {
+      msg << "\"event\":\"devProblem\",\"error\":\"unable to resume after idle stop; will keep trying\",\"devLabel\":\"" << label << "\"";
+      Pollable::asyncMsg(msg.str());
+    }
+    return;
+  }
+  resumeFailures = 0;
+  msg << "\"event\":\"devResumed\",\"devLabel\":\"" << label << "\"";
+  Pollable::asyncMsg(msg.str());
+};
+
+void DevMinder::resumeIdleDevices(double timeNow) {
+  // idle-stopped devices have no fds, so nothing else would wake them;
+  // once a second is soon enough, given IDLE_RESUME_LEAD
+  static double lastCheck = 0;
+  if (timeNow - lastCheck < 1.0)
+    return;
+  lastCheck = timeNow;
+  for (PollableSet::iterator ip = Pollable::pollables.begin(); ip != Pollable::pollables.end(); ++ip)
+    if (DevMinder * dev = dynamic_cast < DevMinder * > (ip->second.get()))
+      dev->resumeIfScheduled(timeNow);
+};
+
+void DevMinder::consumersChanged() {
+  hw_setLowLatency(haveLowLatencyConsumer());
 };
 
 DevMinder::DevMinder(const string &devName, int rate, unsigned int numChan, unsigned int maxSampleAbs, const string &label, double now, int buffSize):
@@ -99,6 +280,7 @@ DevMinder::DevMinder(const string &devName, int rate, unsigned int numChan, unsi
   rate(rate),
   numChan(numChan),
   maxSampleAbs(maxSampleAbs),
+  sampleFormat(SampleFormat::S16_LE),
   totalFrames(0),
   startTimestamp(-1.0),
   stopTimestamp(now),
@@ -106,21 +288,88 @@ DevMinder::DevMinder(const string &devName, int rate, unsigned int numChan, unsi
   shouldBeRunning(false),
   stopped(true),
   hasError(0),
+  idleStopped(false),
+  idleSince(0),
+  idleCounted(0),
+  idleSeconds(0),
+  idleStops(0),
+  resumeFailures(0),
+  spectralIdle(false),
   demodFMForRaw(false),
   demodFMLastTheta(0),
-  sampleBuf(buffSize * numChan)
+  statsWindow(DEFAULT_STATS_WINDOW),
+  noiseWindow(DEFAULT_NOISE_WINDOW),
+  sampleBuf(buffSize * numChan),
+  wakeupCount(0),
+  wakeupWindowStart(now),
+  wakeupsPerSecond(0)
 {
+  resetStats();
 };
 
+void DevMinder::resetStats() {
+  for (int i = 0; i < MAX_CHANNELS; ++i) {
+    chanStats[i].dc = 0;
+    chanStats[i].meanSquare = 0;
+    chanStats[i].peak = 0;
+    chanStats[i].noise = 0;
+    chanStats[i].clips = 0;
+  }
+  statsFrames = 0;
+};
+
+void DevMinder::setStatsWindows(double statsWindow, double noiseWindow) {
+  if (! (statsWindow > 0 && noiseWindow > 0))
+    throw std::runtime_error("Statistics windows must be positive");
+  this->statsWindow = statsWindow;
+  this->noiseWindow = noiseWindow;
+};
+
+void DevMinder::updateStats(unsigned chan, const BatchStats &b, long frames) {
+  // fold one batch into the running statistics, with decay according to
+  // the batch's duration, so that results don't depend on period size
 
-DevMinder * DevMinder::getDevMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now) {
+  ChannelStats & s = chanStats[chan];
+  double mean = b.sum / frames;
+  double ms = b.sumSquares / frames;
+  double rms = sqrt(std::max(0.0, ms - mean * mean));
 
-  DevMinder * dev;
-  if (devName.substr( 0, 7 ) == "rtlsdr:") {
-    dev = new RTLSDRMinder(devName, rate, numChan, label, now);
+  if (statsFrames == 0) {
+    s.dc = mean;
+    s.meanSquare = ms;
+    s.peak = b.peak;
+    s.noise = rms;
   } else {
-    dev = new AlsaMinder(devName, rate, numChan, label, now);
+    double dt = (double) frames / hwRate;
+    double decay = exp(- dt / statsWindow);
+    s.dc += (1 - decay) * (mean - s.dc);
+    s.meanSquare += (1 - decay) * (ms - s.meanSquare);
+    s.peak = std::max((double) b.peak, s.peak * decay);
+    // the noise floor follows quiet batches down immediately, but rises slowly
+    if (rms < s.noise)
+      s.noise = rms;
+    else
+      s.noise += (1 - exp(- dt / noiseWindow)) * (rms - s.noise);
   }
+  s.clips += b.clips;
+};
+
+
+DevMinder * DevMinder::newDevMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now,
+                                     int periodFrames, int bufferFrames, bool adaptivePeriod, SampleFormat::Code sampleFormat) {
+
+  if (numChan < 1 || numChan > (unsigned) MAX_CHANNELS)
+    throw std::runtime_error("Invalid number of channels");
+
+  if (devName.substr( 0, 7 ) == "rtlsdr:")
+    return new RTLSDRMinder(devName, rate, numChan, label, now);
+  return new AlsaMinder(devName, rate, numChan, label, now, periodFrames, bufferFrames, adaptivePeriod, sampleFormat);
+};
+
+DevMinder * DevMinder::getDevMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now,
+                                     int periodFrames, int bufferFrames, bool adaptivePeriod, SampleFormat::Code sampleFormat) {
+
+  DevMinder * dev = newDevMinder(devName, rate, numChan, label, now, periodFrames, bufferFrames, adaptivePeriod, sampleFormat);
   if (dev->open()) {
     // there was an error, so throw an exception
     dev->delete_privates();
@@ -145,13 +394,66 @@ string DevMinder::toJSON() {
     << "\"rate\":" << rate << ","
     << "\"hwRate\":" << hwRate << ","
     << "\"numChan\":" << numChan << ","
+    << "\"sampleFormat\":\"" << SampleFormat::name(sampleFormat) << "\","
     << setprecision(14)
     << "\"startTimestamp\":" << startTimestamp << ","
     << "\"stopTimestamp\":" << stopTimestamp << ","
     << "\"running\":" << (stopped ? "false" : "true") << ","
     << "\"hasError\":" << hasError << ","
     << "\"totalFrames\":" << totalFrames << ","
-    << "\"numRawListeners\":" << rawListeners.size()
+    << "\"clockValid\":" << (clockModel.isValid() ? "true" : "false") << ","
+    << "\"clockPPM\":" << clockModel.ppm() << ","
+    << "\"clockResidualRMS\":" << clockModel.residualRMS() << ","
+    << "\"clockOutliers\":" << clockModel.getNumRejected() << ","
+    << "\"clockResyncs\":" << clockModel.getNumResyncs() << ","
+    << "\"numRawListeners\":" << rawListeners.size() << ","
+    << "\"numSpectrograms\":" << spectrograms.size() << ","
+    << "\"numGroups\":" << groups.size() << ","
+    << "\"numCorrelators\":" << correlators.size() << ","
+    << "\"idleStopped\":" << (idleStopped ? "true" : "false") << ","
+    << "\"idleStops\":" << idleStops << ","
+    << "\"resumeFailures\":" << resumeFailures << ","
+    << "\"idleSeconds\":" << idleSeconds + (idleStopped ? VampAlsaHost::now() - idleSince : 0) << ","
+    << "\"wakeupsPerSecond\":" << wakeupsPerSecond << ","
+    << setprecision(6)
+    << "\"stats\":{"
+    << "\"window\":" << statsWindow << ","
+    << "\"noiseWindow\":" << noiseWindow << ","
+    << "\"frames\":" << statsFrames << ","
+    << "\"channels\":[";
+  // levels are fractions of full scale, except for those in dB, which are dBFS
+  for (unsigned j = 0; j < numChan; ++j) {
+    const ChannelStats & cs = chanStats[j];
+    double rms = sqrt(std::max(0.0, cs.meanSquare - cs.dc * cs.dc)) / maxSampleAbs;
+    double noise = cs.noise / maxSampleAbs;
+    s << (j ? "," : "") << "{"
+      << "\"rms\":" << rms << ","
+      << "\"rmsDB\":" << 20 * log10(rms + 1e-10) << ","
+      << "\"peak\":" << cs.peak / maxSampleAbs << ","
+      << "\"dc\":" << cs.dc / maxSampleAbs << ","
+      << "\"noiseDB\":" << 20 * log10(noise + 1e-10) << ","
+      << "\"clips\":" << cs.clips
+      << "}";
+  }
+  s << "]}"
+    << hw_toJSON()
+    << "}";
+  return s.str();
+}
+
+string DevMinder::configJSON() {
+  // an idle-stopped device is still meant to be running
+  ostringstream s;
+  s << "{"
+    << "\"label\":\"" << label << "\","
+    << "\"device\":\"" << devName << "\","
+    << "\"rate\":" << rate << ","
+    << "\"channels\":" << numChan << ","
+    << "\"start\":" << (shouldBeRunning || idleStopped ? "true" : "false") << ","
+    << "\"fm\":" << (demodFMForRaw ? "true" : "false") << ","
+    << "\"statsWindow\":" << statsWindow << ","
+    << "\"noiseWindow\":" << noiseWindow
+    << hw_configJSON()
     << "}";
   return s.str();
 }
@@ -177,12 +479,20 @@ void DevMinder::handleEvents ( struct pollfd *pollfds, bool timedOut, double tim
     std::ostringstream msg;
     msg << "\"event\":\"devProblem\",\"error\":\" device returned with error " << (- avail) << "\",\"devLabel\":\"" << label << "\"";
     Pollable::asyncMsg(msg.str());
+    clockModel.reset();
     hw_do_restart();
     return;
   }
 
-  if (avail > 0)
+  if (avail > 0) {
     lastDataReceived = timeNow;
+    ++wakeupCount;
+  }
+  if (timeNow - wakeupWindowStart >= WAKEUP_RATE_WINDOW) {
+    wakeupsPerSecond = wakeupCount / (timeNow - wakeupWindowStart);
+    wakeupCount = 0;
+    wakeupWindowStart = timeNow;
+  }
 
   if (avail * numChan > sampleBuf.capacity()) {
     sampleBuf.resize(avail * numChan);
@@ -192,6 +502,17 @@ void DevMinder::handleEvents ( struct pollfd *pollfds, bool timedOut, double tim
 
   avail = hw_getFrames (& sampleBuf[0], avail, frameTimestamp);
 
+  // replace the device's jittery timestamp with a smoothed, drift-corrected one
+  // from the clock model.  A device may not have a timestamp for every batch
+  // (e.g. rtlsdr before the first segment header), in which case it reports 0.
+
+  if (avail > 0) {
+    if (frameTimestamp > 0)
+      frameTimestamp = clockModel.observe(totalFrames, frameTimestamp);
+    else if (clockModel.isValid())
+      frameTimestamp = clockModel.timeOf(totalFrames);
+  }
+
   totalFrames += avail;
 
   if (avail > 0) {
@@ -199,33 +520,36 @@ void DevMinder::handleEvents ( struct pollfd *pollfds, bool timedOut, double tim
     // FIXME: assumes interleaved channels
     // now downsample sampleBuf, using the running accumulator.
     // We downsample in-place, keeping track of the destination
-    // index in downSampleAvail;
+    // index in downSampleAvail.  Signal statistics are gathered in
+    // the same pass, from the full-rate samples.
 
     int downSampleAvail = avail;
+    float clipLevel = CLIP_LEVEL * maxSampleAbs;
 
-    if (downSampleFactor > 1) {
-      for (unsigned j = 0; j < numChan; ++j) {
+    for (unsigned j = 0; j < numChan; ++j) {
+      BatchStats bs = {0, 0, 0, 0};
+      if (downSampleFactor > 1) {
         downSampleAvail = 0; // works the same for all channels
         if (downSampleUseAvg) {
-          int16_t * rs = & sampleBuf[j];
-          int16_t * ds = rs;
+          float * rs = & sampleBuf[j];
+          float * ds = rs;
           for (int i=0; i < avail; ++i) {
+            accumStats(bs, *rs, clipLevel);
             downSampleAccum[j] += *rs;
             rs += numChan;
             if (! --downSampleCount[j]) {
               downSampleCount[j] = downSampleFactor;
-              // simple dithering: round to nearest int, but retain remainder in downSampleAccum
-              int16_t downSample = (downSampleAccum[j] + downSampleFactor / 2) / downSampleFactor;
-              *ds = downSample;
-              downSampleAccum[j] -= downSample * downSampleFactor;
+              *ds = downSampleAccum[j] / downSampleFactor;
+              downSampleAccum[j] = 0;
               ds += numChan;
               ++ downSampleAvail;
             }
           }
         } else {
-          int16_t * rs = & sampleBuf[j];
-          int16_t * ds = rs;
+          float * rs = & sampleBuf[j];
+          float * ds = rs;
           for (int i=0; i < avail; ++i) {
+            accumStats(bs, *rs, clipLevel);
             if (! --downSampleCount[j]) {
               downSampleCount[j] = downSampleFactor;
               *ds = *rs;
@@ -235,13 +559,20 @@ void DevMinder::handleEvents ( struct pollfd *pollfds, bool timedOut, double tim
             rs += numChan;
           }
         }
+      } else {
+        float * rs = & sampleBuf[j];
+        for (int i=0; i < avail; ++i, rs += numChan)
+          accumStats(bs, *rs, clipLevel);
       }
+      updateStats(j, bs, avail);
     }
+    statsFrames += avail;
+
     // if requested, do FM demodulation of the downsamples,
     if (numChan == 2 && demodFMForRaw) {
       // do in-place FM demodulation with simple but expensive arctan!
       // only first avail slots in sampleBuf will end up valid
-      float dthetaScale = hwRate / (2 * M_PI) / 75000.0 * 32767.0;
+      float dthetaScale = hwRate / (2 * M_PI) / 75000.0 * (32767.0 / 32768.0) * maxSampleAbs;
       for (int i=0; i < downSampleAvail; ++i) {
         // get phase angle in -pi..pi
         float theta = atan2f(sampleBuf[2*i], sampleBuf[2*i+1]);
@@ -252,38 +583,134 @@ void DevMinder::handleEvents ( struct pollfd *pollfds, bool timedOut, double tim
         } else if (dtheta < -M_PI) {
           dtheta += 2 * M_PI;
         }
-        sampleBuf[i] = roundf(dthetaScale * dtheta);
+        sampleBuf[i] = dthetaScale * dtheta;
       }
     }
 
 
     // there are now downSampleAvail samples, stored in sampleBuf[0..downSampleAvail * numChan - 1]
+    // Convert them back to the device's sample format for raw listeners.
+    // This is done once, into a chunk which is given to every listener;
+    // listeners which can keep a reference to it rather than copying it
+    // do so.
+
+    if (rawListeners.size() > 0) {
+      shared_ptr < RawChunk > chunk = getRawChunk();
+      chunk->data.resize(downSampleAvail * numChan * SampleFormat::bytes(sampleFormat));
+      chunk->timestamp = frameTimestamp;
+      if (chunk->data.size() > 0)
+        SampleFormat::fromFloat(sampleFormat, & sampleBuf[0], & chunk->data[0], downSampleAvail * numChan);
+      RawChunkPtr shared = chunk;
+
+      for (size_t i = 0; i < rawListeners.size(); /**/) {
+
+        if (Pollable * ptr = rawListeners.at(i)) {
+          ptr->queueChunk(shared);
+          ++i;
+        } else {
+          rawListeners.removeAt(i);
+          consumersChanged();
+        }
+      }
+    }
+    /*
+      find which plugins are within their schedules for this batch;
+      the others are skipped, but stay attached
+    */
 
-    for (RawListenerSet::iterator ir = rawListeners.begin(); ir != rawListeners.end(); /**/) {
+    bool anyActive = false;
+    pluginActive.resize(plugins.size());
+    for (size_t i = 0; i < plugins.size(); ++i) {
+      PluginRunner * ptr = plugins.at(i);
+      pluginActive[i] = ptr && ptr->isScheduledAt(frameTimestamp);
+      anyActive = anyActive || pluginActive[i];
+    }
 
-      if (Pollable * ptr = (ir->second).lock().get()) {
-        ptr->queueOutput((char *) & sampleBuf[0], downSampleAvail * 2 * numChan, frameTimestamp ); // NB: hardcoded S16_LE sample size
-        ++ir;
-      } else {
-        RawListenerSet::iterator to_delete = ir++;
-        rawListeners.erase(to_delete);
+    /*
+      transform the data once for each spectral stage, before any
+      frequency-domain plugins look at it
+    */
+
+    if (anyActive) {
+      for (size_t i = 0; i < spectralStages.size(); ++i) {
+        if (spectralIdle)
+          spectralStages[i]->reset();
+        spectralStages[i]->handleData(downSampleAvail, & sampleBuf[0], numChan, frameTimestamp);
       }
     }
+    spectralIdle = ! anyActive;
+
     /*
-      copy from sampleBuf to each attached plugin's buffer,
-      converting from S16_LE to float, and calling the plugin if its
-      buffer has reached blocksize
+      copy from sampleBuf to each attached plugin's buffer, selecting
+      the plugin's channels, scaling to the range [-1, 1], and
+      calling the plugin if its buffer has reached blocksize
     */
 
-    for (PluginRunnerSet::iterator ip = plugins.begin(); ip != plugins.end(); /**/) {
-      if (boost::shared_ptr < PluginRunner > ptr = (ip->second).lock()) {
-        ptr->handleData(downSampleAvail, & sampleBuf[0], & sampleBuf[1], 2, frameTimestamp);
-        ++ip;
+    for (size_t i = 0; i < plugins.size(); /**/) {
+      if (PluginRunner * ptr = plugins.at(i)) {
+        if (pluginActive[i])
+          ptr->handleData(downSampleAvail, & sampleBuf[0], numChan, frameTimestamp);
+        else
+          ptr->skipData(downSampleAvail);
+        ++i;
       } else {
-        PluginRunnerSet::iterator to_delete = ip++;
-        plugins.erase(to_delete);
+        plugins.removeAt(i);
+        pluginActive.erase(pluginActive.begin() + i);
+        pruneSpectralStages();
+        consumersChanged();
       }
     }
+
+    // a spectrogram whose connection has closed is no longer needed
+
+    for (size_t i = 0; i < spectrograms.size(); /**/) {
+      Spectrogram * ptr = spectrograms.at(i);
+      if (ptr && ! ptr->connectionClosed()) {
+        ptr->handleData(downSampleAvail, & sampleBuf[0], numChan, frameTimestamp);
+        ++i;
+      } else {
+        if (ptr)
+          Pollable::remove(spectrograms.labelAt(i));
+        spectrograms.removeAt(i);
+      }
+    }
+
+    // cross-correlators, like plugins, run on every batch
+
+    for (size_t i = 0; i < correlators.size(); /**/) {
+      if (CrossCorrelator * ptr = correlators.at(i)) {
+        ptr->handleData(downSampleAvail, & sampleBuf[0], numChan, frameTimestamp);
+        ++i;
+      } else {
+        correlators.removeAt(i);
+      }
+    }
+
+    // groups align this device's data with that of their other members
+
+    for (size_t i = 0; i < groups.size(); /**/) {
+      if (DeviceGroup * ptr = groups.at(i)) {
+        ptr->handleData(label, downSampleAvail, & sampleBuf[0], numChan, frameTimestamp);
+        ++i;
+      } else {
+        groups.removeAt(i);
+      }
+    }
+
+    // if the only consumers are plugins outside their schedules (and not
+    // due soon), stop the device to save power; resumeIdleDevices()
+    // restarts it when one is due
+
+    if (! stopped && frameTimestamp > 0 && ! haveActiveConsumer(frameTimestamp)
+        && ! haveActiveConsumer(frameTimestamp + IDLE_RESUME_LEAD)) {
+      stop(timeNow);
+      idleStopped = true;
+      idleSince = idleCounted = timeNow;
+      ++ idleStops;
+      std::ostringstream msg;
+      msg << "\"event\":\"devIdle\",\"devLabel\":\"" << label << "\"";
+      Pollable::asyncMsg(msg.str());
+    }
   } else if (shouldBeRunning && lastDataReceived >= 0 && timeNow - lastDataReceived > MAX_DEV_QUIET_TIME
              && ! (timeNow > 1000000000 && lastDataReceived < 1000000000)) {
     // this device appears to have stopped delivering audio; try restart it
@@ -14,28 +14,49 @@ using namespace std;
 #include "Pollable.hpp"
 #include "PluginRunner.hpp"
 #include "WavFileHeader.hpp"
-
-typedef std::map < string, weak_ptr < Pollable > > RawListenerSet;
-typedef std::map < string, weak_ptr < PluginRunner > > PluginRunnerSet;
+#include "ClockModel.hpp"
+#include "SampleFormat.hpp"
+#include "Spectrogram.hpp"
+#include "DeviceGroup.hpp"
+#include "CrossCorrelator.hpp"
+
+typedef ListenerTable < Pollable > RawListenerSet;
+typedef ListenerTable < PluginRunner > PluginRunnerSet;
+typedef ListenerTable < Spectrogram > SpectrogramSet;
+typedef ListenerTable < DeviceGroup > DeviceGroupSet;
+typedef ListenerTable < CrossCorrelator > CrossCorrelatorSet;
 
 class DevMinder : public Pollable {
 
 public:
 
-  static const int  MAX_CHANNELS          = 2;      // maximum of two channels per device
+  static const int  MAX_CHANNELS          = PluginRunner::MAX_NUM_CHAN; // maximum number of channels per device
   static const int  MAX_DEV_QUIET_TIME   = 30;     // 30 second maximum quiet time before we decide an device data stream is dry and try restart it
+  static const int  WAKEUP_RATE_WINDOW   = 10;     // seconds over which wakeups per second is estimated
+  static const unsigned RAW_CHUNK_POOL_SIZE = 32;  // maximum number of raw chunks kept for reuse
+  static const double DEFAULT_STATS_WINDOW;        // seconds; decay time for RMS, DC offset and peak
+  static const double DEFAULT_NOISE_WINDOW;        // seconds; rise time for noise floor
+  static const double CLIP_LEVEL;                  // fraction of full scale at or above which a sample counts as clipped
+  static const double IDLE_RESUME_LEAD;            // seconds before a plugin's schedule opens at which an idle device is restarted
 
   string             devName;          // path to device (e.g. hw:CARD=V10 for ALSA, or rtlsdr:/tmp/rtlsdr1:3 for rtl_tcp listening on /tmp/rtlsdr1:3
   int                rate;             // sampling rate to supply plugins with
   unsigned int       hwRate;           // sampling rate of hardware device
   unsigned int       numChan;          // number of channels to read from device
   unsigned int       maxSampleAbs;     // maximum absolute value of sample
+  SampleFormat::Code sampleFormat;     // format of samples from device; raw output is in this format
 
 protected:
 
   PluginRunnerSet   plugins;          // set of plugins accepting input from this device
   RawListenerSet    rawListeners;     // listeners receiving raw output from this device, if
                                       // any.
+  SpectrogramSet    spectrograms;     // spectrogram summaries of this device's data
+  DeviceGroupSet    groups;           // groups this device belongs to
+  CrossCorrelatorSet correlators;     // cross-correlators between pairs of this device's channels
+  std::vector < shared_ptr < SpectralStage > > spectralStages; // shared FFT stages for attached
+                                      // frequency-domain plugins, one per block size, step
+                                      // size and channel list
   long long         totalFrames;      // total frames seen on this device since start of capture
   double            startTimestamp;   // timestamp device was (most recently) started (-1 if
                                       // never)
@@ -50,20 +71,69 @@ protected:
                                       // streaming USB audio)
   int               hasError;         // if non-zero, the most recent error this device got
                                       // while we polled it? (this would have stopped it)
+  bool              idleStopped;      // was this device stopped because all its consumers were
+                                      // plugins outside their schedules?
+  double            idleSince;        // time at which device was most recently idle-stopped
+  double            idleCounted;      // time up to which the current idle stop has been counted
+                                      // in plugins' skipped frames
+  double            idleSeconds;      // total time spent idle-stopped, not counting any current stop
+  long long         idleStops;        // number of times device has been idle-stopped
+  int               resumeFailures;   // consecutive failed attempts to resume from an idle stop
+  std::vector < char > pluginActive;  // for each plugin, is it within its schedule for the current batch?
+  bool              spectralIdle;     // were spectral stages skipped for the previous batch?
   bool              demodFMForRaw;    // if true, any rawListeners receive FM-demodulated
                                       // samples (reducing stereo to mono)
   float             demodFMLastTheta; // value of previous phase angle for FM demodulation (in
                                       // range -pi..pi)
   int16_t           downSampleFactor; // by what factor do we downsample input audio for raw listeners
   int16_t           downSampleCount[MAX_CHANNELS];  // count of how many samples we've accumulated since last down sample
-  int32_t           downSampleAccum[MAX_CHANNELS];  // accumulator for downsampling
+  float             downSampleAccum[MAX_CHANNELS];  // accumulator for downsampling
   bool              downSampleUseAvg; // if true, downsample by averaging; else downsample by subsampling
 
-  std::vector < int16_t > sampleBuf;  // buffer to store latest interleaved samples from device
+  // running signal statistics for each channel, at the hardware rate,
+  // in device units; updated once per batch, in the same pass over the
+  // samples as downsampling for raw listeners
+
+  struct ChannelStats {
+    double          dc;               // decaying mean
+    double          meanSquare;       // decaying mean of squares
+    double          peak;             // decaying peak absolute value
+    double          noise;            // noise floor: decaying minimum of batch RMS (about the mean)
+    long long       clips;            // samples at or above CLIP_LEVEL of full scale
+  };
+  struct BatchStats {
+    double          sum;
+    double          sumSquares;
+    float           peak;
+    long            clips;
+  };
+  ChannelStats      chanStats[MAX_CHANNELS];
+  long long         statsFrames;      // frames included in chanStats
+  double            statsWindow;      // seconds; decay time for dc, meanSquare and peak
+  double            noiseWindow;      // seconds; time constant with which noise rises
+
+  std::vector < float > sampleBuf;    // buffer to store latest interleaved samples from device, in device units
+  std::vector < shared_ptr < RawChunk > > rawChunkPool; // chunks for raw output, reused once no
+                                      // listener holds them
+  ClockModel        clockModel;       // regression of frame timestamps on frame count, for
+                                      // smoothing and drift-correcting device timestamps
+  long long         wakeupCount;      // number of wakeups with data since wakeupWindowStart
+  double            wakeupWindowStart;// start of current window for counting wakeups
+  double            wakeupsPerSecond; // wakeups with data per second, over most recent complete window
 
 public:
 
-  static DevMinder * getDevMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now); // factory method
+  static DevMinder * getDevMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now,
+                                  int periodFrames = 0, int bufferFrames = 0, bool adaptivePeriod = false,
+                                  SampleFormat::Code sampleFormat = SampleFormat::AUTO); // factory method
+  // periodFrames and bufferFrames of 0 mean use the device's defaults; devices
+  // which have no notion of period or buffer size ignore these, and devices
+  // with a fixed sample format ignore sampleFormat
+  static DevMinder * newDevMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now,
+                                  int periodFrames = 0, int bufferFrames = 0, bool adaptivePeriod = false,
+                                  SampleFormat::Code sampleFormat = SampleFormat::AUTO); // as getDevMinder, but without
+  // calling open(); open() touches only the device's own state, so devices
+  // made this way can be opened in parallel
   ~DevMinder();
 
   int open(); // return 0 on success, non-zero on error
@@ -76,9 +146,26 @@ public:
   void addRawListener(string &label, int downSampleFactor, bool writeWavHeader = false, bool downSampleUseAvg = false);
   void removeRawListener(string &label);
   void removeAllRawListeners();
+  void addSpectrogram(std::string &label, Spectrogram * sp);
+  void removeSpectrogram(std::string &label);
+  void addGroup(const std::string &label, DeviceGroup * g);
+  void removeGroup(const std::string &label);
+  void addCorrelator(std::string &label, CrossCorrelator * xc);
+  bool haveLowLatencyConsumer(); // does any raw listener or plugin want data with minimum delay?
+  bool haveActiveConsumer(double t); // would any consumer use data timestamped t? (true if there are no plugins)
+  void resumeIfScheduled(double timeNow); // restart an idle-stopped device once a consumer is due
+  static void resumeIdleDevices(double timeNow); // resumeIfScheduled() for all devices; called after each poll
+  void consumersChanged(); // called whenever raw listeners or plugins are added or removed, or change their latency needs
+  void pruneSpectralStages(); // drop stages no longer used by any plugin
+  shared_ptr < RawChunk > getRawChunk(); // a chunk from the pool which no listener holds, or a new one
+  void setStatsWindows(double statsWindow, double noiseWindow); // in seconds
+  void resetStats();
 
   string about();
   string toJSON();
+  virtual string hw_toJSON() {return "";}; // device-specific fields for toJSON, each preceded by ','
+  string configJSON(); // this device as an entry in the "devices" list of a config file; see Config.hpp
+  virtual string hw_configJSON() {return "";}; // device-specific open parameters for configJSON, each preceded by ','
 
   virtual int getNumPollFDs ();
   virtual int hw_getNumPollFDs () = 0;
@@ -91,7 +178,7 @@ public:
   virtual void handleEvents ( struct pollfd *pollfds, bool timedOut, double timeNow);
   virtual int hw_handleEvents ( struct pollfd *pollfds, bool timedOut) = 0; // returns number of frames of data available (possibly 0)
 
-  virtual int hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp) = 0;  // fill buffer buf with frame data (interleaved by channel); returns # of frames copied
+  virtual int hw_getFrames (float *buf, int numFrames, double & frameTimestamp) = 0;  // fill buffer buf with frame data (interleaved by channel, in device units); returns # of frames copied
   // it is guaranteed that whenever hw_handleEvents returns a positive number N, hw_getFrames will be called with numFrames=N
   // also returns CLOCK_REALTIME for first frame in frameTimestamp
   // negative return value is an error code.
@@ -105,6 +192,12 @@ protected:
   DevMinder(const string &devName, int rate, unsigned int numChan, unsigned int maxSampleAbs, const string &label, double now, int buffSize); // buffSize is in frames.
 
   void delete_privates();
+  static void accumStats(BatchStats &b, float x, float clipLevel); // add one sample to a channel's batch statistics
+  void updateStats(unsigned chan, const BatchStats &b, long frames);
+  void endIdle(double timeNow); // account for the end of an idle stop
+  void countIdleFrames(double timeNow); // count frames missed while idle-stopped as skipped by plugins
+
+  virtual void hw_setLowLatency(bool lowLatency) {}; // choose between few wakeups and low latency, if the device supports it
 
   virtual int hw_do_start() = 0;      // returns 0 on success; non-zero otherwise
 
@@ -0,0 +1,278 @@
+#include "DeviceGroup.hpp"
+#include "DevMinder.hpp"
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+
+const double DeviceGroup::RESYNC_SECONDS = 0.02;
+
+DeviceGroup * DeviceGroup::newDeviceGroup(const string &label, const std::vector < string > &devLabels) {
+  if (Pollable::lookupByName(label))
+    throw std::runtime_error(string("There is already a device or plugin with label '") + label + "'");
+  if (devLabels.size() < 2)
+    throw std::runtime_error("A group needs at least two devices");
+
+  std::vector < DevMinder * > devs;
+  unsigned int numChan = 0;
+  for (size_t i = 0; i < devLabels.size(); ++i) {
+    DevMinder * dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(devLabels[i]));
+    if (! dev)
+      throw std::runtime_error(string("There is no device with label '") + devLabels[i] + "'");
+    for (size_t j = 0; j < i; ++j)
+      if (devLabels[j] == devLabels[i])
+        throw std::runtime_error(string("Device '") + devLabels[i] + "' is given more than once");
+    if (devs.size() > 0 && dev->rate != devs[0]->rate)
+      throw std::runtime_error(string("Device '") + devLabels[i] + "' has a different rate from device '" + devLabels[0] + "'");
+    numChan += dev->numChan;
+    devs.push_back(dev);
+  }
+  if (numChan > (unsigned) PluginRunner::MAX_NUM_CHAN)
+    throw std::runtime_error("Too many channels in group");
+
+  return new DeviceGroup(label, devs);
+};
+
+DeviceGroup::DeviceGroup(const string &label, const std::vector < DevMinder * > &devs) :
+  Pollable(label),
+  rate(devs[0]->rate),
+  numChan(0),
+  maxSampleAbs(1),
+  spectralIdle(false),
+  framesOut(0),
+  lastTimestamp(0)
+{
+  for (size_t i = 0; i < devs.size(); ++i) {
+    Member m;
+    m.devLabel = devs[i]->label;
+    m.numChan = devs[i]->numChan;
+    m.firstChan = numChan;
+    m.scale = 1.0 / devs[i]->maxSampleAbs;
+    m.start = 0;
+    m.skew = m.skewMax = 0;
+    m.residualMax = m.residualSumSq = 0;
+    m.alignments = m.framesTrimmed = m.framesOverflowed = m.resyncs = 0;
+    members.push_back(m);
+    numChan += m.numChan;
+    devs[i]->addGroup(this->label, this);
+  }
+};
+
+DeviceGroup::~DeviceGroup() {
+  if (Pollable::terminating)
+    return;
+  for (size_t i = 0; i < members.size(); ++i)
+    if (DevMinder * dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(members[i].devLabel)))
+      dev->removeGroup(label);
+};
+
+DeviceGroup::Member * DeviceGroup::findMember(const string &devLabel) {
+  for (size_t i = 0; i < members.size(); ++i)
+    if (members[i].devLabel == devLabel)
+      return & members[i];
+  return 0;
+};
+
+void DeviceGroup::handleData(const string &devLabel, long avail, float *src, int numDevChan, double frameTimestamp) {
+  Member * m = findMember(devLabel);
+
+  // frames without a timestamp can't be aligned
+  if (! m || avail <= 0 || frameTimestamp <= 0)
+    return;
+
+  long have = m->buf.size() / m->numChan;
+  if (have > 0 && fabs(frameTimestamp - (m->start + (double) have / rate)) > RESYNC_SECONDS) {
+    m->buf.clear();
+    ++ m->resyncs;
+    have = 0;
+  }
+  m->start = frameTimestamp - (double) have / rate;
+
+  size_t at = m->buf.size();
+  m->buf.resize(at + avail * m->numChan);
+  float * dst = & m->buf[at];
+  for (long i = 0; i < avail; ++i, src += numDevChan)
+    for (unsigned c = 0; c < m->numChan; ++c)
+      *dst++ = src[c] * m->scale;
+
+  long excess = have + avail - (long) MAX_BUFFER_SECONDS * rate;
+  if (excess > 0) {
+    m->buf.erase(m->buf.begin(), m->buf.begin() + excess * m->numChan);
+    m->start += (double) excess / rate;
+    m->framesOverflowed += excess;
+  }
+
+  align();
+};
+
+void DeviceGroup::align() {
+  // the common timeline starts with the latest member's first frame
+  double t0 = 0;
+  for (size_t i = 0; i < members.size(); ++i) {
+    if (members[i].buf.size() == 0)
+      return;
+    t0 = std::max(t0, members[i].start);
+  }
+
+  // discard whole frames from the other members, to within half a frame of t0
+
+  long n = -1;
+  for (size_t i = 0; i < members.size(); ++i) {
+    Member & m = members[i];
+    long have = m.buf.size() / m.numChan;
+    m.skew = m.start - t0;
+    m.skewMax = std::max(m.skewMax, fabs(m.skew));
+    long trim = std::min(have, (long) floor((t0 - m.start) * rate + 0.5));
+    if (trim > 0) {
+      m.buf.erase(m.buf.begin(), m.buf.begin() + trim * m.numChan);
+      m.start += (double) trim / rate;
+      m.framesTrimmed += trim;
+      have -= trim;
+    }
+    if (n < 0 || have < n)
+      n = have;
+  }
+  if (n <= 0)
+    return;
+
+  // interleave the frames all members have, and remove them from the buffers
+
+  outBuf.resize(n * numChan);
+  for (size_t i = 0; i < members.size(); ++i) {
+    Member & m = members[i];
+    double residual = m.start - t0;
+    m.residualMax = std::max(m.residualMax, fabs(residual));
+    m.residualSumSq += residual * residual;
+    ++ m.alignments;
+    const float * s = & m.buf[0];
+    float * d = & outBuf[m.firstChan];
+    for (long j = 0; j < n; ++j, d += numChan)
+      for (unsigned c = 0; c < m.numChan; ++c)
+        d[c] = *s++;
+    m.buf.erase(m.buf.begin(), m.buf.begin() + n * m.numChan);
+    m.start += (double) n / rate;
+  }
+  framesOut += n;
+  lastTimestamp = t0;
+
+  // as a device does for its plugins
+
+  for (size_t i = 0; i < plugins.size(); /**/) {
+    if (PluginRunner * ptr = plugins.at(i)) {
+      if (ptr->isScheduledAt(t0)) {
+        if (spectral) {
+          if (spectralIdle)
+            spectral->reset();
+          spectral->handleData(n, & outBuf[0], numChan, t0);
+        }
+        ptr->handleData(n, & outBuf[0], numChan, t0);
+        spectralIdle = false;
+      } else {
+        ptr->skipData(n);
+        spectralIdle = true;
+      }
+      ++i;
+    } else {
+      plugins.removeAt(i);
+      spectral.reset();
+      consumersChanged();
+    }
+  }
+};
+
+bool DeviceGroup::hasPlugin() {
+  for (size_t i = 0; i < plugins.size(); ++i)
+    if (plugins.at(i))
+      return true;
+  return false;
+};
+
+void DeviceGroup::addPluginRunner(std::string &label, shared_ptr < PluginRunner > pr) {
+  if (pr->isFrequencyDomain()) {
+    spectral = shared_ptr < SpectralStage > (new SpectralStage(rate, pr->getBlockSize(), pr->getStepSize(), pr->getChannelMap(), 1.0));
+    spectralIdle = false;
+    pr->setSpectralStage(spectral);
+  }
+  plugins.clear();
+  plugins.add(label, pr.get());
+  consumersChanged();
+};
+
+void DeviceGroup::consumersChanged() {
+  for (size_t i = 0; i < members.size(); ++i)
+    if (DevMinder * dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(members[i].devLabel)))
+      dev->consumersChanged();
+};
+
+bool DeviceGroup::wantsLowLatency() {
+  for (size_t i = 0; i < plugins.size(); ++i) {
+    PluginRunner * ptr = plugins.at(i);
+    if (ptr && ptr->wantsLowLatency())
+      return true;
+  }
+  return false;
+};
+
+void DeviceGroup::stop(double timeNow) {
+  for (size_t i = 0; i < members.size(); ++i)
+    if (DevMinder * dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(members[i].devLabel)))
+      dev->stop(timeNow);
+};
+
+int DeviceGroup::start(double timeNow) {
+  // buffered frames would be discontinuous with what follows
+  int rv = 0;
+  for (size_t i = 0; i < members.size(); ++i) {
+    members[i].buf.clear();
+    DevMinder * dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(members[i].devLabel));
+    if (! dev || dev->start(timeNow))
+      rv = 1;
+  }
+  return rv;
+};
+
+string DeviceGroup::toJSON() {
+  string plugin;
+  for (size_t i = 0; i < plugins.size(); ++i)
+    if (plugins.at(i))
+      plugin = plugins.labelAt(i);
+  ostringstream s;
+  s << "{"
+    << "\"type\":\"DeviceGroup\","
+    << "\"rate\":" << rate << ","
+    << "\"numChan\":" << numChan << ","
+    << "\"plugin\":\"" << plugin << "\","
+    << "\"framesOut\":" << framesOut << ","
+    << std::setprecision(14)
+    << "\"lastTimestamp\":" << lastTimestamp << ","
+    << std::setprecision(6)
+    << "\"members\":[";
+  // skews and residuals are in seconds
+  for (size_t i = 0; i < members.size(); ++i) {
+    const Member & m = members[i];
+    s << (i ? "," : "") << "{"
+      << "\"device\":\"" << m.devLabel << "\","
+      << "\"numChan\":" << m.numChan << ","
+      << "\"bufferedSeconds\":" << (double) (m.buf.size() / m.numChan) / rate << ","
+      << "\"skew\":" << m.skew << ","
+      << "\"skewMax\":" << m.skewMax << ","
+      << "\"residualRMS\":" << (m.alignments ? sqrt(m.residualSumSq / m.alignments) : 0) << ","
+      << "\"residualMax\":" << m.residualMax << ","
+      << "\"framesTrimmed\":" << m.framesTrimmed << ","
+      << "\"framesOverflowed\":" << m.framesOverflowed << ","
+      << "\"resyncs\":" << m.resyncs
+      << "}";
+  }
+  s << "]}";
+  return s.str();
+};
+
+string DeviceGroup::configJSON() {
+  ostringstream s;
+  s << "{"
+    << "\"label\":\"" << label << "\","
+    << "\"devices\":[";
+  for (size_t i = 0; i < members.size(); ++i)
+    s << (i ? "," : "") << "\"" << members[i].devLabel << "\"";
+  s << "]}";
+  return s.str();
+};
@@ -0,0 +1,116 @@
+#ifndef DEVICEGROUP_HPP
+#define DEVICEGROUP_HPP
+
+/*
+  A group of devices whose data are aligned to a common timeline and
+  given to a single plugin as one multichannel stream, e.g. for
+  comparing pulse arrival times across several receivers.
+
+  The group's channels are those of its member devices, in the order
+  the devices were given, so a group of two stereo devices "1" and "2"
+  has channels 0,1 from device 1 and channels 2,3 from device 2.  All
+  members must have the same rate.  A plugin is attached to the group
+  as to a device, with the group's label in place of the device's.
+
+  Each member device gives the group its batches, with the smoothed,
+  drift-corrected timestamps from its clock model.  The group buffers
+  each member's frames, anchoring the buffer to the timestamp of the
+  member's most recent batch, so that the small difference between a
+  device's true rate and its nominal rate doesn't accumulate.  Once
+  every member has data, frames which begin before the latest member's
+  first frame are discarded, leaving the members aligned to within half
+  a frame, and the frames which all members have are interleaved and
+  given to the plugin.  Frames are only ever discarded, never invented,
+  so a member whose clock runs fast loses a frame now and then.
+
+  A member whose timestamps jump by more than RESYNC_SECONDS from what
+  its buffered frames predict (e.g. after a restart) has its buffer
+  cleared.  If a member stops delivering data, the others' buffers are
+  capped at MAX_BUFFER_SECONDS, with the oldest frames discarded.
+
+  For each member, the group reports its skew (how far its first
+  buffered frame was before the latest member's, at the most recent
+  alignment) and the residual error of alignment to a whole frame,
+  along with counts of the frames discarded for alignment and for
+  overflow.
+*/
+
+#include <string>
+#include <vector>
+
+#include "Pollable.hpp"
+#include "PluginRunner.hpp"
+#include "SpectralStage.hpp"
+
+class DevMinder;
+
+class DeviceGroup : public Pollable {
+
+public:
+
+  static const int MAX_BUFFER_SECONDS = 2;      // frames buffered for a member beyond this are discarded
+  static const double RESYNC_SECONDS;           // timestamp jump at which a member's buffer is cleared
+
+  int                rate;             // frames per second, common to all members
+  unsigned int       numChan;          // total channels, over all members
+  unsigned int       maxSampleAbs;     // samples are scaled to [-1, 1], so this is 1
+
+protected:
+
+  struct Member {
+    string           devLabel;         // label of member device
+    unsigned int     numChan;          // channels from this device
+    unsigned int     firstChan;        // index of its first channel in the group
+    float            scale;            // scale factor from device units to [-1, 1]
+    std::vector < float > buf;         // interleaved frames not yet aligned and given to the plugin
+    double           start;            // timestamp of first frame in buf
+    double           skew;             // start - latest member's start, at most recent alignment
+    double           skewMax;          // largest magnitude of skew
+    double           residualMax;      // largest magnitude of alignment error after discarding whole frames
+    double           residualSumSq;    // sum of squared alignment errors
+    long long        alignments;       // number of alignments contributing to residualSumSq
+    long long        framesTrimmed;    // frames discarded to align with other members
+    long long        framesOverflowed; // frames discarded because the buffer was full
+    long long        resyncs;          // times buffer was cleared after a timestamp jump
+  };
+
+  std::vector < Member > members;
+  ListenerTable < PluginRunner > plugins; // the plugin attached to this group, if any
+  shared_ptr < SpectralStage > spectral; // for a frequency-domain plugin, its FFT stage
+  bool               spectralIdle;     // was the plugin skipped for the previous block?
+  std::vector < float > outBuf;        // aligned, interleaved frames; storage is reused
+  long long          framesOut;        // aligned frames given to the plugin (or skipped by it)
+  double             lastTimestamp;    // timestamp of most recent aligned frames
+
+  DeviceGroup(const string &label, const std::vector < DevMinder * > &devs);
+
+public:
+
+  static DeviceGroup * newDeviceGroup(const string &label, const std::vector < string > &devLabels); // factory method; throws
+  // std::runtime_error if the label is in use, or the devices don't exist, repeat, or differ in rate
+  ~DeviceGroup();
+
+  void handleData(const string &devLabel, long avail, float *src, int numDevChan, double frameTimestamp); // called by each member device
+  bool hasPlugin();
+  void addPluginRunner(std::string &label, shared_ptr < PluginRunner > pr);
+  void consumersChanged(); // tell member devices the plugin's latency needs may have changed
+  bool wantsLowLatency();
+
+  string toJSON();
+  string configJSON(); // this group as an entry in the "groups" list of a config file; see Config.hpp
+
+  int getNumPollFDs() {return 0;};
+  int getPollFDs (struct pollfd * pollfds) {return 0;};
+  int getOutputFD(){return 0;};
+  void handleEvents (struct pollfd *pollfds, bool timedOut, double timeNow) {};
+
+  void stop(double timeNow); // stops all member devices
+  int start(double timeNow); // starts all member devices; returns non-zero if any failed
+
+protected:
+
+  Member * findMember(const string &devLabel);
+  void align(); // give the plugin whatever frames all members have
+};
+
+#endif // DEVICEGROUP_HPP
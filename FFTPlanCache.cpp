@@ -0,0 +1,88 @@
+#include "FFTPlanCache.hpp"
+#include <cstdio>
+#include <unistd.h>
+
+const std::string FFTPlanCache::DEFAULT_WISDOM_FILE = "/var/tmp/vamp-alsa-host.fftw-wisdom";
+
+FFTPlanCache::PlanMap FFTPlanCache::plans;
+std::string FFTPlanCache::wisdomFile = FFTPlanCache::DEFAULT_WISDOM_FILE;
+bool FFTPlanCache::wisdomLoaded = false;
+
+bool FFTPlanCache::Key::operator< (const Key &k) const {
+  if (n != k.n)
+    return n < k.n;
+  if (isInverse != k.isInverse)
+    return isInverse < k.isInverse;
+  if (inAlign != k.inAlign)
+    return inAlign < k.inAlign;
+  return outAlign < k.outAlign;
+};
+
+void FFTPlanCache::setWisdomFile(const std::string &filename) {
+  wisdomFile = filename;
+  wisdomLoaded = false;
+  loadWisdom();
+};
+
+void FFTPlanCache::loadWisdom() {
+  // a missing or unreadable file just means we start without wisdom
+  if (wisdomLoaded)
+    return;
+  wisdomLoaded = true;
+  if (wisdomFile.length() > 0)
+    fftwf_import_wisdom_from_filename(wisdomFile.c_str());
+};
+
+void FFTPlanCache::saveWisdom() {
+  // write to a temporary file and rename it, so that a crash while
+  // writing can't leave a truncated wisdom file for the next start
+
+  if (wisdomFile.length() == 0)
+    return;
+  std::string tmp = wisdomFile + ".tmp";
+  if (fftwf_export_wisdom_to_filename(tmp.c_str()))
+    rename(tmp.c_str(), wisdomFile.c_str());
+  else
+    unlink(tmp.c_str());
+};
+
+fftwf_plan FFTPlanCache::lookup(const Key &key) {
+  loadWisdom();
+  PlanMap::iterator ip = plans.find(key);
+  return ip == plans.end() ? 0 : ip->second;
+};
+
+void FFTPlanCache::add(const Key &key, fftwf_plan plan) {
+  if (! plan)
+    return;
+  plans[key] = plan;
+  saveWisdom();
+};
+
+fftwf_plan FFTPlanCache::forward(int n, float *in, fftwf_complex *out) {
+  Key key;
+  key.n = n;
+  key.isInverse = false;
+  key.inAlign = fftwf_alignment_of(in);
+  key.outAlign = fftwf_alignment_of((float *) out);
+  fftwf_plan plan = lookup(key);
+  if (! plan) {
+    plan = fftwf_plan_dft_r2c_1d(n, in, out, FFTW_MEASURE);
+    add(key, plan);
+  }
+  return plan;
+};
+
+fftwf_plan FFTPlanCache::inverse(int n, fftwf_complex *in, float *out) {
+  Key key;
+  key.n = n;
+  key.isInverse = true;
+  key.inAlign = fftwf_alignment_of((float *) in);
+  key.outAlign = fftwf_alignment_of(out);
+  fftwf_plan plan = lookup(key);
+  if (! plan) {
+    plan = fftwf_plan_dft_c2r_1d(n, in, out, FFTW_MEASURE);
+    add(key, plan);
+  }
+  return plan;
+};
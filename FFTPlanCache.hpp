@@ -0,0 +1,59 @@
+#ifndef FFTPLANCACHE_HPP
+#define FFTPLANCACHE_HPP
+
+/*
+  Cache of FFTW plans, with wisdom kept on disk.
+
+  Planning with FFTW_MEASURE can take seconds per size on slow
+  machines, and would otherwise be repeated each time a consumer
+  needing a transform is created, and after every restart.  Plans are
+  cached here for the life of the process, keyed by size, direction
+  and the alignment of the arrays they were made for (FFTW requires
+  arrays given to fftwf_execute_dft_* to have the same alignment as
+  those used for planning).  Accumulated wisdom is loaded from a file
+  at startup and saved whenever a new plan has been made, so that
+  after a restart FFTW_MEASURE planning is immediate.
+
+  The FFTW planner is not thread-safe, so plans must only be requested
+  from the poll thread.
+*/
+
+#include <map>
+#include <string>
+#include <fftw3.h>
+
+class FFTPlanCache {
+
+public:
+
+  static const std::string DEFAULT_WISDOM_FILE; // where wisdom is kept unless setWisdomFile() says otherwise
+
+  static void setWisdomFile(const std::string &filename); // use this file for wisdom, loading any it already has; "" disables
+  static fftwf_plan forward(int n, float *in, fftwf_complex *out); // real-to-complex plan of size n
+  static fftwf_plan inverse(int n, fftwf_complex *in, float *out); // complex-to-real plan of size n
+  // The returned plans belong to the cache; callers must not destroy them.
+  // As with any FFTW_MEASURE planning, the arrays may be overwritten when
+  // a new plan is made.
+
+protected:
+
+  struct Key {
+    int n;         // transform size
+    bool isInverse;
+    int inAlign;   // fftwf_alignment_of input array
+    int outAlign;  // fftwf_alignment_of output array
+    bool operator< (const Key &k) const;
+  };
+  typedef std::map < Key, fftwf_plan > PlanMap;
+
+  static PlanMap plans;
+  static std::string wisdomFile;
+  static bool wisdomLoaded;
+
+  static void loadWisdom();
+  static void saveWisdom();
+  static fftwf_plan lookup(const Key &key); // 0 if not cached
+  static void add(const Key &key, fftwf_plan plan); // cache plan and save wisdom
+};
+
+#endif // FFTPLANCACHE_HPP
@@ -0,0 +1,103 @@
+#include "PluginCache.hpp"
+#include <dlfcn.h>
+
+PluginCache::LibraryMap PluginCache::libraries;
+PluginCache::EntryMap PluginCache::entries;
+boost::mutex PluginCache::cacheMutex;
+
+bool PluginCache::openLibrary(const string &path, const string &libName) {
+  void * handle = dlopen(path.c_str(), RTLD_LAZY | RTLD_LOCAL);
+  if (! handle)
+    return false;
+
+  VampGetPluginDescriptorFunction fn = (VampGetPluginDescriptorFunction) dlsym(handle, "vampGetPluginDescriptor");
+  if (! fn) {
+    dlclose(handle);
+    return false;
+  }
+
+  // the library stays open for the life of the process, so its descriptors
+  // remain valid
+
+  libraries[libName] = handle;
+  const VampPluginDescriptor * desc;
+  for (unsigned int i = 0; (desc = fn(VAMP_API_VERSION, i)); ++i) {
+    Entry & e = entries[libName + ":" + desc->identifier];
+    e.descriptor = desc;
+    e.haveDescriptors = false;
+  }
+  return true;
+};
+
+PluginCache::Entry * PluginCache::lookup(const string &soname, const string &id) {
+  PluginLoader * loader = PluginLoader::getInstance();
+  PluginLoader::PluginKey key = loader->composePluginKey(soname, id);
+
+  EntryMap::iterator ie = entries.find(key);
+  if (ie != entries.end())
+    return & ie->second;
+
+  string libName = key.substr(0, key.find(':'));
+  if (libraries.count(libName))
+    // library is open, but doesn't have this plugin
+    return 0;
+
+  // use the loader only to find the library; this scans the Vamp path
+  // for libraries with matching names
+
+  string path = loader->getLibraryPathForPlugin(key);
+  if (path == "" || ! openLibrary(path, libName))
+    return 0;
+
+  ie = entries.find(key);
+  if (ie == entries.end())
+    return 0;
+  return & ie->second;
+};
+
+Plugin * PluginCache::loadPlugin(const string &soname, const string &id, float rate, Entry ** entry) {
+  boost::mutex::scoped_lock lock(cacheMutex);
+
+  Entry * e = lookup(soname, id);
+  if (! e)
+    return 0;
+
+  Plugin * plugin = new PluginHostAdapter(e->descriptor, rate);
+
+  if (! e->haveDescriptors) {
+    e->outputs = plugin->getOutputDescriptors();
+    e->params = plugin->getParameterDescriptors();
+    e->haveDescriptors = true;
+  }
+  if (entry)
+    * entry = e;
+  return plugin;
+};
+
+int PluginCache::preload(const string &soname, const string &id, std::vector < string > &keys) {
+  std::vector < string > ids;
+
+  if (id != "") {
+    ids.push_back(id);
+  } else {
+    // all plugins from this library; listPlugins() scans the whole Vamp path
+    boost::mutex::scoped_lock lock(cacheMutex);
+    PluginLoader * loader = PluginLoader::getInstance();
+    string prefix = loader->composePluginKey(soname, "");
+    std::vector < PluginLoader::PluginKey > all = loader->listPlugins();
+    for (size_t i = 0; i < all.size(); ++i)
+      if (all[i].compare(0, prefix.length(), prefix) == 0)
+        ids.push_back(all[i].substr(prefix.length()));
+  }
+
+  int n = 0;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    Plugin * p = loadPlugin(soname, ids[i], PRELOAD_RATE);
+    if (p) {
+      delete p;
+      keys.push_back(PluginLoader::getInstance()->composePluginKey(soname, ids[i]));
+      ++n;
+    }
+  }
+  return n;
+};
@@ -0,0 +1,69 @@
+#ifndef PLUGINCACHE_HPP
+#define PLUGINCACHE_HPP
+
+/*
+  Cache of Vamp plugin libraries and descriptors.
+
+  PluginLoader::loadPlugin() looks up the library for a plugin key,
+  dlopen()s it, and searches it for the plugin's descriptor; the
+  library is dlclose()d again when the plugin is deleted.  So each
+  detach / attach cycle repeats all of that.  Instead, we keep each
+  library open for the life of the process, remember the descriptor
+  for each plugin, and create instances directly with a
+  PluginHostAdapter, which is what PluginLoader does when no adapters
+  are requested.  Output and parameter descriptors are also memoized,
+  as querying them goes through the plugin's C API and allocates.
+
+  PluginRunner builds replacement instances on a background thread, so
+  the cache is guarded by a mutex.
+*/
+
+#include <vamp/vamp.h>
+#include <vamp-hostsdk/PluginHostAdapter.h>
+#include <vamp-hostsdk/PluginLoader.h>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace Vamp;
+using namespace Vamp::HostExt;
+using std::string;
+
+class PluginCache {
+
+public:
+
+  struct Entry {
+    const VampPluginDescriptor * descriptor; // descriptor from plugin library
+    bool                       haveDescriptors; // have outputs and params been filled in?
+    Plugin::OutputList         outputs;     // output descriptors, as reported by the first instance
+    PluginBase::ParameterList  params;      // parameter descriptors, as reported by the first instance
+  };
+
+  static const int PRELOAD_RATE = 48000; // sampling rate for instances created only to obtain descriptors
+
+  // create a new instance of plugin id from library soname; returns 0 if
+  // not found.  If entry is not null, it is set to the cache entry for the
+  // plugin.  The caller owns the returned instance.
+  static Plugin * loadPlugin(const string &soname, const string &id, float rate, Entry ** entry = 0);
+
+  // load library soname and cache descriptors for plugin id, or for all
+  // plugins in the library if id is "".  Keys of the plugins cached are
+  // appended to keys.  Returns the number of plugins cached.
+  static int preload(const string &soname, const string &id, std::vector < string > &keys);
+
+protected:
+
+  typedef std::map < string, void * > LibraryMap; // dlopen() handles, by canonical soname
+  typedef std::map < string, Entry > EntryMap;    // cache entries, by plugin key ("soname:id")
+
+  static LibraryMap libraries;
+  static EntryMap entries;
+  static boost::mutex cacheMutex; // guards libraries, entries, and use of the PluginLoader
+
+  static Entry * lookup(const string &soname, const string &id); // find entry, opening library if necessary; 0 if not found
+  static bool openLibrary(const string &path, const string &libName); // dlopen library and add entries for all its plugins
+};
+
+#endif // PLUGINCACHE_HPP
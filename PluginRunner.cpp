@@ -1,8 +1,30 @@
 #include "PluginRunner.hpp"
+#include <boost/bind.hpp>
+#include <cstdio>
+
+// append x to s, formatted as with printf; formatting into a local buffer
+// means no allocation unless s has to grow
+
+static void appendNumber(string &s, const char *fmt, double x) {
+  char num[64];
+  int n = snprintf(num, sizeof(num), fmt, x);
+  if (n > 0)
+    s.append(num, std::min(n, (int) sizeof(num) - 1));
+};
 
 void PluginRunner::delete_privates() {
+  // the builder thread uses PluginCache's statics, so it must finish
+  // before they are destroyed, even when terminating
+  if (builder) {
+    builder->join();
+    delete builder;
+    builder = 0;
+  }
   if (Pollable::terminating)
     return;
+  if (pendingPlugin) {
+    delete pendingPlugin;
+  }
   if (plugin) {
     delete plugin;
   }
@@ -18,23 +40,23 @@ void PluginRunner::delete_privates() {
 int PluginRunner::loadPlugin() {
   // load the plugin, make sure it is compatible and that all parameters are okay.
 
-  // get an instance of the plugin loader,
+  // instances come from the plugin cache, which keeps libraries open and
+  // memoizes descriptors; as with PluginLoader::loadPlugin (key, rate, 0),
+  // there is no adapting, rather than PluginLoader::ADAPT_ALL_SAFE;
 
-  if (! pluginLoader)
-    pluginLoader =  PluginLoader::getInstance();
-
-  PluginLoader::PluginKey key = pluginLoader->composePluginKey(pluginSOName, pluginID);
-
-  plugin = pluginLoader->loadPlugin (key, rate, 0); // no adapting, rather than PluginLoader::ADAPT_ALL_SAFE;
+  PluginCache::Entry * entry;
+  plugin = PluginCache::loadPlugin (pluginSOName, pluginID, rate, & entry);
 
   if (! plugin) {
     return 1;
   }
 
-  // make sure the plugin is compatible: it must run in the time domain and accept an appropriate number of channels
+  // make sure the plugin is compatible: it must accept an appropriate number of channels.
+  // Frequency-domain plugins get their input from the device's shared spectral stage.
 
-  if (plugin->getInputDomain() != Plugin::TimeDomain
-      || plugin->getMinChannelCount() > numChan
+  frequencyDomain = plugin->getInputDomain() == Plugin::FrequencyDomain;
+
+  if (plugin->getMinChannelCount() > numChan
       || plugin->getMaxChannelCount() < numChan) {
     return 2;
   }
@@ -47,6 +69,16 @@ int PluginRunner::loadPlugin() {
   if (blockSize == 0) {
     blockSize = 1024;
   }
+  if (frequencyDomain) {
+    // as for PluginInputDomainAdapter: the FFT size is a power of two,
+    // and the default step is half a block
+    int n = 2;
+    while (n < blockSize)
+      n *= 2;
+    blockSize = n;
+    if (stepSize == 0)
+      stepSize = blockSize / 2;
+  }
   if (stepSize == 0) {
     stepSize = blockSize;
   } else if (stepSize > blockSize) {
@@ -55,14 +87,16 @@ int PluginRunner::loadPlugin() {
 
   // allocate buffers to transfer float audio data to plugin
 
-  plugbuf = new float*[numChan];
-  for (unsigned c = 0; c < numChan; ++c)
-    // use fftwf_alloc_real to make sure we have alignment suitable for in-place SIMD FFTs
-    plugbuf[c] =  fftwf_alloc_real(blockSize + 2);  // FIXME: is "+2" only to leave room for DFT?;
+  if (! frequencyDomain) {
+    plugbuf = new float*[numChan];
+    for (unsigned c = 0; c < numChan; ++c)
+      // use fftwf_alloc_real to make sure we have alignment suitable for in-place SIMD FFTs
+      plugbuf[c] =  fftwf_alloc_real(blockSize + 2);  // FIXME: is "+2" only to leave room for DFT?;
+  }
 
   // make sure the named output is valid
 
-  Plugin::OutputList outputs = plugin->getOutputDescriptors();
+  Plugin::OutputList & outputs = entry->outputs;
 
   for (size_t i = 0; i < outputs.size(); ++i) {
     if (outputs[i].identifier == pluginOutput) {
@@ -77,7 +111,7 @@ int PluginRunner::loadPlugin() {
 
   // set the plugin's parameters
 
-  setParameters(pluginParams);
+  applyParameters(plugin, pluginParams);
 
   // initialise the plugin
 
@@ -98,7 +132,7 @@ int PluginRunner::loadPlugin() {
   // value, then set MAX_BUFFER_SIZE to that value.  Output from each call to the plugin's
   // process() method is guaranteed to be no larger than MAX_BUFFER_SIZE bytes.
 
-  PluginBase::ParameterList plist = plugin->getParameterDescriptors();
+  PluginBase::ParameterList & plist = entry->params;
   for (PluginBase::ParameterList::iterator ipa = plist.begin(); ipa != plist.end(); ++ipa) {
     if (ipa->identifier == "isForVampAlsaHost") {
       plugin->setParameter(ipa->identifier, 1.0);
@@ -115,7 +149,7 @@ int PluginRunner::loadPlugin() {
   return 0;
 };
 
-PluginRunner::PluginRunner(const string &label, const string &devLabel, int rate, int numChan, unsigned int maxSampleAbs, const string &pluginSOName, const string &pluginID, const string &pluginOutput, const ParamSet &ps):
+PluginRunner::PluginRunner(const string &label, const string &devLabel, int rate, const std::vector < int > &channelMap, unsigned int maxSampleAbs, const string &pluginSOName, const string &pluginID, const string &pluginOutput, const ParamSet &ps):
   Pollable (label),
   label(label),
   devLabel(devLabel),
@@ -124,7 +158,8 @@ PluginRunner::PluginRunner(const string &label, const string &devLabel, int rate
   pluginOutput(pluginOutput),
   pluginParams(ps),
   rate(rate),
-  numChan(numChan),
+  numChan(channelMap.size()),
+  channelMap(channelMap),
   maxSampleAbs(maxSampleAbs),
   totalFrames(0),
   totalFeatures(0),
@@ -136,7 +171,21 @@ PluginRunner::PluginRunner(const string &label, const string &devLabel, int rate
   framesInPlugBuf(0),
   isOutputBinary(false),
   resampleScale(1.0 / maxSampleAbs),
-  lastFrametimestamp(0)
+  lastFrametimestamp(0),
+  lowLatency(false),
+  frequencyDomain(false),
+  framesSkipped(0),
+  skipped(false),
+  latencyLast(0),
+  latencySum(0),
+  latencyMax(0),
+  latencyCount(0),
+  builder(0),
+  building(false),
+  paramGen(0),
+  pendingDone(false),
+  pendingPlugin(0),
+  pendingGen(0)
 {
 
   // try load the plugin and throw if we fail
@@ -153,9 +202,9 @@ PluginRunner::~PluginRunner() {
 
 bool PluginRunner::addOutputListener(string label) {
 
-  shared_ptr < Pollable > outl = boost::static_pointer_cast < Pollable > (lookupByNameShared(label));
+  Pollable * outl = lookupByName(label);
   if (outl) {
-    outputListeners[label] = outl;
+    outputListeners.add(label, outl);
     return true;
   } else {
     return false;
@@ -163,31 +212,50 @@ bool PluginRunner::addOutputListener(string label) {
 };
 
 void PluginRunner::removeOutputListener(string label) {
-  outputListeners.erase(label);
+  outputListeners.remove(label);
 };
 
 void PluginRunner::removeAllOutputListeners() {
   outputListeners.clear();
 };
 
-void PluginRunner::handleData(long avail, int16_t *src0, int16_t *src1, int step, double frameTimestamp) {
-  // alsaHandler has some data for us.  If src1 is NULL, it's only one channel; otherwise it's two channels
+void PluginRunner::handleData(long avail, float *src, int numDevChan, double frameTimestamp) {
+  // the device has some data for us: avail frames of numDevChan interleaved channels.
+  // We take only the channels in channelMap.
+
+  if (skipped) {
+    // data are not continuous with any partial block, so start a new one
+    skipped = false;
+    framesInPlugBuf = 0;
+  }
+
+  if (frequencyDomain) {
+    // the spectral stage has already been given this data; process
+    // whatever blocks it transformed.  The timestamp passed to the
+    // plugin is that of the centre of the block, as with
+    // PluginInputDomainAdapter.
+    totalFrames += avail;
+    if (! spectral)
+      return;
+    for (int k = 0; k < spectral->numReady(); ++k) {
+      double ts = spectral->timestamp(k);
+      processBlock(spectral->spectrum(k), ts, RealTime::fromSeconds(ts + (double) (blockSize / 2) / rate));
+    }
+    return;
+  }
 
   // get timestamp of first (hardware) frame in plugin's buffer
   frameTimestamp -= (double) framesInPlugBuf / rate;
 
   while (avail > 0) {
     int hw_frames_to_copy = std::min((int) avail, blockSize - framesInPlugBuf);
-    float *pb0 = plugbuf[0] + framesInPlugBuf;
-    float *pb1 = plugbuf[1] + framesInPlugBuf;
 
-    for (int i = 0; i < hw_frames_to_copy; ++i, ++pb0, src0 += step) {
-      *pb0 = *src0 * resampleScale;
-    }
-    if (src1) {
-      for (int i = 0; i < hw_frames_to_copy; ++i, ++pb1, src1 += step) {
-        *pb1 = *src1 * resampleScale;
-      }
+    // deinterleave in a single pass over the source frames, so that each
+    // device frame is read from memory only once regardless of channel count
+
+    for (int i = framesInPlugBuf; i < framesInPlugBuf + hw_frames_to_copy; ++i, src += numDevChan) {
+      for (unsigned c = 0; c < numChan; ++c)
+        plugbuf[c][i] = src[channelMap[c]] * resampleScale;
     }
 
     avail -= hw_frames_to_copy;
@@ -197,8 +265,7 @@ void PluginRunner::handleData(long avail, int16_t *src0, int16_t *src1, int step
     if (framesInPlugBuf == blockSize) {
       // time to call the plugin
 
-      RealTime rt = RealTime::fromSeconds( frameTimestamp );
-      outputFeatures(plugin->process(plugbuf, rt), label);
+      processBlock(plugbuf, frameTimestamp, RealTime::fromSeconds( frameTimestamp ));
 
       // shift samples if we're not advancing by a full
       // block.
@@ -215,9 +282,8 @@ void PluginRunner::handleData(long avail, int16_t *src0, int16_t *src1, int step
       // full buffers.
 
       if (stepSize < blockSize) {
-        memmove(&plugbuf[0][0], &plugbuf[0][stepSize], (blockSize - stepSize) * sizeof(float));
-        if (src1)
-          memmove(&plugbuf[1][0], &plugbuf[1][stepSize], (blockSize - stepSize) * sizeof(float));
+        for (unsigned c = 0; c < numChan; ++c)
+          memmove(&plugbuf[c][0], &plugbuf[c][stepSize], (blockSize - stepSize) * sizeof(float));
         framesInPlugBuf = blockSize - stepSize;
         frameTimestamp += (double) stepSize / rate;
       } else {
@@ -229,25 +295,59 @@ void PluginRunner::handleData(long avail, int16_t *src0, int16_t *src1, int step
 };
 
 void
-PluginRunner::outputFeatures(Plugin::FeatureSet features, string prefix)
+PluginRunner::processBlock(const float * const * input, double blockTimestamp, RealTime rt) {
+  // run the plugin on one block of input; blockTimestamp is the time of
+  // the block's first frame, and rt is the timestamp given to the plugin
+
+  Plugin::FeatureSet features = plugin->process(input, rt);
+  if (outputFeatures(features, label) > 0) {
+
+    // latency is measured from the real time of the last frame in
+    // the block, which is the earliest the features could exist
+    double latency = VampAlsaHost::now() - (blockTimestamp + (double) blockSize / rate);
+    latencyLast = latency;
+    latencySum += latency;
+    if (latency > latencyMax)
+      latencyMax = latency;
+    ++latencyCount;
+  }
+
+  // if a replacement instance with new parameters is ready, switch
+  // to it now, while we still have a full block of input for it
+
+  if (building)
+    checkPendingPlugin(input, rt);
+};
+
+int
+PluginRunner::outputFeatures(Plugin::FeatureSet &features, const string &prefix)
 {
-  totalFeatures += features[outputNo].size();
-  for (Plugin::FeatureList::iterator f = features[outputNo].begin(), g = features[outputNo].end(); f != g; ++f ) {
+  // look up our output without operator[], which would insert an empty
+  // list into the set when the plugin returned nothing for it
+
+  Plugin::FeatureSet::iterator fs = features.find(outputNo);
+  if (fs == features.end())
+    return 0;
+  Plugin::FeatureList & fl = fs->second;
+
+  totalFeatures += fl.size();
+  for (Plugin::FeatureList::iterator f = fl.begin(), g = fl.end(); f != g; ++f ) {
     if (isOutputBinary) {
       // copy values as raw bytes to any outputListeners
-      for (OutputListenerSet::iterator io = outputListeners.begin(); io != outputListeners.end(); /**/) {
-        if (shared_ptr < Pollable > ptr = (io->second).lock()) {
+      for (size_t i = 0; i < outputListeners.size(); /**/) {
+        if (Pollable * ptr = outputListeners.at(i)) {
           ptr->queueOutput((char *)& f->values[0], f->values.size() * sizeof(f->values[0]));
-          ++io;
+          ++i;
         } else {
-          OutputListenerSet::iterator to_delete = io++;
-          outputListeners.erase(to_delete);
+          outputListeners.removeAt(i);
         }
       }
     } else {
-      ostringstream txt;
-      txt.setf(ios::fixed,ios::floatfield);
-      txt.precision(4); // 0.1 ms precision for timestamp
+      // format into textBuf, which keeps its storage from one feature to
+      // the next, rather than building an ostringstream and a copy of its
+      // string for each feature and listener.
+
+      textBuf.clear();
 
       RealTime rt;
 
@@ -255,35 +355,45 @@ PluginRunner::outputFeatures(Plugin::FeatureSet features, string prefix)
         rt = f->timestamp;
       }
 
-      if (prefix.length())
-        txt << prefix << ",";
-      txt << (double) (rt.sec + rt.nsec / (double) 1.0e9);
-      txt.unsetf(ios::floatfield); // now 4 digits total precision
+      if (prefix.length()) {
+        textBuf += prefix;
+        textBuf += ',';
+      }
+      appendNumber(textBuf, "%.4f", rt.sec + rt.nsec / (double) 1.0e9); // 0.1 ms precision for timestamp
 
       if (f->hasDuration) {
         rt = f->duration;
-        txt << "," << rt.toString();
+        textBuf += ',';
+        textBuf += rt.toString();
       }
 
       for (std::vector<float>::iterator v = f->values.begin(), w=f->values.end(); v != w; ++v) {
-        txt << "," << *v;
+        textBuf += ',';
+        appendNumber(textBuf, "%.4g", *v); // 4 digits total precision
       }
 
-      txt << endl;
+      textBuf += '\n';
 
       // send output as text to any outputListeners
-      for (OutputListenerSet::iterator io = outputListeners.begin(); io != outputListeners.end(); /**/) {
-        if (shared_ptr < Pollable > ptr = (io->second).lock()) {
-          string output = txt.str();
-          ptr->queueOutput(output);
-          ++io;
+      for (size_t i = 0; i < outputListeners.size(); /**/) {
+        if (Pollable * ptr = outputListeners.at(i)) {
+          ptr->queueOutput(textBuf.data(), textBuf.length());
+          ++i;
         } else {
-          OutputListenerSet::iterator to_delete = io++;
-          outputListeners.erase(to_delete);
+          outputListeners.removeAt(i);
         }
       }
     }
   }
+
+  // in low-latency mode, don't wait for the next poll() to send output
+
+  if (lowLatency) {
+    for (size_t i = 0; i < outputListeners.size(); ++i)
+      if (Pollable * ptr = outputListeners.at(i))
+        ptr->flushOutput();
+  }
+  return fl.size();
 };
 
 string PluginRunner::toJSON() {
@@ -295,13 +405,56 @@ string PluginRunner::toJSON() {
     << "\"libraryName\":\"" << pluginSOName << "\","
     << "\"pluginID\":\"" << pluginID << "\","
     << "\"pluginOutput\":\"" << pluginOutput << "\","
+    << "\"channels\":[";
+  for (unsigned c = 0; c < numChan; ++c)
+    s << (c ? "," : "") << channelMap[c];
+  s << "],"
     << "\"totalFrames\":" << totalFrames << ","
-    << "\"totalFeatures\":" << totalFeatures
-    << "}";
+    << "\"totalFeatures\":" << totalFeatures << ","
+    << "\"schedule\":\"" << schedule.toString() << "\","
+    << "\"framesSkipped\":" << framesSkipped << ","
+    << "\"activeFraction\":" << (totalFrames + framesSkipped > 0 ? (double) totalFrames / (totalFrames + framesSkipped) : 1.0) << ","
+    << "\"lowLatency\":" << (lowLatency ? "true" : "false") << ","
+    << "\"latency\":{"
+    << "\"last\":" << latencyLast << ","
+    << "\"mean\":" << (latencyCount ? latencySum / latencyCount : 0) << ","
+    << "\"max\":" << latencyMax << ","
+    << "\"count\":" << latencyCount
+    << "}}";
   return s.str();
 }
 
-PluginLoader *PluginRunner::pluginLoader = 0;
+string PluginRunner::configJSON() {
+  ostringstream s;
+  s << "{"
+    << "\"label\":\"" << label << "\","
+    << "\"device\":\"" << devLabel << "\","
+    << "\"channels\":\"";
+  for (unsigned c = 0; c < numChan; ++c)
+    s << (c ? "," : "") << channelMap[c];
+  s << "\","
+    << "\"library\":\"" << pluginSOName << "\","
+    << "\"plugin\":\"" << pluginID << "\","
+    << "\"output\":\"" << pluginOutput << "\","
+    << "\"params\":{" << std::setprecision(9);
+  for (ParamSetIter ip = pluginParams.begin(); ip != pluginParams.end(); ++ip)
+    s << (ip == pluginParams.begin() ? "" : ",") << "\"" << ip->first << "\":" << ip->second;
+  s << "},"
+    << "\"schedule\":\"" << schedule.toString() << "\","
+    << "\"lowLatency\":" << (lowLatency ? "true" : "false") << ","
+    << "\"state\":{"
+    << "\"totalFrames\":" << totalFrames << ","
+    << "\"totalFeatures\":" << totalFeatures << ","
+    << "\"framesSkipped\":" << framesSkipped
+    << "}}";
+  return s.str();
+}
+
+void PluginRunner::restoreCounters(long long totalFrames, long long totalFeatures, long long framesSkipped) {
+  this->totalFrames = totalFrames;
+  this->totalFeatures = totalFeatures;
+  this->framesSkipped = framesSkipped;
+}
 
 /*
   Trivially implementing the following methods allow us to put
@@ -322,9 +475,103 @@ PluginRunner::start(double timeNow) {
 
 void
 PluginRunner::setParameters(ParamSet &ps) {
-  if (plugin)
-    for (ParamSetIter it = ps.begin(); it != ps.end(); ++it)
-      plugin->setParameter(it->first, it->second);
+  // many plugins only act on parameters in initialise(), and
+  // re-initialising the running instance would lose its state and the
+  // partial block in plugbuf.  Instead, build a new instance with the
+  // updated parameters on a background thread; handleData() swaps it in
+  // at a block boundary.  If a build is already under way, a new one is
+  // started when it finishes, since its parameters are now stale.
+
+  for (ParamSetIter it = ps.begin(); it != ps.end(); ++it)
+    pluginParams[it->first] = it->second;
+  ++paramGen;
+  if (! building)
+    startBuild();
+};
+
+void
+PluginRunner::applyParameters(Plugin *p, ParamSet &ps) {
+  for (ParamSetIter it = ps.begin(); it != ps.end(); ++it)
+    p->setParameter(it->first, it->second);
+};
+
+void
+PluginRunner::startBuild() {
+  building = true;
+  builder = new boost::thread(boost::bind(&PluginRunner::buildPlugin, this, pluginParams, paramGen));
+};
+
+void
+PluginRunner::buildPlugin(ParamSet ps, int gen) {
+  // runs on the builder thread; the block and step sizes must match
+  // those of the running instance so that plugbuf can be handed over
+  // as-is.
+
+  PluginCache::Entry * entry;
+  Plugin * p = PluginCache::loadPlugin (pluginSOName, pluginID, rate, & entry);
+
+  if (p) {
+    applyParameters(p, ps);
+    if (p->initialise(numChan, stepSize, blockSize)) {
+      PluginBase::ParameterList & plist = entry->params;
+      for (PluginBase::ParameterList::iterator ipa = plist.begin(); ipa != plist.end(); ++ipa)
+        if (ipa->identifier == "isForVampAlsaHost")
+          p->setParameter(ipa->identifier, 1.0);
+    } else {
+      delete p;
+      p = 0;
+    }
+  }
+
+  boost::mutex::scoped_lock lock(pendingMutex);
+  pendingPlugin = p;
+  pendingGen = gen;
+  pendingDone = true;
+};
+
+void
+PluginRunner::checkPendingPlugin(const float * const * input, RealTime rt) {
+  // called from processBlock() right after a full block of input has
+  // been processed, with that block's timestamp.
+
+  Plugin * p;
+  int gen;
+  {
+    boost::mutex::scoped_lock lock(pendingMutex);
+    if (! pendingDone)
+      return;
+    p = pendingPlugin;
+    gen = pendingGen;
+    pendingPlugin = 0;
+    pendingDone = false;
+  }
+  building = false;
+  builder->join();
+  delete builder;
+  builder = 0;
+
+  if (gen != paramGen) {
+    // parameters were changed again while this instance was being built
+    delete p;
+    startBuild();
+    return;
+  }
+
+  if (! p) {
+    // the plugin won't initialise with the new parameters at our block
+    // and step sizes; fall back to setting them on the running instance
+    applyParameters(plugin, pluginParams);
+    return;
+  }
+
+  // pre-feed the new instance with the block just processed, discarding
+  // its output, which the old instance has already reported.  The next
+  // block it sees then follows on from this one, so no audio is lost or
+  // reported twice.
+
+  p->process(input, rt);
+  delete plugin;
+  plugin = p;
 };
 
 int
@@ -12,14 +12,19 @@
 #include <set>
 #include <memory>
 #include <fftw3.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
 
 using namespace Vamp;
 using namespace Vamp::HostExt;
 
 #include "ParamSet.hpp"
 #include "Pollable.hpp"
+#include "PluginCache.hpp"
+#include "SpectralStage.hpp"
+#include "Schedule.hpp"
 
-typedef std::map < string, weak_ptr < Pollable > > OutputListenerSet;
+typedef ListenerTable < Pollable > OutputListenerSet;
 
 class PluginRunner : public Pollable {
 public:
@@ -31,10 +36,10 @@ public:
   ParamSet           pluginParams;     // parameter settings for plugin
   static const int   MAX_NUM_CHAN = 16;// maximum number of channels a plugin can handle
 protected:
-  static PluginLoader *pluginLoader;   // plugin loader (singleton)
   VampAlsaHost *     host;             // host
   int                rate;             // sampling rate for plugin; frames per second
   unsigned int       numChan;          // number of channels plugin uses
+  std::vector < int > channelMap;      // device channel from which each plugin channel is taken
   unsigned int       maxSampleAbs;     // maximum absolute value of sample
   long long          totalFrames;      // total number of (decimated) frames this plugin instance has processed
   long long          totalFeatures;    // total number of "features" (e.g. lotek pulses) seen on this FCD
@@ -47,6 +52,33 @@ protected:
   bool               isOutputBinary;   // if true, output from plugin is not text.  For text outputs, if
   float              resampleScale;    // scale factor for a sum of hardware samples
   double             lastFrametimestamp; // frame timestamp from prvious call to handleData
+  bool               lowLatency;       // if true, device should wake us every period, and output is written immediately
+  bool               frequencyDomain;  // if true, plugin takes spectra from a shared SpectralStage, rather than plugbuf
+  shared_ptr < SpectralStage > spectral; // for frequency-domain plugins, the device's stage for our block size and channels
+  Schedule           schedule;         // when the device should give us data
+  long long          framesSkipped;    // frames the device skipped us for, because we were outside our schedule
+  bool               skipped;          // were we skipped since the last call to handleData?
+
+  // end-to-end latency, from the real time of the last frame in a block to
+  // the writing of features from that block; only blocks with features count
+
+  double             latencyLast;      // latency for most recent block with features (seconds)
+  double             latencySum;       // sum of latencies, for computing mean
+  double             latencyMax;       // maximum latency seen
+  long long          latencyCount;     // number of blocks with features
+  string             textBuf;          // text output for one feature; its storage is reused for each feature
+
+  // parameter changes are applied by building and initialising a new
+  // instance of the plugin on a background thread, then swapping it in
+  // at a block boundary.
+
+  boost::thread *    builder;          // thread building a replacement instance, if any
+  bool               building;         // true from when builder is started until its result is collected
+  int                paramGen;         // incremented each time parameters are changed
+  boost::mutex       pendingMutex;     // guards the pending* fields, which are written by builder
+  bool               pendingDone;      // true once builder has finished
+  Plugin *           pendingPlugin;    // replacement instance from builder; 0 if it could not be built
+  int                pendingGen;       // value of paramGen for which pendingPlugin was built
 
   // the output buffer gets filled before it can be written to a socket,
   // the oldest output is discarded line by line, so that any output line
@@ -56,7 +88,7 @@ protected:
   OutputListenerSet     outputListeners;     // connections receiving output from this plugin, if any.
 
 public:
-  PluginRunner(const string &label, const string &devLabel, int rate, int numChan, unsigned int maxSampleAbs, const string &pluginSOName, const string &pluginID, const string &pluginOutput, const ParamSet &ps);
+  PluginRunner(const string &label, const string &devLabel, int rate, const std::vector < int > &channelMap, unsigned int maxSampleAbs, const string &pluginSOName, const string &pluginID, const string &pluginOutput, const ParamSet &ps);
   ~PluginRunner();
 
   bool addOutputListener(string connLabel);
@@ -64,9 +96,24 @@ public:
   void removeAllOutputListeners();
 
   int loadPlugin();
-  void handleData(long avail, int16_t *src0, int16_t *src1, int step, double frameTimestamp);
-  void outputFeatures(Plugin::FeatureSet features, string prefix);
+  void handleData(long avail, float *src, int numDevChan, double frameTimestamp); // src holds avail frames of numDevChan interleaved channels
+  int outputFeatures(Plugin::FeatureSet &features, const string &prefix); // returns number of features output
   string toJSON();
+  string configJSON(); // this plugin as an entry in the "plugins" list of a config file; see Config.hpp
+  void restoreCounters(long long totalFrames, long long totalFeatures, long long framesSkipped); // from a snapshot
+
+  bool isFrequencyDomain() {return frequencyDomain;};
+  int getBlockSize() {return blockSize;};
+  int getStepSize() {return stepSize;};
+  const std::vector < int > & getChannelMap() {return channelMap;};
+  void setSpectralStage(shared_ptr < SpectralStage > s) {spectral = s;};
+
+  bool isScheduledAt(double t) {return schedule.isActive(t);};
+  void setSchedule(const string &spec) {schedule.parse(spec);}; // throws std::runtime_error if spec is invalid
+  void skipData(long long avail) {framesSkipped += avail; skipped = true;}; // called by device instead of handleData when we're outside our schedule
+
+  bool wantsLowLatency() {return lowLatency;};
+  void setLowLatency(bool yesno) {lowLatency = yesno;};
 
   int getNumPollFDs();
                       // return number of fds used by this Pollable (negative means error)
@@ -84,6 +131,11 @@ public:
 
 private:
   void delete_privates();
+  void applyParameters(Plugin *p, ParamSet &ps);
+  void startBuild();
+  void buildPlugin(ParamSet ps, int gen); // runs on builder thread
+  void checkPendingPlugin(const float * const * input, RealTime rt);
+  void processBlock(const float * const * input, double blockTimestamp, RealTime rt);
 };
 
 #endif // PLUGINRUNNER_HPP
@@ -4,15 +4,31 @@
 Pollable::Pollable(const std::string label) :
   label(label),
   indexInPollFD(-1),
-  outputBuffer(DEFAULT_OUTPUT_BUFFER_SIZE)
+  outputBuffer(DEFAULT_OUTPUT_BUFFER_SIZE),
+  outputPaused(false)
 {
   pollfd.fd = -1;
+
+  // take a slot in the handle table
+  if (freeSlots.size() > 0) {
+    handle.slot = freeSlots.back();
+    freeSlots.pop_back();
+  } else {
+    handle.slot = slotGens.size();
+    slotGens.push_back(0);
+  }
+  handle.gen = slotGens[handle.slot];
+
   pollables[label] = shared_ptr < Pollable > (this);
   regen_pollfds = true;
 };
 
 Pollable::~Pollable() {
   //  std::cout << "About to destroy Pollable with label " << label << std::endl;
+
+  // invalidate any handles to this Pollable, and free its slot
+  ++ slotGens[handle.slot];
+  freeSlots.push_back(handle.slot);
 };
 
 void
@@ -184,6 +200,32 @@ Pollable::writeSomeOutput (int maxBytes) {
   }
 };
 
+int
+Pollable::flushOutput () {
+  // for low-latency consumers: write queued output immediately instead
+  // of waiting for the next poll() to report POLLOUT.  Our sockets are
+  // unix-domain, so there is no Nagle delay to turn off; this is the
+  // equivalent of TCP_NODELAY.  Returns the number of bytes written.
+
+  if (outputPaused || getOutputFD() <= 0)
+    return 0;
+
+  int total = 0;
+  int n;
+  // the buffer may wrap, in which case it takes two writes
+  while (outputBuffer.size() > 0 && (n = writeSomeOutput(outputBuffer.size())) > 0)
+    total += n;
+
+  if (outputBuffer.size() > 0) {
+    // the socket is full (or in error); writeSomeOutput() may have
+    // cleared POLLOUT, so let poll() deal with the remainder
+    pollfd.events |= POLLOUT;
+    if (indexInPollFD >= 0)
+      eventsOf(0) = pollfd.events;
+  }
+  return total;
+};
+
 void
 Pollable::asyncMsg(std::string msg) {
   // send an asynchronous message to the control TCP connection (the first tcp connection)
@@ -211,6 +253,10 @@ Pollable::haveControlSocket() {
 
 
 // static initializers
+// (the handle table is defined before pollables, so that it is still
+// around when pollables is destroyed at exit)
+std::vector < unsigned int > Pollable::slotGens;
+std::vector < int > Pollable::freeSlots;
 std::vector < struct pollfd > Pollable::allpollfds(5);
 PollableSet Pollable::pollables;
 std::vector < std::string > Pollable::deferred_removes;
@@ -8,6 +8,7 @@
 */
 
 #include <string>
+#include <vector>
 #include <stdexcept>
 #include <stdint.h>
 #include <boost/circular_buffer.hpp>
@@ -25,6 +26,26 @@ using boost::static_pointer_cast;
 class Pollable;
 typedef std::map < std::string, shared_ptr < Pollable > > PollableSet;
 
+// identifies a Pollable by its slot in the handle table; the generation
+// changes when the Pollable is destroyed, so a stale handle never matches
+// a later Pollable which reuses the slot
+
+struct PollableHandle {
+  int          slot;
+  unsigned int gen;
+  PollableHandle() : slot(-1), gen(0) {};
+};
+
+// one batch of raw output from a device.  The same chunk is given to
+// all of the device's raw listeners, which may keep a reference to it
+// instead of copying its data.
+
+struct RawChunk {
+  std::vector < char > data;  // samples, in the device's sample format
+  double timestamp;           // timestamp of first frame
+};
+typedef shared_ptr < const RawChunk > RawChunkPtr;
+
 class Pollable {
 public:
   /* class members */
@@ -41,8 +62,12 @@ public:
   static void setControlSocket(string label);
   static void controlSocketClosed();
   static bool haveControlSocket();
+  static bool isLive(const PollableHandle &h) {return h.slot >= 0 && slotGens[h.slot] == h.gen;}; // is the Pollable with this handle still around?
 
 protected:
+  static std::vector < unsigned int > slotGens; // current generation of each slot in the handle table
+  static std::vector < int > freeSlots;         // slots in the handle table not in use
+
   static std::vector <struct pollfd> allpollfds; // in same order as pollables, but some pollables may have 0 or more than 1 FD
   static std::vector < std::string > deferred_removes;
   static bool regen_pollfds;
@@ -62,10 +87,13 @@ public:
   virtual ~Pollable();
 
   string label;
+  PollableHandle handle;  // for fast lookup by ListenerTables
   virtual string toJSON() = 0;
   virtual bool queueOutput(const char * p, uint32_t len, double timestamp = 0.0);
   virtual bool queueOutput(std::string &str, double timestamp = 0) {return queueOutput(str.data(), str.length(), timestamp);};
+  virtual bool queueChunk(const RawChunkPtr &chunk) {return queueOutput(chunk->data.size() ? & chunk->data[0] : 0, chunk->data.size(), chunk->timestamp);}; // by default, copy into outputBuffer
   int writeSomeOutput(int maxBytes);
+  virtual int flushOutput(); // write as much queued output as the fd will take now, rather than waiting for POLLOUT
 
   short & eventsOf(int offset = 0); // reference to the events field for a pollfd
 
@@ -76,6 +104,7 @@ public:
   virtual void handleEvents (struct pollfd *pollfds, bool timedOut, double timeNow) {}; // handle possible event(s) on the fds for this Pollable
   virtual int start(double timeNow){ return 0;};
   virtual void stop(double timeNow){};
+  virtual bool wantsLowLatency() {return false;}; // should data be delivered to this Pollable with minimum delay?
 
 protected:
   int indexInPollFD;  // index of first FD in class pollfds vector (< 0 means not in pollfd vector)
@@ -85,4 +114,53 @@ protected:
   bool outputPaused;
 };
 
+/*
+  A table of Pollables receiving data from another object, e.g. the
+  plugins and raw listeners of a device, or the connections receiving
+  output from a plugin.  These are walked for every batch of data or
+  every feature, so entries are kept in a dense vector, in the order
+  added, each with a raw pointer and the Pollable's handle.  Checking
+  that an entry is still live is then an index and a compare, rather
+  than locking a weak_ptr and walking a map.  Labels are only used by
+  add() and remove(), i.e. by commands.
+
+  P must be Pollable or a subclass.
+*/
+
+template < class P >
+class ListenerTable {
+public:
+  void add(const string &label, P * ptr) {
+    // replaces any entry with the same label; a null ptr just removes it
+    remove(label);
+    if (! ptr)
+      return;
+    Entry e;
+    e.ptr = ptr;
+    e.handle = ptr->handle;
+    e.label = label;
+    entries.push_back(e);
+  };
+  void remove(const string &label) {
+    for (size_t i = 0; i < entries.size(); ++i)
+      if (entries[i].label == label) {
+        removeAt(i);
+        return;
+      }
+  };
+  void removeAt(size_t i) {entries.erase(entries.begin() + i);}; // keeps order
+  void clear() {entries.clear();};
+  size_t size() const {return entries.size();};
+  P * at(size_t i) const {return Pollable::isLive(entries[i].handle) ? entries[i].ptr : 0;}; // 0 if destroyed
+  const string & labelAt(size_t i) const {return entries[i].label;};
+
+protected:
+  struct Entry {
+    P *            ptr;
+    PollableHandle handle;
+    string         label;
+  };
+  std::vector < Entry > entries;
+};
+
 #endif /* POLLABLE_HPP */
@@ -1,5 +1,4 @@
 #include "RTLSDRMinder.hpp"
-#include <sys/ioctl.h>
 #include <stdint.h>
 #include <arpa/inet.h>
 #include <time.h>
@@ -59,7 +58,9 @@ RTLSDRMinder::RTLSDRMinder(const string &devName, int rate, unsigned int numChan
   rtltcp(-1),
   headerValid(false),
   segi(0),
-  bytesAvail(0)
+  staging(STAGING_BYTES),
+  stagingLen(0),
+  carryByte(-1)
 {
   if (devName.substr(0, 7) != "rtlsdr:")
     throw std::runtime_error("Invalid name for RTLSDR device; must look like 'rtlsdr:PATH'");
@@ -87,30 +88,56 @@ int RTLSDRMinder::hw_handleEvents ( struct pollfd *pollfds, bool timedOut) {
   if (rtltcp < 0 || timedOut)
     return 0;
   if (pollfds->revents & POLLIN) {
-    // return number of frames available
-    int avail;
-    ioctl(rtltcp, FIONREAD, &avail);
-    bytesAvail = avail;
-    return (avail + 1) / 2; // hardcoded: 1 byte per sample, two channels (I/Q)
+    // read as much as is available with a single call, appending to whatever
+    // (at most a partial header and one sample byte) was left unparsed by the
+    // previous call to hw_getFrames
+    int bytes = recv(rtltcp, & staging[stagingLen], staging.size() - stagingLen, MSG_DONTWAIT);
+    if (bytes <= 0)
+      return 0;
+    stagingLen += bytes;
+    // return an upper bound on the number of frames available, since some of the
+    // bytes are headers; hardcoded: 1 byte per sample, two channels (I/Q)
+    return (stagingLen + (carryByte >= 0)) / 2;
   }
   return 0;
 };
 
-int RTLSDRMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp) {
+void RTLSDRMinder::expandIQ(const uint8_t *src, float *dst, size_t n) {
+  // convert from offset binary to signed, and scale by SAMPLE_SCALE so raw
+  // output in S16_LE keeps the precision gained by averaging downsampling.
+  const uint8_t * __restrict__ s = src;
+  float * __restrict__ d = dst;
+  for (size_t i = 0; i < n; ++i)
+    d[i] = ((int) s[i] - 128) * SAMPLE_SCALE;
+};
+
+int RTLSDRMinder::hw_getFrames (float *buf, int numFrames, double & frameTimestamp) {
   /*
-    data available in the recv buf look like so:
+    data in the staging buffer look like so:
 
      [ seg header, or tail thereof ]? [sample data] [ seg header ] [sample data] ... [seg header] [sample data]
 
     and there is no alignment to stream segment boundaries as we're using a stream-oriented socket protocol
 
-    So we perform one or more recv()'s to completely use up the available byte count (recorded in the
-    most recent call to hw_handleEvents), removing any stream_segment_hdr_t structures; the latest such
-    struct is saved for use of its timestamp and byte count.  We return the count of frames copied to
-    buf, which will not exceed numFrames.
+    So we parse the staging buffer in place, skipping any stream_segment_hdr_t structures; the latest such
+    struct is saved for use of its timestamp and byte count.  Sample data are expanded directly from the
+    staging buffer into buf.  We return the count of frames copied to buf, which will not exceed numFrames.
+    A partial header, or an odd trailing sample byte (so that I and Q stay paired), is left in the staging
+    buffer for the next call.  If a partial header follows an odd sample byte, that byte is kept in carryByte,
+    and is the first sample returned by the next call.
 
   */
-  int sampleBytesCopied = 0;
+  unsigned int sampleBytesCopied = 0;
+  unsigned int pos = 0;
+  uint8_t lastSampleByte = 0; // most recent sample byte copied to buf, as received
+
+  if (carryByte >= 0 && numFrames > 0) {
+    uint8_t b = lastSampleByte = carryByte;
+    expandIQ(& b, buf, 1);
+    ++buf;
+    sampleBytesCopied = 1;
+    carryByte = -1;
+  }
 
   // we accumulate the best estimate of the timestamp for the first sample in this segment,
   // getting a separate estimate for each segment header in the current buffer.
@@ -119,23 +146,20 @@ int RTLSDRMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimes
   if (segi >= sizeof(stream_segment_hdr_t)) {
     // we already have a header for the current segment, so
     // estimate the timestamp of the first sample to be copied to the buffer
-    frameTimestamp = header.ts + ((segi - sizeof(stream_segment_hdr_t)) / 2.0) / hwRate;
+    frameTimestamp = header.ts + (((int) segi - (int) sizeof(stream_segment_hdr_t) - (int) sampleBytesCopied) / 2.0) / hwRate;
     numTSest = 1;
   } else {
     frameTimestamp = 0;
   }
 
-  while (bytesAvail > 0) {
+  while (pos < stagingLen) {
     // try finish filling in the current stream_segment_hdr_t, if not already full.
 
-    int hdrBytes  = std::min((int) sizeof(stream_segment_hdr_t) - (int) segi, (int) bytesAvail);
-    if (hdrBytes > 0) {
-      // need to try finish filling in header
-      int bytes = recv(rtltcp, ((char *) (& header)) + segi, hdrBytes, 0);
-      if (bytes != hdrBytes)
-        std::cerr << "Bytes = " << bytes << " but hdrBytes = " << hdrBytes << std::endl;
-      bytesAvail -= bytes;
-      segi +=  bytes;
+    if (segi < sizeof(stream_segment_hdr_t)) {
+      unsigned int hdrBytes = std::min((unsigned int) sizeof(stream_segment_hdr_t) - segi, stagingLen - pos);
+      memcpy(((char *) (& header)) + segi, & staging[pos], hdrBytes);
+      pos += hdrBytes;
+      segi += hdrBytes;
       // if new header has been obtained, add a new estimate of the timestamp for the first sample in the buffer
       if (segi == sizeof(stream_segment_hdr_t)) {
         frameTimestamp += header.ts - (sampleBytesCopied / 2.0) / hwRate;
@@ -144,32 +168,34 @@ int RTLSDRMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimes
       continue;
     }
 
-    // try finish the sample data from the stream segment
-
-    int dataBytes = std::min((int) header.size - (int) segi, (int) bytesAvail);
-    if (dataBytes > 0) {
-      // need to continue copying data
-      int bytes = recv(rtltcp, buf, dataBytes, 0);
-      if (bytes != dataBytes)
-        std::cerr << "Bytes = " << bytes << " but dataBytes = " << dataBytes << std::endl;
-
-      // expand the samples from 8 to 16 bits
-      // working from right to left; also, shift left 8 bits so sample downsampling using average method maintains more precision.
-      int16_t * ebuf = buf + (bytes - 1);
-      unsigned char * cbuf = ((unsigned char *) buf) + (bytes - 1);
-      for ( int i = bytes; i > 0; --i, --cbuf, --ebuf)
-        *ebuf = ((int16_t) (int8_t) (*cbuf - 128)) * SAMPLE_SCALE; // scale from 8 to 16 bits, improving precision of averaging downsampling
-
-      bytesAvail -= bytes;
-      segi +=  bytes;
-      sampleBytesCopied += bytes;
-      buf += bytes;
-      if (segi == header.size) {
-        segi = 0;
-      }
-      continue;
+    // expand as much of the sample data from the stream segment as we have
+
+    unsigned int dataBytes = std::min(std::min(header.size - segi, stagingLen - pos), 2 * numFrames - sampleBytesCopied);
+    if (pos + dataBytes == stagingLen && ((sampleBytesCopied + dataBytes) & 1))
+      --dataBytes;
+    if (dataBytes == 0)
+      break;
+
+    expandIQ(& staging[pos], buf, dataBytes);
+    lastSampleByte = staging[pos + dataBytes - 1];
+
+    pos += dataBytes;
+    segi += dataBytes;
+    sampleBytesCopied += dataBytes;
+    buf += dataBytes;
+    if (segi == header.size) {
+      segi = 0;
     }
   }
+
+  // keep any unparsed bytes for next time, and the unpaired sample byte, if any
+
+  if (sampleBytesCopied & 1)
+    carryByte = lastSampleByte;
+  if (pos < stagingLen)
+    memmove(& staging[0], & staging[pos], stagingLen - pos);
+  stagingLen -= pos;
+
   if (numTSest > 1)
     frameTimestamp /= numTSest;
   return sampleBytesCopied / 2; // returning # of frames
@@ -36,11 +36,14 @@ protected:
   stream_segment_hdr_t   header;      // most recently encountered header in stream
   bool                   headerValid; // is content of latestHeader valid?
   unsigned int           segi;        // how many bytes from this segment (header + data) have been processed, including those from the header
-  unsigned int           bytesAvail;  // bytes available in recv buffer, from latest ioctl()
+  std::vector < uint8_t > staging;    // bytes received from rtl_tcp but not yet parsed
+  unsigned int           stagingLen;  // number of bytes in staging
+  int                    carryByte;   // sample byte parsed but not returned by hw_getFrames, as its pair hadn't arrived; -1 if none
 
 public:
 
   const static int RTLSDR_FRAMES = 2048;
+  const static int STAGING_BYTES = 262144; // size of staging buffer; at most this many bytes are read per wakeup
   const static int SAMPLE_SCALE = 16;  // amount by which to multiply signed 8-bit samples to get signed 16-bit sample; for plugins, this
                                        // only matters if downsampling by averaging (and then, only improves precision a bit);
                                        // simple subsampling isn't affected, as the scale
@@ -61,7 +64,7 @@ public:
 
   virtual int hw_handleEvents ( struct pollfd *pollfds, bool timedOut);
 
-  virtual int hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp);
+  virtual int hw_getFrames (float *buf, int numFrames, double & frameTimestamp);
 
 protected:
 
@@ -71,6 +74,8 @@ protected:
   virtual int hw_do_restart();
   virtual bool hw_running(double timeNow);
 
+  static void expandIQ(const uint8_t *src, float *dst, size_t n); // convert n unsigned 8-bit samples to scaled floats
+
   int getHWRateForRate(int rate); // get minimum sampling rate that is an integer multiple of desired rate; this is the hardware
   // sampling rate that nodejs would have set for this rtlsdr device
   // sets fields hwRate and downsamplefactor correspondingly; returns 0 on sucess, non-zero on error.
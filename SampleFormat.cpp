@@ -0,0 +1,135 @@
+#include "SampleFormat.hpp"
+#include "WavFileHeader.hpp"
+#include <stdexcept>
+#include <string.h>
+#include <algorithm>
+
+static const char * formatNames[SampleFormat::NUM_FORMATS] = {"S16_LE", "S24_3LE", "S32_LE", "FLOAT_LE"};
+
+int SampleFormat::bytes(Code f) {
+  switch (f) {
+  case S24_3LE:
+    return 3;
+  case S32_LE:
+  case FLOAT_LE:
+    return 4;
+  default:
+    return 2;
+  }
+};
+
+double SampleFormat::maxAbs(Code f) {
+  switch (f) {
+  case S24_3LE:
+    return 8388608.0;
+  case S32_LE:
+    return 2147483648.0;
+  case FLOAT_LE:
+    return 1.0;
+  default:
+    return 32768.0;
+  }
+};
+
+int SampleFormat::wavFmtCode(Code f) {
+  return f == FLOAT_LE ? WavFileHeader::SAMPLE_FMT_CODE_IEEE_FLOAT : WavFileHeader::SAMPLE_FMT_CODE_PCM;
+};
+
+const char * SampleFormat::name(Code f) {
+  if (f < 0 || f >= NUM_FORMATS)
+    return "auto";
+  return formatNames[f];
+};
+
+SampleFormat::Code SampleFormat::fromName(const std::string &name) {
+  if (name == "auto")
+    return AUTO;
+  for (int i = 0; i < NUM_FORMATS; ++i)
+    if (name == formatNames[i])
+      return (Code) i;
+  throw std::runtime_error(std::string("Unknown sample format '") + name + "'");
+};
+
+void SampleFormat::toFloat(Code f, const void *src, float *dst, size_t n) {
+  switch (f) {
+  case S16_LE:
+    {
+      const int16_t * __restrict__ s = (const int16_t *) src;
+      float * __restrict__ d = dst;
+      for (size_t i = 0; i < n; ++i)
+        d[i] = s[i];
+    }
+    break;
+  case S24_3LE:
+    {
+      // assemble each sample in the top 3 bytes of an int32 so the
+      // arithmetic shift sign-extends it
+      const uint8_t * __restrict__ s = (const uint8_t *) src;
+      float * __restrict__ d = dst;
+      for (size_t i = 0; i < n; ++i, s += 3)
+        d[i] = (int32_t) (((uint32_t) s[0] << 8) | ((uint32_t) s[1] << 16) | ((uint32_t) s[2] << 24)) >> 8;
+    }
+    break;
+  case S32_LE:
+    {
+      const int32_t * __restrict__ s = (const int32_t *) src;
+      float * __restrict__ d = dst;
+      for (size_t i = 0; i < n; ++i)
+        d[i] = s[i];
+    }
+    break;
+  case FLOAT_LE:
+    memcpy(dst, src, n * sizeof(float));
+    break;
+  default:
+    break;
+  }
+};
+
+void SampleFormat::fromFloat(Code f, const float *src, void *dst, size_t n) {
+  // NB: rounding is done by adding +/-0.5 and truncating, rather than
+  // with lrintf(), which prevents vectorization
+
+  switch (f) {
+  case S16_LE:
+    {
+      const float * __restrict__ s = src;
+      int16_t * __restrict__ d = (int16_t *) dst;
+      for (size_t i = 0; i < n; ++i) {
+        float v = std::min(std::max(s[i], -32768.0f), 32767.0f);
+        d[i] = (int16_t) (v + (v >= 0 ? 0.5f : -0.5f));
+      }
+    }
+    break;
+  case S24_3LE:
+    {
+      const float * __restrict__ s = src;
+      uint8_t * __restrict__ d = (uint8_t *) dst;
+      for (size_t i = 0; i < n; ++i, d += 3) {
+        float v = std::min(std::max(s[i], -8388608.0f), 8388607.0f);
+        int32_t x = (int32_t) (v + (v >= 0 ? 0.5f : -0.5f));
+        d[0] = x;
+        d[1] = x >> 8;
+        d[2] = x >> 16;
+      }
+    }
+    break;
+  case S32_LE:
+    {
+      // 2147483520 is the largest float below 2^31; at this magnitude, adding
+      // 0.5 has no effect, so the rounding can't overflow
+      const float * __restrict__ s = src;
+      int32_t * __restrict__ d = (int32_t *) dst;
+      for (size_t i = 0; i < n; ++i) {
+        float v = std::min(std::max(s[i], -2147483648.0f), 2147483520.0f);
+        d[i] = (int32_t) (v + (v >= 0 ? 0.5f : -0.5f));
+      }
+    }
+    break;
+  case FLOAT_LE:
+    memcpy(dst, src, n * sizeof(float));
+    break;
+  default:
+    break;
+  }
+};
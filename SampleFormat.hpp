@@ -0,0 +1,49 @@
+#ifndef SAMPLEFORMAT_HPP
+#define SAMPLEFORMAT_HPP
+
+/*
+  Sample formats we can capture natively, and kernels for converting
+  between them and the float samples used internally.
+
+  Internally, samples are floats in device units; i.e. they are not
+  normalized, so an S16_LE sample of 1000 becomes 1000.0f.  Plugins
+  scale by 1 / maxAbs(format) when filling their buffers, and raw
+  output is converted back to the device's native format, so the
+  round trip is exact for integer formats of up to 24 bits.
+
+  The conversion loops are written so that gcc auto-vectorizes them
+  with the -O3 -ftree-vectorize (and on ARM, -mfpu=neon) flags used
+  in the Makefiles.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+struct SampleFormat {
+
+  enum Code {
+    AUTO     = -1,  // not a format: let the device choose
+    S16_LE   = 0,
+    S24_3LE  = 1,   // packed 24-bit, 3 bytes per sample
+    S32_LE   = 2,
+    FLOAT_LE = 3
+  };
+
+  static const int NUM_FORMATS = 4;
+
+  static int bytes(Code f);                 // bytes per sample
+  static int bits(Code f) {return 8 * bytes(f);}; // bits per sample, as written to .WAV files
+  static double maxAbs(Code f);             // maximum absolute sample value, in device units
+  static int wavFmtCode(Code f);            // format code for the .WAV header
+  static const char * name(Code f);         // ALSA-style name, e.g. "S24_3LE"
+  static Code fromName(const std::string &name); // inverse of name(); AUTO if name is "auto"; throws if unknown
+
+  // convert n samples from format f at src to floats at dst
+  static void toFloat(Code f, const void *src, float *dst, size_t n);
+
+  // convert n floats at src to format f at dst, with rounding and clipping
+  static void fromFloat(Code f, const float *src, void *dst, size_t n);
+};
+
+#endif // SAMPLEFORMAT_HPP
@@ -0,0 +1,79 @@
+#include "Schedule.hpp"
+#include <sstream>
+#include <stdexcept>
+#include <cmath>
+#include <cstdio>
+
+Schedule::Schedule() :
+  kind(ALWAYS),
+  on(0),
+  period(0),
+  offset(0),
+  spec("always")
+{
+};
+
+void Schedule::parse(const std::string &spec) {
+  std::istringstream s(spec);
+  std::string word;
+  s >> word;
+
+  if (word == "always") {
+    kind = ALWAYS;
+  } else if (word == "duty") {
+    double on = 0, period = 0, offset = 0;
+    s >> on >> period;
+    if (! s || ! (on > 0 && period >= on))
+      throw std::runtime_error("duty schedule must be 'duty ON_SECONDS PERIOD_SECONDS [OFFSET_SECONDS]', with 0 < ON_SECONDS <= PERIOD_SECONDS");
+    s >> offset;
+    kind = DUTY;
+    this->on = on;
+    this->period = period;
+    this->offset = offset;
+  } else if (word == "daily") {
+    std::string list;
+    s >> list;
+    std::vector < std::pair < int, int > > w;
+    std::istringstream items(list);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+      int h1, m1, h2, m2;
+      char tail;
+      if (sscanf(item.c_str(), "%d:%d-%d:%d%c", &h1, &m1, &h2, &m2, &tail) != 4
+          || h1 < 0 || h1 > 24 || m1 < 0 || m1 > 59 || h2 < 0 || h2 > 24 || m2 < 0 || m2 > 59)
+        throw std::runtime_error(std::string("invalid daily window '") + item + "'; must be HH:MM-HH:MM");
+      w.push_back(std::make_pair((h1 * 60 + m1) * 60, (h2 * 60 + m2) * 60));
+    }
+    if (w.size() == 0)
+      throw std::runtime_error("daily schedule must be 'daily HH:MM-HH:MM[,HH:MM-HH:MM...]'");
+    kind = DAILY;
+    windows = w;
+  } else {
+    throw std::runtime_error(std::string("unknown schedule '") + spec + "'; must be 'always', 'duty ...' or 'daily ...'");
+  }
+  this->spec = spec;
+};
+
+bool Schedule::isActive(double t) const {
+  switch (kind) {
+  case DUTY:
+    {
+      double p = fmod(t - offset, period);
+      if (p < 0)
+        p += period;
+      return p < on;
+    }
+  case DAILY:
+    {
+      double sec = fmod(t, SECONDS_PER_DAY);
+      for (size_t i = 0; i < windows.size(); ++i) {
+        int start = windows[i].first, end = windows[i].second;
+        if (start <= end ? (sec >= start && sec < end) : (sec >= start || sec < end))
+          return true;
+      }
+      return false;
+    }
+  default:
+    return true;
+  }
+};
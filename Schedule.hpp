@@ -0,0 +1,53 @@
+#ifndef SCHEDULE_HPP
+#define SCHEDULE_HPP
+
+/*
+  When a plugin should run, in terms of (real) frame timestamps.
+
+  A schedule is given as text, one of:
+
+    always
+        the default
+
+    duty ON_SECONDS PERIOD_SECONDS [OFFSET_SECONDS]
+        active for the first ON_SECONDS of every PERIOD_SECONDS,
+        with periods starting at OFFSET_SECONDS (default 0) past the
+        epoch; e.g. "duty 600 3600" runs for the first ten minutes of
+        every hour
+
+    daily HH:MM-HH:MM[,HH:MM-HH:MM...]
+        active during the given windows each day, in UTC; a window
+        whose end is before its start runs past midnight
+
+  A PluginRunner outside its schedule is skipped by its device, rather
+  than detached, so it keeps its state and needs no reload.
+*/
+
+#include <string>
+#include <vector>
+#include <utility>
+
+class Schedule {
+
+public:
+
+  Schedule(); // always active
+
+  void parse(const std::string &spec); // throws std::runtime_error if spec is invalid, leaving the schedule unchanged
+  bool isActive(double t) const; // is the schedule active at timestamp t?
+  bool isAlways() const {return kind == ALWAYS;};
+  const std::string & toString() const {return spec;};
+
+protected:
+
+  static const int SECONDS_PER_DAY = 86400;
+
+  enum {ALWAYS, DUTY, DAILY} kind;
+  double on;           // for DUTY, seconds active per period
+  double period;       // for DUTY, seconds per period
+  double offset;       // for DUTY, start of first period
+  std::vector < std::pair < int, int > > windows; // for DAILY, [start, end) in seconds past midnight UTC
+  std::string spec;    // as given to parse()
+};
+
+#endif // SCHEDULE_HPP
@@ -0,0 +1,105 @@
+#include "SpectralStage.hpp"
+#include "FFTPlanCache.hpp"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+SpectralStage::SpectralStage(int rate, int blockSize, int stepSize, const std::vector < int > &channelMap, float scale) :
+  rate(rate),
+  blockSize(blockSize),
+  stepSize(stepSize),
+  numChan(channelMap.size()),
+  channelMap(channelMap),
+  scale(scale),
+  timebuf(channelMap.size()),
+  framesInBuf(0),
+  window(blockSize),
+  ready(0)
+{
+  for (unsigned c = 0; c < numChan; ++c)
+    timebuf[c] = fftwf_alloc_real(blockSize);
+
+  // same window as Vamp::Window<float> (HanningWindow)
+  for (int i = 0; i < blockSize; ++i)
+    window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / blockSize);
+
+  // plan on scratch output; transforms are done with fftwf_execute_dft_r2c
+  // into whichever spectrum buffer is next, all of which come from
+  // fftwf_alloc_real and so have the alignment the plan assumes
+
+  fftIn = fftwf_alloc_real(blockSize);
+  float * scratch = fftwf_alloc_real(blockSize + 2);
+  plan = FFTPlanCache::forward(blockSize, fftIn, (fftwf_complex *) scratch);
+  fftwf_free(scratch);
+};
+
+SpectralStage::~SpectralStage() {
+  fftwf_free(fftIn);
+  for (unsigned c = 0; c < numChan; ++c)
+    fftwf_free(timebuf[c]);
+  for (size_t i = 0; i < spectra.size(); ++i)
+    fftwf_free(spectra[i]);
+};
+
+bool SpectralStage::matches(int blockSize, int stepSize, const std::vector < int > &channelMap) const {
+  return blockSize == this->blockSize && stepSize == this->stepSize && channelMap == this->channelMap;
+};
+
+void SpectralStage::handleData(long avail, float *src, int numDevChan, double frameTimestamp) {
+  // same block assembly as PluginRunner::handleData
+
+  ready = 0;
+
+  // get timestamp of first frame in timebuf
+  frameTimestamp -= (double) framesInBuf / rate;
+
+  while (avail > 0) {
+    int frames_to_copy = std::min((int) avail, blockSize - framesInBuf);
+
+    for (int i = framesInBuf; i < framesInBuf + frames_to_copy; ++i, src += numDevChan) {
+      for (unsigned c = 0; c < numChan; ++c)
+        timebuf[c][i] = src[channelMap[c]] * scale;
+    }
+
+    avail -= frames_to_copy;
+    framesInBuf += frames_to_copy;
+
+    if (framesInBuf == blockSize) {
+      transform(frameTimestamp);
+
+      if (stepSize < blockSize) {
+        for (unsigned c = 0; c < numChan; ++c)
+          memmove(&timebuf[c][0], &timebuf[c][stepSize], (blockSize - stepSize) * sizeof(float));
+        framesInBuf = blockSize - stepSize;
+        frameTimestamp += (double) stepSize / rate;
+      } else {
+        framesInBuf = 0;
+        frameTimestamp += (double) blockSize / rate;
+      }
+    }
+  }
+};
+
+void SpectralStage::transform(double frameTimestamp) {
+  // make room for another block's spectra; buffers are kept from batch to
+  // batch, so this only allocates until the largest batch has been seen
+
+  if ((ready + 1) * numChan > spectra.size()) {
+    for (unsigned c = 0; c < numChan; ++c)
+      spectra.push_back(fftwf_alloc_real(blockSize + 2));
+    stamps.push_back(0);
+  }
+
+  int half = blockSize / 2;
+  for (unsigned c = 0; c < numChan; ++c) {
+    // window, and swap the two halves of the block
+    float * in = timebuf[c];
+    for (int i = 0; i < half; ++i) {
+      fftIn[i] = in[i + half] * window[i + half];
+      fftIn[i + half] = in[i] * window[i];
+    }
+    fftwf_execute_dft_r2c(plan, fftIn, (fftwf_complex *) spectra[ready * numChan + c]);
+  }
+  stamps[ready] = frameTimestamp;
+  ++ready;
+};
@@ -0,0 +1,60 @@
+#ifndef SPECTRALSTAGE_HPP
+#define SPECTRALSTAGE_HPP
+
+/*
+  Shared FFT front end for frequency-domain plugins.
+
+  A DevMinder keeps one SpectralStage for each combination of block
+  size, step size and channel list used by its attached
+  frequency-domain plugins.  The stage is given each batch of device
+  data before the plugins are, assembles blocks exactly as
+  PluginRunner::handleData does for time-domain plugins, and computes
+  one transform per channel per block.  Every plugin attached to the
+  stage then processes the same spectra, so two detectors on the same
+  device and block size no longer transform the same data twice.
+
+  The transform matches what PluginInputDomainAdapter does: a Hann
+  window, a circular shift by half a block so that phase is relative to
+  the centre of the block, and a real FFT of blockSize points giving
+  blockSize / 2 + 1 complex bins per channel, interleaved as (re, im).
+*/
+
+#include <vector>
+#include <fftw3.h>
+
+class SpectralStage {
+
+public:
+
+  SpectralStage(int rate, int blockSize, int stepSize, const std::vector < int > &channelMap, float scale); // blockSize must be even
+  ~SpectralStage();
+
+  bool matches(int blockSize, int stepSize, const std::vector < int > &channelMap) const;
+
+  void handleData(long avail, float *src, int numDevChan, double frameTimestamp); // src holds avail frames of numDevChan interleaved channels
+  void reset() {framesInBuf = 0; ready = 0;}; // discard any partial block, e.g. after data have been skipped
+
+  int numReady() const {return ready;}; // number of blocks transformed by the most recent call to handleData
+  const float * const * spectrum(int k) const {return & spectra[k * numChan];}; // one (re, im) array per channel for block k
+  double timestamp(int k) const {return stamps[k];}; // timestamp of first frame of block k
+
+protected:
+  int                   rate;          // frames per second
+  int                   blockSize;     // size (in frames) of blocks transformed
+  int                   stepSize;      // amount (in frames) by which consecutive blocks differ
+  unsigned int          numChan;       // number of channels transformed
+  std::vector < int >   channelMap;    // device channel for each transformed channel
+  float                 scale;         // scale factor from device units to [-1, 1]
+  std::vector < float * > timebuf;     // one block of time-domain data for each channel
+  int                   framesInBuf;   // frames in timebuf
+  float *               fftIn;         // windowed and shifted block for one channel
+  std::vector < float > window;        // Hann window
+  fftwf_plan            plan;          // real FFT of blockSize points, executed on fftIn and spectra; owned by FFTPlanCache
+  std::vector < float * > spectra;     // numChan arrays of blockSize + 2 floats for each block; grows as needed
+  std::vector < double > stamps;       // timestamp of first frame of each block
+  int                   ready;         // number of blocks in spectra from the latest batch
+
+  void transform(double frameTimestamp); // transform the full block in timebuf
+};
+
+#endif // SPECTRALSTAGE_HPP
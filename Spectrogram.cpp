@@ -0,0 +1,228 @@
+#include "Spectrogram.hpp"
+#include "FFTPlanCache.hpp"
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <boost/bind.hpp>
+
+Spectrogram::Spectrogram(const string &label, const string &devLabel, const string &connLabel, int rate, int channel, unsigned int maxSampleAbs,
+                         int fftSize, double rowsPerSecond, float dbFloor, float dbRange) :
+  Pollable(label),
+  devLabel(devLabel),
+  connLabel(connLabel),
+  conn(Pollable::lookupByName(connLabel)),
+  rate(rate),
+  channel(channel),
+  scale(1.0 / maxSampleAbs),
+  fftSize(fftSize),
+  numBins(fftSize / 2),
+  rowsPerSecond(rowsPerSecond),
+  dbFloor(dbFloor),
+  dbRange(dbRange),
+  pendingTimestamp(0),
+  pendingGap(false),
+  quitting(false),
+  framesDropped(0),
+  timebufTimestamp(0),
+  framesPerRow(rate / rowsPerSecond),
+  rowFrames(0),
+  rowTimestamp(0),
+  numInRow(0),
+  power(fftSize / 2),
+  window(fftSize),
+  rowsSent(0)
+{
+  if (conn)
+    connHandle = conn->handle;
+
+  // overlap transforms by half, unless rows are closer together than that
+  hop = std::max(1, (int) std::min(framesPerRow, (double) (fftSize / 2)));
+
+  double sumw = 0;
+  for (int i = 0; i < fftSize; ++i) {
+    window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / fftSize);
+    sumw += window[i];
+  }
+  // a full-scale sine in bin k has |X[k]| = sumw / 2
+  powerScale = 4.0 / (sumw * sumw);
+
+  // plans can only be made on the poll thread, so make ours now
+  fftIn = fftwf_alloc_real(fftSize);
+  fftOut = fftwf_alloc_complex(fftSize / 2 + 1);
+  plan = FFTPlanCache::forward(fftSize, fftIn, fftOut);
+
+  worker = new boost::thread(boost::bind(&Spectrogram::run, this));
+};
+
+Spectrogram::~Spectrogram() {
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    quitting = true;
+  }
+  wake.notify_one();
+  worker->join();
+  delete worker;
+  fftwf_free(fftIn);
+  fftwf_free(fftOut);
+};
+
+void Spectrogram::checkSettings(int fftSize, double rowsPerSecond, float dbRange) {
+  if (fftSize < MIN_FFT_SIZE || fftSize > MAX_FFT_SIZE || (fftSize & (fftSize - 1)))
+    throw std::runtime_error("FFT size must be a power of two between 16 and 65536");
+  if (! (rowsPerSecond > 0 && rowsPerSecond <= MAX_ROWS_PER_SECOND))
+    throw std::runtime_error("rows per second must be greater than 0 and at most 100");
+  if (! (dbRange > 0))
+    throw std::runtime_error("dB range must be positive");
+};
+
+void Spectrogram::handleData(long avail, float *src, int numDevChan, double frameTimestamp) {
+  // runs on the poll thread: hand our channel's samples to the worker,
+  // and queue any rows it has finished to the connection
+
+  if (connectionClosed())
+    return;
+
+  {
+    boost::mutex::scoped_lock lock(mutex);
+
+    if (pending.size() + avail > (size_t) MAX_BACKLOG_SECONDS * rate) {
+      // the worker is too far behind; start again from this batch
+      framesDropped += pending.size();
+      pending.clear();
+      pendingGap = true;
+    }
+    if (pending.size() == 0)
+      pendingTimestamp = frameTimestamp;
+    src += channel;
+    for (long i = 0; i < avail; ++i, src += numDevChan)
+      pending.push_back(*src * scale);
+
+    outBuf.clear();
+    outBuf.swap(rows);
+  }
+  wake.notify_one();
+
+  if (outBuf.size() > 0) {
+    conn->queueOutput(& outBuf[0], outBuf.size());
+    rowsSent += outBuf.size() / (sizeof(double) + numBins);
+  }
+};
+
+void Spectrogram::run() {
+  std::vector < float > taken;
+  for (;;) {
+    double ts;
+    bool gap;
+    {
+      boost::mutex::scoped_lock lock(mutex);
+
+      // hand over rows finished since we last had the lock
+      rows.insert(rows.end(), rowBuf.begin(), rowBuf.end());
+      rowBuf.clear();
+
+      while (! quitting && pending.size() == 0)
+        wake.wait(lock);
+      if (quitting)
+        return;
+      taken.clear();
+      taken.swap(pending);
+      ts = pendingTimestamp;
+      gap = pendingGap;
+      pendingGap = false;
+    }
+
+    if (gap) {
+      // the partial row is not continuous with what follows
+      timebuf.clear();
+      power.assign(numBins, 0);
+      numInRow = 0;
+      rowFrames = 0;
+    }
+    if (timebuf.size() == 0)
+      timebufTimestamp = ts;
+    timebuf.insert(timebuf.end(), taken.begin(), taken.end());
+    transformSome();
+  }
+};
+
+void Spectrogram::transformSome() {
+  size_t start = 0;
+  while (timebuf.size() - start >= (size_t) fftSize) {
+    if (numInRow == 0)
+      rowTimestamp = timebufTimestamp + (double) start / rate;
+
+    const float * x = & timebuf[start];
+    for (int i = 0; i < fftSize; ++i)
+      fftIn[i] = x[i] * window[i];
+    fftwf_execute_dft_r2c(plan, fftIn, fftOut);
+    for (int b = 0; b < numBins; ++b)
+      power[b] += fftOut[b][0] * fftOut[b][0] + fftOut[b][1] * fftOut[b][1];
+    ++numInRow;
+
+    start += hop;
+    rowFrames += hop;
+    if (rowFrames >= framesPerRow) {
+      finishRow();
+      rowFrames -= framesPerRow;
+    }
+  }
+  timebuf.erase(timebuf.begin(), timebuf.begin() + start);
+  timebufTimestamp += (double) start / rate;
+};
+
+void Spectrogram::finishRow() {
+  size_t at = rowBuf.size();
+  rowBuf.resize(at + sizeof(double) + numBins);
+  memcpy(& rowBuf[at], & rowTimestamp, sizeof(double));
+  unsigned char * q = (unsigned char *) & rowBuf[at + sizeof(double)];
+
+  double k = powerScale / numInRow;
+  float qscale = 255 / dbRange;
+  for (int b = 0; b < numBins; ++b) {
+    float v = (10 * log10(power[b] * k + 1e-30) - dbFloor) * qscale;
+    q[b] = v <= 0 ? 0 : v >= 255 ? 255 : (unsigned char) (v + 0.5);
+  }
+  power.assign(numBins, 0);
+  numInRow = 0;
+};
+
+string Spectrogram::header() {
+  ostringstream s;
+  s << "{\"spectrogram\":{"
+    << "\"label\":\"" << label << "\","
+    << "\"devLabel\":\"" << devLabel << "\","
+    << "\"channel\":" << channel << ","
+    << "\"rate\":" << rate << ","
+    << "\"fftSize\":" << fftSize << ","
+    << "\"bins\":" << numBins << ","
+    << "\"binHz\":" << (double) rate / fftSize << ","
+    << "\"rowsPerSecond\":" << rowsPerSecond << ","
+    << "\"dbFloor\":" << dbFloor << ","
+    << "\"dbRange\":" << dbRange << ","
+    << "\"rowBytes\":" << sizeof(double) + numBins
+    << "}}\n";
+  return s.str();
+};
+
+string Spectrogram::toJSON() {
+  long long dropped;
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    dropped = framesDropped;
+  }
+  ostringstream s;
+  s << "{"
+    << "\"type\":\"Spectrogram\","
+    << "\"devLabel\":\"" << devLabel << "\","
+    << "\"connLabel\":\"" << connLabel << "\","
+    << "\"channel\":" << channel << ","
+    << "\"fftSize\":" << fftSize << ","
+    << "\"rowsPerSecond\":" << rowsPerSecond << ","
+    << "\"dbFloor\":" << dbFloor << ","
+    << "\"dbRange\":" << dbRange << ","
+    << "\"rowsSent\":" << rowsSent << ","
+    << "\"framesDropped\":" << dropped
+    << "}";
+  return s.str();
+};
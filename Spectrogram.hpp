@@ -0,0 +1,114 @@
+#ifndef SPECTROGRAM_HPP
+#define SPECTROGRAM_HPP
+
+/*
+  Spectrogram (waterfall) summary of one device channel, for remote
+  monitoring.
+
+  Rather than send full-rate raw audio to a client which only wants to
+  draw a waterfall, a Spectrogram computes averaged power spectra and
+  sends each one as a compact row: an 8-byte timestamp (double, host
+  byte order, of the first frame in the row) followed by one byte per
+  frequency bin, being the power in dB relative to a full-scale sine,
+  mapped linearly from [dbFloor, dbFloor + dbRange] to [0, 255].  Bins
+  run from 0 Hz up to, but not including, the Nyquist frequency, in
+  steps of rate / fftSize.
+
+  Each row averages the power spectra of Hann-windowed transforms of
+  fftSize frames, overlapped by half, over 1 / rowsPerSecond seconds of
+  data (or a single transform, if rows are closer together than half
+  an fftSize).
+
+  Like a plugin, a Spectrogram is attached to a device, which gives it
+  each batch of (float) samples.  The transforms are done on a worker
+  thread, so that a large fftSize doesn't delay the device's other
+  consumers; samples are handed to the worker, and finished rows
+  collected from it, under a mutex.  If the worker falls more than
+  MAX_BACKLOG_SECONDS behind, the backlog is discarded.
+*/
+
+#include <string>
+#include <vector>
+#include <fftw3.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "Pollable.hpp"
+
+class Spectrogram : public Pollable {
+
+public:
+
+  static const int MIN_FFT_SIZE = 16;
+  static const int MAX_FFT_SIZE = 65536;
+  static const int MAX_ROWS_PER_SECOND = 100;
+  static const int MAX_BACKLOG_SECONDS = 5;     // samples waiting for the worker beyond this are discarded
+
+  string             devLabel;         // label of device from which we receive input
+
+protected:
+  string             connLabel;        // label of connection receiving our rows
+  PollableHandle     connHandle;       // handle of that connection, to notice when it closes
+  Pollable *         conn;             // the connection
+  int                rate;             // frames per second
+  int                channel;          // device channel summarized
+  float              scale;            // scale factor from device units to [-1, 1]
+  int                fftSize;          // frames per transform
+  int                numBins;          // bytes per row, after the timestamp
+  double             rowsPerSecond;    // rows sent per second of data
+  float              dbFloor;          // power (dB re full-scale sine) mapped to 0
+  float              dbRange;          // power range mapped to 0..255
+
+  // shared with the worker thread, and guarded by mutex
+
+  boost::mutex       mutex;
+  boost::condition_variable wake;      // signalled when there are samples, or we're quitting
+  std::vector < float > pending;       // samples not yet taken by the worker
+  double             pendingTimestamp; // timestamp of first sample in pending
+  bool               pendingGap;       // samples were discarded before pending; worker must restart rows
+  std::vector < char > rows;           // finished rows not yet queued to the connection
+  bool               quitting;         // tells the worker to finish
+  long long          framesDropped;    // frames discarded because the worker was behind
+
+  // used only by the worker thread
+
+  std::vector < float > timebuf;       // samples not yet transformed
+  double             timebufTimestamp; // timestamp of timebuf[0]
+  int                hop;              // frames between consecutive transforms
+  double             framesPerRow;     // frames of data summarized by each row
+  double             rowFrames;        // frames of data in the current row so far
+  double             rowTimestamp;     // timestamp of first frame in current row
+  int                numInRow;         // transforms summed into power
+  std::vector < double > power;        // summed power spectra for current row
+  std::vector < float > window;        // Hann window
+  double             powerScale;       // scales |X|^2 so that a full-scale sine has power 1
+  float *            fftIn;            // windowed block
+  fftwf_complex *    fftOut;           // its transform
+  fftwf_plan         plan;             // owned by FFTPlanCache
+  std::vector < char > rowBuf;         // rows made since last handing them over
+
+  std::vector < char > outBuf;         // rows being queued to the connection; storage is reused
+  long long          rowsSent;         // rows queued to the connection
+  boost::thread *    worker;
+
+public:
+
+  Spectrogram(const string &label, const string &devLabel, const string &connLabel, int rate, int channel, unsigned int maxSampleAbs,
+              int fftSize, double rowsPerSecond, float dbFloor, float dbRange); // settings must have passed checkSettings()
+  ~Spectrogram();
+
+  static void checkSettings(int fftSize, double rowsPerSecond, float dbRange); // throws std::runtime_error if invalid
+
+  void handleData(long avail, float *src, int numDevChan, double frameTimestamp); // src holds avail frames of numDevChan interleaved channels
+  string header(); // JSON line describing the rows which follow
+  string toJSON();
+  bool connectionClosed() {return ! Pollable::isLive(connHandle);};
+
+protected:
+  void run(); // worker thread
+  void transformSome(); // transform whatever timebuf allows, appending rows to rowBuf
+  void finishRow();
+};
+
+#endif // SPECTROGRAM_HPP
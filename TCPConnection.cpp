@@ -1,5 +1,20 @@
 #include "TCPConnection.hpp"
 #include <iomanip>
+#include <sys/uio.h>
+#include <algorithm>
+
+// does line start a batch block which continues on following lines?
+static bool startsBatch(const string &line) {
+  size_t i = line.find_first_not_of(" \t");
+  return i != string::npos && line.compare(i, 5, "batch") == 0
+    && line.find('{') != string::npos && line.find('}') == string::npos;
+};
+
+// does line end a batch block?
+static bool endsBatch(const string &line) {
+  size_t i = line.find_first_not_of(" \t\r");
+  return i != string::npos && line[i] == '}';
+};
 
 string TCPConnection::toJSON() {
   ostringstream s;
@@ -14,6 +29,12 @@ string TCPConnection::toJSON() {
 TCPConnection::TCPConnection (int fd, string label, CommandHandler handler, bool quiet, double timeNow) :
   Pollable(label),
   handler(handler),
+  readBuf(CMD_READ_BYTES),
+  inBatch(false),
+  batchOverflowed(false),
+  lineTooLong(false),
+  chunkOffset(0),
+  chunkBytes(0),
   timeConnected(timeNow)
 {
   static string msg ( "{"
@@ -59,8 +80,9 @@ void TCPConnection::handleEvents (struct pollfd *pollfds, bool timedOut, double
   }
 
   if (pollfds->revents & (POLLIN | POLLRDHUP)) {
-    // handle read
-    int len = read(pollfd.fd, cmdString, VampAlsaHost::MAX_CMD_STRING_LENGTH);
+    // handle read; take as much as is waiting, so that a burst of
+    // commands is handled in one wakeup
+    int len = read(pollfd.fd, & readBuf[0], CMD_READ_BYTES);
     if (len <= 0) {
       // socket has been closed, apparently.
 
@@ -75,31 +97,160 @@ void TCPConnection::handleEvents (struct pollfd *pollfds, bool timedOut, double
       requestPollFDRegen();
       return;
     }
-    cmdString[len] = '\0';
-    inputBuff += string(cmdString); // might be as long as 2 * MAX_CMD_STRING_LENGTH
-    // handle as many '\n'-terminated command lines as we can find
-    for (;;) {
+    inputBuff.append(& readBuf[0], len);
+
+    // handle as many '\n'-terminated command lines as we can find,
+    // collecting the replies so they go out in a single write.  Lines
+    // of a multi-line batch { ... } block are gathered and passed to
+    // the handler together once the closing '}' arrives.  A line or
+    // batch longer than MAX_BATCH_LENGTH is discarded whole, so that
+    // none of its commands run.
+
+    string replies;
+    size_t start = 0;
+    if (lineTooLong) {
+      // still discarding the rest of an overlong line
       size_t pos = inputBuff.find('\n');
       if (pos == inputBuff.npos) {
-        // none found; prevent input buffer from growing too big
-        if (inputBuff.npos > VampAlsaHost::MAX_CMD_STRING_LENGTH)
-          inputBuff.erase(0, inputBuff.npos - VampAlsaHost::MAX_CMD_STRING_LENGTH);
-        return;
+        start = inputBuff.length();
+      } else {
+        start = pos + 1;
+        lineTooLong = false;
       }
+    }
+    try {
+      for (;;) {
+        size_t pos = inputBuff.find('\n', start);
+        if (pos == inputBuff.npos)
+          break;
+        string cmd(inputBuff, start, pos - start);
+        start = pos + 1;
+        if (cmd.length() > (unsigned) MAX_BATCH_LENGTH) {
+          if (inBatch)
+            batchOverflowed = true; // reported at the closing '}'
+          else
+            replies += "{\"error\": \"Error: command line too long\"}\n";
+        } else if (inBatch) {
+          if (! batchOverflowed) {
+            batchBuff += cmd;
+            batchBuff += '\n';
+            if (batchBuff.length() > (unsigned) MAX_BATCH_LENGTH) {
+              batchOverflowed = true;
+              batchBuff.clear();
+            }
+          }
+          if (endsBatch(cmd)) {
+            inBatch = false;
+            if (batchOverflowed) {
+              batchOverflowed = false;
+              replies += "{\"error\": \"Error: batch too long; no commands were run\"}\n";
+            } else {
+              replies += (*handler)(batchBuff, label);
+            }
+            batchBuff.clear();
+          }
+        } else if (startsBatch(cmd)) {
+          inBatch = true;
+          batchBuff = cmd + '\n';
+        } else {
+          replies += (*handler)(cmd, label); // call the command handler
+        }
+      }
+    } catch (std::runtime_error e) {
+      // e.g. quit; send what we have
+      queueOutput(replies);
+      throw;
+    }
 
-      // grab the full command
-      string cmd(inputBuff.substr(0, pos));
-      // drop it from the input buffer; note that since the newline is in the
-      // last MAX_CMD_STRING_LENGTH characters of inputBuff, removing the command
-      // will keep that buffer's length <= MAX_CMD_STRING_LENGTH
-      inputBuff.erase(0, pos + 1);
-      string rv = (*handler)(cmd, label);
-      queueOutput(rv); // call the command handler
+    // drop handled commands from the input buffer; a partial line which
+    // is already too long is dropped, along with the rest of it as it
+    // arrives
+    inputBuff.erase(0, start);
+    if (inputBuff.length() > (unsigned) MAX_BATCH_LENGTH) {
+      inputBuff.clear();
+      lineTooLong = true;
+      if (inBatch)
+        batchOverflowed = true; // reported at the closing '}'
+      else
+        replies += "{\"error\": \"Error: command line too long\"}\n";
     }
+
+    if (replies.length() > 0)
+      queueOutput(replies);
   }
 
   if (pollfds->revents & (POLLOUT)) {
-    writeSomeOutput(outputBuffer.size());
+    // a partly written chunk is finished first, so that text never lands
+    // in the middle of a sample frame; otherwise anything in outputBuffer
+    // (replies, or a WAV header) goes before further raw chunks.
+    // writeSomeOutput() stops POLLOUT once both are empty
+    if (chunkOffset > 0)
+      writeChunks(1);
+    else if (outputBuffer.size() > 0 || chunks.size() == 0)
+      writeSomeOutput(outputBuffer.size());
+    else
+      writeChunks(MAX_CHUNKS_PER_WRITE);
+  }
+};
+
+int TCPConnection::flushOutput() {
+  // as for POLLOUT: finish any partly written chunk before sending text
+  if (chunkOffset > 0 && ! outputPaused)
+    writeChunks(1);
+  if (chunkOffset > 0)
+    return 0; // socket is full; poll() will finish the chunk, then the text
+  return Pollable::flushOutput();
+};
+
+bool TCPConnection::queueChunk(const RawChunkPtr &chunk) {
+  if (chunk->data.size() == 0)
+    return true;
+  chunks.push_back(chunk);
+  chunkBytes += chunk->data.size();
+
+  // as with outputBuffer, drop the oldest data if the reader falls too
+  // far behind; but drop whole chunks, and neither one we've started
+  // writing nor the one just queued
+
+  size_t oldest = chunkOffset > 0 ? 1 : 0; // oldest unstarted chunk
+  while (chunkBytes > outputBuffer.capacity() && chunks.size() > oldest + 1) {
+    chunkBytes -= chunks[oldest]->data.size();
+    chunks.erase(chunks.begin() + oldest);
+  }
+
+  pollfd.events |= POLLOUT;
+  if (indexInPollFD >= 0)
+    eventsOf(0) = pollfd.events;
+  return true;
+};
+
+void TCPConnection::writeChunks(int maxChunks) {
+  // write up to maxChunks queued chunks, or as many as the socket will
+  // take, with one writev()
+
+  struct iovec iov[MAX_CHUNKS_PER_WRITE];
+  int n = 0;
+  maxChunks = std::min(maxChunks, (int) MAX_CHUNKS_PER_WRITE);
+  for (std::deque < RawChunkPtr >::iterator ic = chunks.begin(); ic != chunks.end() && n < maxChunks; ++ic, ++n) {
+    size_t skip = n == 0 ? chunkOffset : 0;
+    iov[n].iov_base = (void *) (& (*ic)->data[skip]);
+    iov[n].iov_len = (*ic)->data.size() - skip;
+  }
+  ssize_t nb = writev(pollfd.fd, iov, n);
+  if (nb <= 0)
+    return; // errors are reported by poll()
+
+  while (nb > 0) {
+    size_t left = chunks.front()->data.size() - chunkOffset;
+    if ((size_t) nb >= left) {
+      nb -= left;
+      chunkBytes -= chunks.front()->data.size();
+      chunks.pop_front();
+      chunkOffset = 0;
+    } else {
+      chunkOffset += nb;
+      nb = 0;
+    }
   }
 };
 
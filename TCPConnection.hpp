@@ -3,6 +3,8 @@
 
 #include <string>
 #include <sstream>
+#include <vector>
+#include <deque>
 #include <boost/circular_buffer.hpp>
 
 using std::string;
@@ -37,14 +39,33 @@ public:
 
   void setRawOutput(bool yesno);
 
+  bool queueChunk(const RawChunkPtr &chunk); // keep a reference to chunk, rather than copying it
+
+  int flushOutput(); // as Pollable::flushOutput, but never splits a partly written chunk
+
+  bool wantsLowLatency() {return true;}; // interactive consumers, e.g. live audio in the web interface
+
   static const int RAW_OUTPUT_BUFFER_SIZE = 524288;    // size of buffer for receiving commands over TCP
+  static const int CMD_READ_BYTES = 65536;             // maximum bytes read from the socket per wakeup
+  static const int MAX_BATCH_LENGTH = 65536;           // maximum length of a batch { ... } block, or of any one line
+  static const int MAX_CHUNKS_PER_WRITE = 64;          // maximum number of raw chunks passed to one writev()
 
 protected:
   CommandHandler handler;
 
 
-  char cmdString[VampAlsaHost::MAX_CMD_STRING_LENGTH + 1];    // buffer for input from TCP
+  std::vector < char > readBuf; // buffer for input from TCP
   string inputBuff;   // input from TCP socket which has not been processed yet
+  string batchBuff;   // lines of a batch { ... } block whose closing '}' hasn't arrived yet
+  bool inBatch;       // true while collecting a batch block
+  bool batchOverflowed; // true if the batch block being collected grew too long; it is discarded at its closing '}'
+  bool lineTooLong;   // true while discarding the rest of a line which grew too long
+
+  std::deque < RawChunkPtr > chunks; // raw output not yet written, shared with other listeners on the device
+  size_t chunkOffset; // bytes of the first chunk already written
+  size_t chunkBytes;  // total size of chunks
+
+  void writeChunks(int maxChunks); // write up to maxChunks chunks from the front of the queue
 
   weak_ptr < Pollable > outputListener;
   double timeConnected;
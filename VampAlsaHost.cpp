@@ -6,8 +6,13 @@
 #include "VampAlsaHost.hpp"
 #include "Pollable.hpp"
 #include "DevMinder.hpp"
+#include "AlsaMinder.hpp"
 #include "PluginRunner.hpp"
 #include "WavFileWriter.hpp"
+#include "Spectrogram.hpp"
+#include "DeviceGroup.hpp"
+#include "CrossCorrelator.hpp"
+#include "Config.hpp"
 #include <time.h>
 
 VampAlsaHost::VampAlsaHost()
@@ -49,6 +54,31 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
     } else {
       reply << "{\"error\": \"Error: '" << label << "' does not specify a known open device\"}\n";
     }
+  } else if (word == "stats") {
+    string label;
+    double window = 0, noiseWindow = 0;
+    cmd >> label;
+    try {
+      DevMinder *dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(label));
+      if (!dev)
+        throw std::runtime_error(string("There is no device with label '") + label + "'");
+      // optional windows, then optional "reset"
+      string opt;
+      if (cmd >> window) {
+        if (! (cmd >> noiseWindow)) {
+          noiseWindow = DevMinder::DEFAULT_NOISE_WINDOW;
+          cmd.clear();
+        }
+        dev->setStatsWindows(window, noiseWindow);
+      } else {
+        cmd.clear();
+      }
+      if (cmd >> opt && opt == "reset")
+        dev->resetStats();
+      reply << dev->toJSON() << '\n';
+    } catch (std::runtime_error e) {
+      reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
+    };
   } else if (word == "list") {
     reply << "{";
     int i = Pollable::pollables.size();
@@ -104,7 +134,7 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
             if (wav) {
               wav->resumeWithNewFile(path_template);
             } else {
-              new WavFileWriter (label, wavLabel, path_template, frames, rate, p->numChan);
+              new WavFileWriter (label, wavLabel, path_template, frames, rate, p->numChan, p->sampleFormat);
               p->addRawListener(wavLabel, round(p->hwRate / rate));
             }
           }
@@ -117,6 +147,53 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
     } else {
       reply << "{\"error\": \"Error: LABEL does not specify a known open device\"}\n";
     }
+  } else if (word == "spectrogram") {
+    string devLabel, channels;
+    int fftSize = 0;
+    double rowsPerSecond = 0;
+    float dbFloor = -120, dbRange = 120;
+    cmd >> devLabel >> fftSize >> rowsPerSecond;
+    // optional dB scale
+    if (cmd >> dbFloor)
+      cmd >> dbRange;
+    size_t sep = devLabel.find(':');
+    if (sep != string::npos) {
+      channels = devLabel.substr(sep + 1);
+      devLabel = devLabel.substr(0, sep);
+    }
+    try {
+      DevMinder *dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(devLabel));
+      if (!dev)
+        throw std::runtime_error(string("There is no device with label '") + devLabel + "'");
+      int channel = 0;
+      if (channels.length() > 0) {
+        istringstream chan(channels);
+        if (! (chan >> channel) || channel < 0 || channel >= (int) dev->numChan)
+          throw std::runtime_error(string("Invalid channel '") + channels + "' for device '" + devLabel + "'");
+      }
+      Spectrogram::checkSettings(fftSize, rowsPerSecond, dbRange);
+      string spLabel = devLabel + "_Spectrogram_" + connLabel;
+      if (Pollable::lookupByName(spLabel))
+        throw std::runtime_error(string("This connection already has a spectrogram of device '") + devLabel + "'");
+      Spectrogram * sp = new Spectrogram(spLabel, devLabel, connLabel, dev->rate, channel, dev->maxSampleAbs, fftSize, rowsPerSecond, dbFloor, dbRange);
+      dev->addSpectrogram(spLabel, sp);
+      reply << sp->header();
+    } catch (std::runtime_error e) {
+      reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
+    };
+  } else if (word == "spectrogramOff") {
+    string devLabel;
+    cmd >> devLabel;
+    string spLabel = devLabel + "_Spectrogram_" + connLabel;
+    if (Pollable::lookupByName(spLabel)) {
+      DevMinder *dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(devLabel));
+      if (dev)
+        dev->removeSpectrogram(spLabel);
+      Pollable::remove(spLabel);
+      reply << "{}\n";
+    } else {
+      reply << "{\"error\": \"Error: This connection has no spectrogram of device '" << devLabel << "'\"}\n";
+    }
   } else if (word == "fmOn" || word == "fmOff") {
     string label;
     cmd >> label;
@@ -126,12 +203,81 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
     } else {
       reply << "{\"error\": \"Error: LABEL does not specify a known open device\"}\n";
     }
+  } else if (word == "xcorr") {
+    string devLabel, label, channels;
+    int blockFrames = 0, maxLag = 0;
+    cmd >> devLabel >> label >> blockFrames >> maxLag;
+    // DEV_LABEL can have a suffix selecting the two channels, e.g. 3:0,2
+    size_t sep = devLabel.find(':');
+    if (sep != string::npos) {
+      channels = devLabel.substr(sep + 1);
+      devLabel = devLabel.substr(0, sep);
+    }
+    try {
+      DevMinder *dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(devLabel));
+      if (!dev)
+        throw std::runtime_error(string("There is no device with label '") + devLabel + "'");
+      if (Pollable::lookupByName(label))
+        throw std::runtime_error(string("There is already a device or plugin with label '") + label + "'");
+      int chanA = 0, chanB = 1;
+      char comma = 0;
+      if (channels.length() > 0) {
+        istringstream chans(channels);
+        if (! (chans >> chanA >> comma >> chanB) || comma != ',')
+          throw std::runtime_error(string("Invalid channel pair '") + channels + "'; must be CHANNEL,CHANNEL");
+      }
+      if (chanA < 0 || chanB < 0 || chanA >= (int) dev->numChan || chanB >= (int) dev->numChan || chanA == chanB)
+        throw std::runtime_error(string("Device '") + devLabel + "' does not have two distinct channels " + (channels.length() ? channels : "0,1"));
+      CrossCorrelator::checkSettings(blockFrames, maxLag);
+      CrossCorrelator * xc = new CrossCorrelator(label, devLabel, dev->rate, chanA, chanB, dev->maxSampleAbs, blockFrames, maxLag);
+      dev->addCorrelator(label, xc);
+      if (! xc->addOutputListener(defaultOutputListener))
+        defaultOutputListener = "";
+      reply << xc->toJSON() << '\n';
+    } catch (std::runtime_error e) {
+      reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
+    };
+  } else if (word == "group") {
+    string groupLabel, devLabel;
+    std::vector < string > devLabels;
+    cmd >> groupLabel;
+    while (cmd >> devLabel)
+      devLabels.push_back(devLabel);
+    try {
+      DeviceGroup * group = DeviceGroup::newDeviceGroup(groupLabel, devLabels);
+      reply << group->toJSON() << '\n';
+    } catch (std::runtime_error e) {
+      reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
+    };
+  } else if (word == "groupOff") {
+    string groupLabel;
+    cmd >> groupLabel;
+    DeviceGroup * group = dynamic_cast < DeviceGroup * > (Pollable::lookupByName(groupLabel));
+    if (group) {
+      reply << group->toJSON() << '\n';
+      Pollable::remove(groupLabel);
+    } else {
+      reply << "{\"error\": \"Error: '" << groupLabel << "' is not a device group\"}\n";
+    }
   } else if (word == "open" ) {
-    string label, alsaDev;
-    int rate, numChan;
+    string label, alsaDev, period, format;
+    int rate, numChan, periodFrames = 0, bufferFrames = 0;
+    bool adaptivePeriod = false;
     cmd >> label >> alsaDev >> rate >> numChan;
+    // optional period and buffer sizes, and sample format
+    if (cmd >> period) {
+      if (period == "auto") {
+        adaptivePeriod = true;
+      } else if (period == "lowlatency") {
+        adaptivePeriod = true;
+        periodFrames = AlsaMinder::LOW_LATENCY_PERIOD_FRAMES;
+      } else
+        periodFrames = atoi(period.c_str());
+      cmd >> bufferFrames >> format;
+    }
     try {
-      DevMinder * ptr = DevMinder::getDevMinder(alsaDev, rate, numChan, label, realTimeNow);
+      SampleFormat::Code sampleFormat = format.length() > 0 ? SampleFormat::fromName(format) : SampleFormat::AUTO;
+      DevMinder * ptr = DevMinder::getDevMinder(alsaDev, rate, numChan, label, realTimeNow, periodFrames, bufferFrames, adaptivePeriod, sampleFormat);
       reply << ptr->toJSON() << '\n';
     } catch (std::runtime_error e) {
       reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
@@ -159,15 +305,51 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
         break;
       ps[par] = val;
     }
+    // DEV_LABEL can have a suffix selecting device channels for the plugin, e.g. 3:0,2
+    string channels;
+    size_t sep = devLabel.find(':');
+    if (sep != string::npos) {
+      channels = devLabel.substr(sep + 1);
+      devLabel = devLabel.substr(0, sep);
+    }
     try {
+      // DEV_LABEL can also be a device group, which takes a single plugin
       DevMinder *dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(devLabel));
-      if (!dev)
+      DeviceGroup *group = dev ? 0 : dynamic_cast < DeviceGroup * > (Pollable::lookupByName(devLabel));
+      if (!dev && !group)
         throw std::runtime_error(string("There is no device with label '") + devLabel + "'");
+      if (group && group->hasPlugin())
+        throw std::runtime_error(string("Group '") + devLabel + "' already has a plugin");
       if (Pollable::lookupByName(pluginLabel))
         throw std::runtime_error(string("There is already a device or plugin with label '") + pluginLabel + "'");
-      new PluginRunner(pluginLabel, devLabel, dev->rate, dev->numChan, dev->maxSampleAbs, pluginLib, pluginName, outputName, ps);
+      unsigned int numChan = dev ? dev->numChan : group->numChan;
+      std::vector < int > channelMap;
+      if (channels.length() > 0) {
+        // a comma-separated list of channel numbers, with nothing else
+        istringstream chans(channels);
+        int ch;
+        char comma;
+        for (;;) {
+          if (! (chans >> std::noskipws >> ch) || ch < 0 || ch >= (int) numChan)
+            throw std::runtime_error(string("Invalid channel list '") + channels + "' for device '" + devLabel + "'");
+          channelMap.push_back(ch);
+          if (! chans.get(comma))
+            break;
+          if (comma != ',')
+            throw std::runtime_error(string("Invalid channel list '") + channels + "' for device '" + devLabel + "'");
+        }
+        if (channelMap.size() > (unsigned) PluginRunner::MAX_NUM_CHAN)
+          throw std::runtime_error(string("Invalid channel list '") + channels + "' for device '" + devLabel + "'");
+      } else {
+        for (unsigned c = 0; c < numChan; ++c)
+          channelMap.push_back(c);
+      }
+      new PluginRunner(pluginLabel, devLabel, dev ? dev->rate : group->rate, channelMap, dev ? dev->maxSampleAbs : group->maxSampleAbs, pluginLib, pluginName, outputName, ps);
       shared_ptr < PluginRunner > plugin = static_pointer_cast < PluginRunner > (Pollable::lookupByNameShared(pluginLabel));
-      dev->addPluginRunner(pluginLabel, plugin);
+      if (dev)
+        dev->addPluginRunner(pluginLabel, plugin);
+      else
+        group->addPluginRunner(pluginLabel, plugin);
       if (! plugin->addOutputListener(defaultOutputListener))
         // the default output listener doesn't seem to exist any longer
         // so reset its name in case a subsequent connection has the same label
@@ -233,6 +415,8 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
       PluginRunner * ptr = p.get();
       if (ptr)
         ptr->addOutputListener(connLabel);
+      else if (CrossCorrelator * xc = dynamic_cast < CrossCorrelator * > (ip->second.get()))
+        xc->addOutputListener(connLabel);
     } catch (std::runtime_error e) {
       reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
     };
@@ -242,8 +426,86 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
       PluginRunner * ptr = p.get();
       if (ptr)
         ptr->addOutputListener(connLabel);
+      else if (CrossCorrelator * xc = dynamic_cast < CrossCorrelator * > (ip->second.get()))
+        xc->addOutputListener(connLabel);
       defaultOutputListener = connLabel;
     }
+  } else if (word == "lowLatency") {
+    string pluginLabel, onOff;
+    cmd >> pluginLabel >> onOff;
+    try {
+      PollableSet::iterator ip = Pollable::pollables.find(pluginLabel);
+      if (ip == Pollable::pollables.end())
+        throw std::runtime_error(string("There is no attached plugin with label '") + pluginLabel + "'");
+      shared_ptr < PluginRunner > p = boost::dynamic_pointer_cast < PluginRunner > (ip->second);
+      PluginRunner * ptr = p.get();
+      if (! ptr)
+        throw std::runtime_error(string("'") + pluginLabel + "' is not an attached plugin");
+      ptr->setLowLatency(onOff != "off");
+      Pollable * dev = Pollable::lookupByName(ptr->devLabel);
+      if (DevMinder * dm = dynamic_cast < DevMinder * > (dev))
+        dm->consumersChanged();
+      else if (DeviceGroup * dg = dynamic_cast < DeviceGroup * > (dev))
+        dg->consumersChanged();
+      reply << ptr->toJSON() << '\n';
+    } catch (std::runtime_error e) {
+      reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
+    };
+  } else if (word == "schedule") {
+    string pluginLabel, spec;
+    cmd >> pluginLabel >> std::ws;
+    getline(cmd, spec);
+    try {
+      PollableSet::iterator ip = Pollable::pollables.find(pluginLabel);
+      if (ip == Pollable::pollables.end())
+        throw std::runtime_error(string("There is no attached plugin with label '") + pluginLabel + "'");
+      shared_ptr < PluginRunner > p = boost::dynamic_pointer_cast < PluginRunner > (ip->second);
+      PluginRunner * ptr = p.get();
+      if (! ptr)
+        throw std::runtime_error(string("'") + pluginLabel + "' is not an attached plugin");
+      ptr->setSchedule(spec);
+      reply << ptr->toJSON() << '\n';
+    } catch (std::runtime_error e) {
+      reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
+    };
+  } else if (word == "preload") {
+    string spec;
+    cmd >> spec;
+    try {
+      if (spec == "")
+        throw std::runtime_error("preload: must specify PLUGIN_SONAME[:PLUGIN_ID]");
+      string soname = spec, id;
+      size_t colon = spec.find(':');
+      if (colon != string::npos) {
+        soname = spec.substr(0, colon);
+        id = spec.substr(colon + 1);
+      }
+      std::vector < string > keys;
+      if (! PluginCache::preload(soname, id, keys))
+        throw std::runtime_error(string("No plugins could be loaded for '") + spec + "'");
+      reply << "{\"preloaded\":[";
+      for (size_t i = 0; i < keys.size(); ++i)
+        reply << (i ? "," : "") << "\"" << keys[i] << "\"";
+      reply << "]}\n";
+    } catch (std::runtime_error e) {
+      reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
+    };
+  } else if (word == "batch") {
+    string body;
+    getline(cmd, body, '\0');
+    reply << runBatch(body, connLabel);
+  } else if (word == "snapshot") {
+    string filename;
+    if (! (cmd >> filename))
+      filename = Config::snapshotFile;
+    try {
+      if (filename.length() == 0)
+        throw std::runtime_error("no snapshot file given, and no default was set with the -r option");
+      int n = Config::save(filename);
+      reply << "{\"snapshot\":\"" << filename << "\",\"objects\":" << n << "}\n";
+    } catch (std::runtime_error e) {
+      reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
+    };
   } else if (word == "quit" ) {
     reply << "{\"message\": \"Terminating server.\"}\n";
     throw std::runtime_error("Quit by client.\n");
@@ -256,12 +518,55 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
 };
 
 
+string VampAlsaHost::runBatch(string body, string connLabel) {
+  // body is everything after the word "batch": '{', then commands
+  // separated by newlines or ';', then '}'.  Commands are run in order,
+  // stopping at the first one which replies with an error.  Commands
+  // already run are not undone.  Any pollfd changes are picked up once,
+  // on the next call to Pollable::poll().
+
+  size_t open = body.find('{');
+  size_t close = body.rfind('}');
+  if (open == string::npos || close == string::npos || close < open)
+    return "{\"error\": \"Error: batch must be of the form batch { COMMAND; COMMAND; ... }\"}\n";
+
+  string replies;
+  int numCommands = 0, numDone = 0;
+  bool failed = false;
+  size_t start = open + 1;
+  while (start < close) {
+    size_t end = body.find_first_of(";\n", start);
+    if (end == string::npos || end > close)
+      end = close;
+    string cmd = body.substr(start, end - start);
+    start = end + 1;
+    if (cmd.find_first_not_of(" \t\r") == string::npos)
+      continue;
+    ++numCommands;
+    if (failed)
+      continue;
+    string rv = runCommand(cmd, connLabel);
+    replies += rv;
+    if (rv.compare(0, 8, "{\"error\"") == 0)
+      failed = true;
+    else
+      ++numDone;
+  }
+  ostringstream summary;
+  summary << "{\"batch\":{\"commands\":" << numCommands << ",\"done\":" << numDone
+          << ",\"error\":" << (failed ? "true" : "false") << "}}\n";
+  return replies + summary.str();
+};
+
 int VampAlsaHost::run()
 {
   int rv;
   do {
     rv = Pollable::poll(2000); // 2 second timeout
-  } while (! rv);
+    if (rv == EINTR)
+      rv = 0; // a signal; stopSignal says whether to quit
+    DevMinder::resumeIdleDevices(now());
+  } while (! rv && ! stopSignal);
   return rv;
 }
 
@@ -274,7 +579,7 @@ VampAlsaHost::now(bool is_monotonic) {
 
 const string
 VampAlsaHost::commandHelp =
-          "       open DEV_LABEL AUDIO_DEV RATE NUM_CHANNELS\n"
+          "       open DEV_LABEL AUDIO_DEV RATE NUM_CHANNELS [PERIOD_FRAMES [BUFFER_FRAMES [FORMAT]]]\n"
           "          Opens an audio device so that plugins can be attached to it.\n"
           "          To start processing, you must attach a plugin and start the device\n"
           "          using the 'start DEV_LABEL' command - see below\n\n"
@@ -284,14 +589,34 @@ VampAlsaHost::commandHelp =
           "             or a plugin instance (see below).\n"
           "          AUDIO_DEV: the ALSA name of the audio device (e.g. 'default:CARD=V10')\n"
           "          RATE: the sampling rate to use for the device (e.g. 48000)\n"
-          "          NUM_CHANNELS: the number of channels to read from the device (usually 1 or 2)\n\n"
-          "          e.g. open 3 default:CARD=V10_2 48000 2\n\n"
-
-          "       attach DEV_LABEL PLUGIN_LABEL PLUGIN_SONAME PLUGIN_ID PLUGIN_OUTPUT [PAR VALUE]*\n"
+          "          NUM_CHANNELS: the number of channels to read from the device (1 to 16)\n"
+          "          PERIOD_FRAMES: (ALSA only) the period size, in frames; data are read once per period.\n"
+          "             If 0 or omitted, a default of 4800 is used.  If 'auto', a small period is used, but\n"
+          "             wakeups are batched into several periods unless a consumer needing low latency\n"
+          "             (e.g. a rawStream connection) is attached.  If 'lowlatency', as for 'auto' but with\n"
+          "             a period of 256 frames, for use with plugins in low-latency mode (see lowLatency).\n"
+          "          BUFFER_FRAMES: (ALSA only) the ring buffer size, in frames.  If 0 or omitted,\n"
+          "             a default of 131072 is used.\n"
+          "          FORMAT: (ALSA only) the sample format: one of S16_LE, S24_3LE, S32_LE, FLOAT_LE or auto.\n"
+          "             If 'auto' or omitted, S16_LE is used if the device supports it, otherwise the first\n"
+          "             of the others which it supports.  Raw data (rawStream, rawFile) are written in\n"
+          "             this format.  The .WAV header is the classic 44-byte one for S16_LE with one or two\n"
+          "             channels; otherwise it is 80 bytes, with a WAVE_FORMAT_EXTENSIBLE \"fmt \" chunk and a\n"
+          "             \"fact\" chunk.\n\n"
+          "          e.g. open 3 default:CARD=V10_2 48000 2\n"
+          "               open 4 default:CARD=V10_3 48000 2 auto\n"
+          "               open 5 hw:CARD=Array 48000 8 0 0 S24_3LE\n\n"
+
+          "       attach DEV_LABEL[:CHANNELS] PLUGIN_LABEL PLUGIN_SONAME PLUGIN_ID PLUGIN_OUTPUT [PAR VALUE]*\n"
           "          Load the specified plugin and attach it to the specified audio device.  Multiple plugins\n"
           "          can be attached to the same device.  All incoming data is sent to all attached\n"
           "          plugins, in the same order in which they were attached.\n"
-          "          DEV_LABEL: the label for the input device, which must already have been opened with open\n"
+          "          Frequency-domain plugins are given Hann-windowed FFTs of their input; plugins on the\n"
+          "          same device with the same block size, step size and channels share one FFT per block.\n"
+          "          DEV_LABEL: the label for the input device, which must already have been opened with open,\n"
+          "                     or of a device group (see group), which takes at most one plugin\n"
+          "          CHANNELS: an optional comma-separated list of device channels (numbered from 0) to\n"
+          "                    send to the plugin, in order.  By default, the plugin gets all channels.\n"
           "          PLUGIN_LABEL: the label for this plugin instance, for use in subsequent commands.\n"
           "          This label must not already be the label of a device or another plugin instance.\n"
           "          PLUGIN_SONAME: the name (without path) of the library containing the plugin\n"
@@ -301,13 +626,17 @@ VampAlsaHost::commandHelp =
           "          [PAR VALUE]: an optional set of plugin parameter settings, where:\n"
           "                       PAR: is the name of a plugin parameter\n"
           "                       VALUE: is the value to be assiged to the parameter\n\n"
-          "          e.g. attach 3 pulse3 lotek-plugins.so findpulsefdbatch pulses minsnr 6\n\n"
+          "          e.g. attach 3 pulse3 lotek-plugins.so findpulsefdbatch pulses minsnr 6\n"
+          "               attach 5:2,3 pulse5b lotek-plugins.so findpulsefdbatch pulses minsnr 6\n\n"
           "          Output from the plugin will be sent to any TCP connection\n"
           "          which has issued a corresponding 'receive' or 'receiveAll' command, or\n"
           "          discarded if no 'receive' connection exists.\n\n"
 
           "       param PLUGIN_LABEL [PAR VALUE]*\n"
           "          set the value(s) of specified parameter(s) of given attached plugin instance.\n"
+          "          A new instance of the plugin is initialised with the new values in the background, and\n"
+          "          replaces the running instance at the next block boundary after it is ready, so no data\n"
+          "          are lost.\n"
           "          PLUGIN_LABEL: label of an attached plugin instance.\n\n"
           "          PAR: the name of a plugin parameter\n"
           "          VALUE: the value to assign to the parameter\n\n"
@@ -317,14 +646,62 @@ VampAlsaHost::commandHelp =
           "          Stop sending data to the specified plugin instance, and delete it.  Any other\n"
           "          instances of the same plugin, and any other plugins attached to the same device\n"
           "          are not affected.\n"
-          "          PLUGIN_LABEL: the label of an attached plugin instance.\n\n"
+          "          PLUGIN_LABEL: the label of an attached plugin instance.\n"
+          "          This also deletes a cross-correlator (see xcorr).\n\n"
+
+          "       xcorr DEV_LABEL[:CHANNEL_A,CHANNEL_B] LABEL BLOCK_FRAMES MAX_LAG\n"
+          "          Cross-correlate two channels of a device (by default 0 and 1), for estimating the\n"
+          "          difference in arrival times at two antennas.  Like a plugin, the correlator is given\n"
+          "          each batch of data from the device, and its output goes to connections which issue\n"
+          "          receive LABEL or receiveAll.  For each block of BLOCK_FRAMES frames, a line\n"
+          "             LABEL,TIMESTAMP,LAG,STRENGTH\n"
+          "          is sent, where LAG is the lag in frames (to a fraction of a frame, and at most MAX_LAG\n"
+          "          either way) at which the correlation has the largest magnitude, positive if the signal\n"
+          "          reached CHANNEL_B after CHANNEL_A; STRENGTH is the correlation there, normalized to\n"
+          "          [-1, 1]; and TIMESTAMP is that of the first frame of the block.  Each line is\n"
+          "          delayed by MAX_LAG frames, since lags after the block are needed.  Correlation is\n"
+          "          done with FFTs of the smallest power of two at least BLOCK_FRAMES + 2 * MAX_LAG.\n"
+          "          e.g. xcorr 3:0,1 tdoa3 4096 64\n\n"
+
+          "       lowLatency PLUGIN_LABEL [on|off]\n"
+          "          Put an attached plugin instance into (or out of) low-latency mode.  In low-latency mode,\n"
+          "          a device opened with PERIOD_FRAMES 'auto' or 'lowlatency' wakes on every period rather\n"
+          "          than batching periods, and plugin output is written to receiving connections as soon\n"
+          "          as it is produced, instead of on the next pass through the poll loop.\n"
+          "          Replies with the plugin's status, which includes \"latency\": the time in seconds from\n"
+          "          the last frame of a block to the output of features from that block (last, mean, max).\n\n"
+
+          "       schedule PLUGIN_LABEL SCHEDULE\n"
+          "          Run an attached plugin instance only at certain times, according to the timestamps of\n"
+          "          the data.  Outside its schedule, the plugin stays attached and keeps its state, but is\n"
+          "          not given any data.  If every plugin on a device is outside its schedule, and the device\n"
+          "          has no raw or spectrogram listeners, the device is stopped until a plugin's schedule is\n"
+          "          due to open, with asynchronous messages {\"event\":\"devIdle\"} and {\"event\":\"devResumed\"}.\n"
+          "          SCHEDULE is one of:\n"
+          "             always: the default\n"
+          "             duty ON_SECONDS PERIOD_SECONDS [OFFSET_SECONDS]: run for the first ON_SECONDS of each\n"
+          "                period of PERIOD_SECONDS; periods start OFFSET_SECONDS (default 0) after the epoch\n"
+          "             daily HH:MM-HH:MM[,HH:MM-HH:MM...]: run during these windows each day, in UTC\n"
+          "          Replies with the plugin's status, which includes \"activeFraction\": the fraction of the\n"
+          "          device's frames given to the plugin, where time the device spends idle-stopped counts as\n"
+          "          frames not given.  The device's status includes \"idleSeconds\".\n\n"
+
+          "       preload PLUGIN_SONAME[:PLUGIN_ID]\n"
+          "          Open the plugin library and cache its plugin descriptors, so that later attach commands\n"
+          "          for its plugins don't have to search for and load the library.  Libraries stay loaded\n"
+          "          until the server exits.\n"
+          "          PLUGIN_SONAME: the name (without path) of the library containing the plugin(s)\n"
+          "          PLUGIN_ID: the name of the plugin within the library; if omitted, all plugins in the\n"
+          "                     library are cached.\n"
+          "          Replies with {\"preloaded\":[\"SONAME:ID\",...]}\n\n"
+          "          e.g. preload lotek-plugins.so:findpulsefdbatch\n\n"
 
           "       receive PLUGIN_LABEL\n"
           "          Start sending any output for the specified plugin to the TCP connection from\n"
           "          which this command is issued.  This does not affect any existing connections already\n"
           "          set to receive the output, so multiple connections can receive output from the same\n"
           "          attached plugin.\n"
-          "          PLUGIN_LABEL: the label for an attached plugin instance.\n"
+          "          PLUGIN_LABEL: the label for an attached plugin instance, or a cross-correlator.\n"
           "          Note: this command does not return a reply unless there is an error.\n\n"
 
           "       receiveAll\n"
@@ -332,7 +709,8 @@ VampAlsaHost::commandHelp =
           "          which this command is issued.  Also, any plugins attached after this command is issued\n"
           "          will also send output to the issuing TCP connection, unless a subsequent receiveAll command\n"
           "          is issued from a different TCP connection.  This command does not affect any existing\n"
-          "          connections already receiving data from an attached plugin.\n"
+          "          connections already receiving data from an attached plugin.  Cross-correlators (see xcorr)\n"
+          "          are treated as plugins here.\n"
           "          Note: this command does not return a reply unless there is an error.\n\n"
 
           "       rawStream DEV_LABEL RATE FRAMES\n"
@@ -371,6 +749,23 @@ VampAlsaHost::commandHelp =
           "       rawFileOff DEV_LABEL\n"
           "          Stop writing raw data from the device DEV_LABEL to a file, and stop queuing raw data.\n"
 
+          "       spectrogram DEV_LABEL[:CHANNEL] FFT_SIZE ROWS_PER_SECOND [DB_FLOOR [DB_RANGE]]\n"
+          "          Write a spectrogram (waterfall) of one channel of device DEV_LABEL to the TCP connection,\n"
+          "          for monitoring at a small fraction of the bandwidth of rawStream.\n"
+          "          CHANNEL: the device channel to use; default 0.\n"
+          "          FFT_SIZE: frames per transform, a power of two from 16 to 65536; each row has FFT_SIZE / 2\n"
+          "                  frequency bins, from 0 Hz in steps of (device rate) / FFT_SIZE.\n"
+          "          ROWS_PER_SECOND: rows written per second of data (at most 100); each row averages the\n"
+          "                  power spectra of half-overlapping Hann-windowed transforms.\n"
+          "          DB_FLOOR, DB_RANGE: power, in dB relative to a full-scale sine, is mapped linearly from\n"
+          "                  [DB_FLOOR, DB_FLOOR + DB_RANGE] to [0, 255]; defaults are -120 and 120.\n"
+          "          The reply is a line of JSON describing the rows.  Each row which follows is an 8-byte\n"
+          "          timestamp (double, host byte order) of its first frame, followed by one byte per bin.\n\n"
+
+          "       spectrogramOff DEV_LABEL\n"
+          "          Stop writing the spectrogram of device DEV_LABEL to the issuing TCP connection.\n"
+          "          The reply is {} once it has stopped; rows already queued are written before it.\n\n"
+
           "       fmOn DEV_LABEL\n"
           "          Specify that raw data from the device DEV_LABEL will be FM-demodulated\n"
           "          before being sent to to any file or TCP connection which are listening to it via\n"
@@ -405,10 +800,34 @@ VampAlsaHost::commandHelp =
           "           the device from the server, so that DEV_LABEL cannot be used in subsequent commands\n"
           "           until another 'open DEV_LABEL...' command is sent.\n\n"
 
+          "       group GROUP_LABEL DEV_LABEL DEV_LABEL [DEV_LABEL...]\n"
+          "           Align the data from several open devices, which must have the same rate, to a common\n"
+          "           timeline, using each device's clock model, and treat them as one device whose channels\n"
+          "           are those of DEV_LABEL..., in order.  A single plugin can then be attached to\n"
+          "           GROUP_LABEL (e.g. attach GROUP_LABEL:0,2 ...), and is given time-aligned blocks of all\n"
+          "           the devices' channels, scaled to [-1, 1].  Each device's data are buffered until the\n"
+          "           others have caught up, for at most 2 seconds.  start and stop on GROUP_LABEL start and\n"
+          "           stop all its devices.  The group's status (see status) reports, for each device, its\n"
+          "           skew and alignment error in seconds, and frames discarded for alignment or overflow.\n"
+          "           e.g. group df 1 2 3\n\n"
+
+          "       groupOff GROUP_LABEL\n"
+          "           Remove a device group; its devices, and any plugin attached to it, remain.\n\n"
+
           "       status LABEL\n"
           "           Report on the status of the audio device identified by LABEL\n"
           "           The reply is a JSON object.\n\n"
 
+          "       stats DEV_LABEL [WINDOW [NOISE_WINDOW]] [reset]\n"
+          "           Set the windows for signal statistics of device DEV_LABEL, and report its status.\n"
+          "           The device's status (see status) includes, for each channel, running RMS (about the\n"
+          "           mean), peak and DC offset, as fractions of full scale, with RMS also in dBFS; a count\n"
+          "           of clipped samples; and a coarse noise floor in dBFS.\n"
+          "           WINDOW: seconds over which RMS, DC offset and peak decay; default 1.\n"
+          "           NOISE_WINDOW: seconds over which the noise floor rises after it has followed a quiet\n"
+          "                  period down; default 60.\n"
+          "           reset: restart the statistics, and the clip count.\n\n"
+
           "       pstatus LABEL\n"
           "           Report on the status of plugin identified by LABEL\n"
           "           The reply is a JSON object.\n\n"
@@ -422,6 +841,21 @@ VampAlsaHost::commandHelp =
           "       list\n"
           "           Return the status of all open audio devices and plugins.\n\n"
 
+          "       batch { COMMAND; COMMAND; ... }\n"
+          "           Run several commands in order, stopping at the first one which fails.  Commands\n"
+          "           are separated by ';' or newlines, so the block can span several lines, with the\n"
+          "           closing '}' on a line of its own.  Commands already run when one fails are not undone.\n"
+          "           A block longer than 65536 bytes is rejected with an error, and none of its commands run.\n"
+          "           The replies from all commands are returned together, followed by a summary of the form\n"
+          "           {\"batch\":{\"commands\":N,\"done\":M,\"error\":false}}\n\n"
+
+          "       snapshot [FILE]\n"
+          "           Save the open devices, device groups, attached plugins and raw file writers, with their\n"
+          "           settings and counters, to FILE, which can be given to the -r (or -c) option to rebuild\n"
+          "           them at startup.\n"
+          "           FILE defaults to the file given to -r, which is also saved to when the server exits.\n"
+          "           The reply is {\"snapshot\":FILE,\"objects\":N}\n\n"
+
           "       help\n"
           "           Print this information.\n\n"
 
@@ -429,3 +863,4 @@ VampAlsaHost::commandHelp =
           "           Close all open devices and quit the program.\n";
 
 std::string VampAlsaHost::defaultOutputListener;
+volatile sig_atomic_t VampAlsaHost::stopSignal = 0;
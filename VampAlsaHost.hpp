@@ -11,6 +11,7 @@
 #include <map>
 #include <poll.h>
 #include <errno.h>
+#include <signal.h>
 #include <string>
 #include <sstream>
 #include <memory>
@@ -33,7 +34,9 @@ public:
   VampAlsaHost();
   ~VampAlsaHost();
   static string runCommand(string cmdString, string connLabel);
+  static string runBatch(string body, string connLabel); // run commands from a batch { ... } block
   int run();
+  static volatile sig_atomic_t stopSignal; // set by the SIGTERM / SIGINT handler; run() returns once it is non-zero
   static double now(bool is_monotonic = false);
   static const string commandHelp;
 
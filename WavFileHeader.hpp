@@ -1,58 +1,76 @@
 /*
   Header and header-filler for .WAV files
-  FIXME: currently hard-coded to S16_LE sample format
+
+  16-bit PCM with one or two channels gets the classic 44-byte header.
+  Anything else (more channels, wider samples, or float) gets a
+  WAVE_FORMAT_EXTENSIBLE "fmt " chunk, whose subformat gives the actual
+  format, followed by a "fact" chunk, as readers expect for these.
 */
 
 #ifndef WAVFILEHEADER_HPP
 #define WAVFILEHEADER_HPP
 
 #include <string.h>
+#include <stdint.h>
 
 struct WavFileHeader {
 
 protected:
-  struct {
-    char RIFFlabel[4];
-    uint32_t remFileSize;
-    char WAVElabel[4];
-    char FMTlabel[4];
-    uint32_t remFmtSize;
-    uint16_t fmtCode;
-    uint16_t numChan;
-    uint32_t sampleRate;
-    uint32_t byteRate;
-    uint16_t frameSize;
-    uint16_t sampleSize;
-    char DATAlabel[4];
-    uint32_t remDataSize;
-  } __attribute__((packed)) hdrBuf;
+  char hdrBuf[80];   // header bytes; big enough for the extensible form
+  size_t hdrLen;     // number of bytes of hdrBuf used
+
+  void put(const char *s) { memcpy(hdrBuf + hdrLen, s, 4); hdrLen += 4;};
+  void put16(uint16_t x) { hdrBuf[hdrLen++] = x; hdrBuf[hdrLen++] = x >> 8;};
+  void put32(uint32_t x) { put16(x); put16(x >> 16);};
 
 public:
 
   const static int BITS_PER_SAMPLE_S16_LE = 16;
   const static int SAMPLE_FMT_CODE_PCM_S16_LE = 1;
+  const static int SAMPLE_FMT_CODE_PCM = 1;        // integer PCM, of any width
+  const static int SAMPLE_FMT_CODE_IEEE_FLOAT = 3; // 32-bit float
+  const static int SAMPLE_FMT_CODE_EXTENSIBLE = 0xFFFE; // actual format code is in the subformat GUID
+  const static int FMT_CHUNK_SIZE = 16;            // size of the classic "fmt " chunk, following its size field
+  const static int FMT_CHUNK_SIZE_EXTENSIBLE = 40; // size of the extensible "fmt " chunk, following its size field
 
-  WavFileHeader(int rate, int channels, uint32_t frames, int bitsPerSample = BITS_PER_SAMPLE_S16_LE, int fmtCode = SAMPLE_FMT_CODE_PCM_S16_LE)
+  WavFileHeader(int rate, int channels, uint32_t frames, int bitsPerSample = BITS_PER_SAMPLE_S16_LE, int fmtCode = SAMPLE_FMT_CODE_PCM_S16_LE) :
+    hdrLen(0)
   {
     uint32_t bytes = channels * bitsPerSample / 8 * frames;
+    bool extensible = channels > 2 || bitsPerSample > 16 || fmtCode != SAMPLE_FMT_CODE_PCM;
+
+    put("RIFF");
+    put32(bytes + (extensible ? 72 : 36)); // everything after this field
+    put("WAVE");
+
+    put("fmt ");
+    put32(extensible ? FMT_CHUNK_SIZE_EXTENSIBLE : FMT_CHUNK_SIZE);
+    put16(extensible ? SAMPLE_FMT_CODE_EXTENSIBLE : fmtCode);
+    put16(channels);
+    put32(rate);
+    put32(rate * channels * bitsPerSample / 8);
+    put16(channels * bitsPerSample / 8);
+    put16(bitsPerSample);
+    if (extensible) {
+      put16(22);            // cbSize: bytes of extension that follow
+      put16(bitsPerSample); // valid bits per sample
+      put32(0);             // channel mask: channels are not assigned to speaker positions
+      // subformat GUID: the format code, then the fixed KSDATAFORMAT_SUBTYPE suffix
+      put16(fmtCode);
+      memcpy(hdrBuf + hdrLen, "\x00\x00\x00\x00\x10\x00\x80\x00\x00\xAA\x00\x38\x9B\x71", 14);
+      hdrLen += 14;
+
+      put("fact");
+      put32(4);
+      put32(frames);
+    }
 
-    memcpy(hdrBuf.RIFFlabel, "RIFF", 4);
-    hdrBuf.remFileSize = bytes + 36;
-    memcpy(hdrBuf.WAVElabel, "WAVE", 4);
-    memcpy(hdrBuf.FMTlabel, "fmt ", 4);
-    hdrBuf.remFmtSize = bitsPerSample;
-    hdrBuf.fmtCode = fmtCode;
-    hdrBuf.numChan = channels;
-    hdrBuf.sampleRate = rate;
-    hdrBuf.byteRate = rate * channels * bitsPerSample / 8;
-    hdrBuf.frameSize = channels * 2;
-    hdrBuf.sampleSize = bitsPerSample;
-    memcpy(hdrBuf.DATAlabel, "data", 4);
-    hdrBuf.remDataSize = bytes;
+    put("data");
+    put32(bytes);
   };
 
-  char * address() { return (char*) & hdrBuf;};
-  size_t size() { return sizeof(hdrBuf);};
+  char * address() { return hdrBuf;};
+  size_t size() { return hdrLen;};
 };
 
 #endif // WAVFILEHEADER_HPP
@@ -13,23 +13,26 @@
 
 #include <unistd.h>
 
-WavFileWriter::WavFileWriter (string &portLabel, string &label, char *pathTemplate, uint32_t framesToWrite, int rate, int channels) :
+WavFileWriter::WavFileWriter (string &portLabel, string &label, char *pathTemplate, uint32_t framesToWrite, int rate, int channels, SampleFormat::Code sampleFormat) :
   Pollable(label),
   portLabel(portLabel),
   pathTemplate(pathTemplate),
   framesToWrite(framesToWrite),
-  bytesToWrite(framesToWrite * 2 * channels), // FIXME: mono S16_LE hardcoded here
-  byteCountdown(framesToWrite * 2 * channels),
+  bytesToWrite(framesToWrite * SampleFormat::bytes(sampleFormat) * channels),
+  byteCountdown(framesToWrite * SampleFormat::bytes(sampleFormat) * channels),
   currFileTimestamp(-1),
   prevFileTimestamp(-1),
-  hdr(rate, channels, framesToWrite),
+  prevSecondsWritten(0),
+  hdr(rate, channels, framesToWrite, SampleFormat::bits(sampleFormat), SampleFormat::wavFmtCode(sampleFormat)),
   headerWritten(false),
   timestampCaptured(false),
   totalFilesWritten(0),
   totalSecondsWritten(0),
   ensureDirsState(DIR_STATE_NONE),
   rate(rate),
-  channels(channels)
+  channels(channels),
+  sampleFormat(sampleFormat),
+  frameBytes(SampleFormat::bytes(sampleFormat) * channels)
 {
   pollfd.fd = -1;
   pollfd.events = 0;
@@ -57,14 +60,14 @@ bool WavFileWriter::queueOutput(const char *p, uint32_t len, double timestamp) {
     return false;
 
   // get the timestamp for the last frame we're adding, from the timestamp
-  // for the first frame.   FIXME: hardcoded assumption of S16_LE
+  // for the first frame.
 
-  lastFrameTimestamp = (len - 2 * channels) / (2.0 * channels * rate) + timestamp;
+  lastFrameTimestamp = (len - frameBytes) / ((double) frameBytes * rate) + timestamp;
 
   bool rv = Pollable::queueOutput(p, len);
 
   if (pollfd.fd < 0)
-    openOutputFile(lastFrameTimestamp - outputBuffer.size() / (2.0 * channels * rate));
+    openOutputFile(lastFrameTimestamp - outputBuffer.size() / ((double) frameBytes * rate));
 
   // only set this fd up for output polling if there's MIN_WRITE_SIZE data
   // otherwise, we're calling write() much too often
@@ -140,7 +143,7 @@ void WavFileWriter::doneOutputFile(int err) {
     close(pollfd.fd);
     pollfd.fd = -1;
     ++totalFilesWritten;
-    prevSecondsWritten = (bytesToWrite - byteCountdown) / (2.0 * channels * rate); // FIXME: hardwired S16_LE format
+    prevSecondsWritten = (bytesToWrite - byteCountdown) / ((double) frameBytes * rate);
     totalSecondsWritten += prevSecondsWritten;
   }
   requestPollFDRegen();
@@ -172,7 +175,7 @@ void WavFileWriter::handleEvents (struct pollfd *pollfds, bool timedOut, double
       headerWritten = true;
       if (num_bytes != hdr.size()) {
         // we should deal gracefully with this, but is it ever going
-        // to gag on 44 bytes?  Maybe, if the disk is full.
+        // to gag on 80 bytes?  Maybe, if the disk is full.
         doneOutputFile();
       }
       return;
@@ -211,9 +214,9 @@ string WavFileWriter::toJSON() {
     << ",\"port\":\"" << portLabel
     << "\",\"fileDescriptor\":" << pollfd.fd
     << ",\"fileName\":\"" << (char *) filename
-    << "\",\"framesWritten\":" << (uint32_t) ((bytesToWrite - byteCountdown) / (2 * channels))
+    << "\",\"framesWritten\":" << (uint32_t) ((bytesToWrite - byteCountdown) / frameBytes)
     << ",\"framesToWrite\":" << framesToWrite
-    << ",\"secondsWritten\":"  << std::setprecision(16) << ((bytesToWrite - byteCountdown) / (2.0 * rate * channels))
+    << ",\"secondsWritten\":"  << std::setprecision(16) << ((bytesToWrite - byteCountdown) / ((double) frameBytes * rate))
     << ",\"secondsToWrite\":" << framesToWrite / (double) rate
     << ",\"totalFilesWritten\":" << totalFilesWritten
     << ",\"totalSecondsWritten\":" << totalSecondsWritten
@@ -221,6 +224,38 @@ string WavFileWriter::toJSON() {
     << ",\"currFileTimestamp\":" << currFileTimestamp
     << ",\"prevSecondsWritten\":" << prevSecondsWritten
     << ",\"rate\":" << rate
+    << ",\"sampleFormat\":\"" << SampleFormat::name(sampleFormat) << "\""
     << "}";
   return s.str();
 };
+
+string WavFileWriter::configJSON() {
+  // the file being written when the snapshot is taken is cut short at
+  // exit, so it is counted as done; its timestamp becomes the previous
+  // file's timestamp when the restored writer opens its next file
+  bool current = pollfd.fd >= 0;
+  double secondsWritten = current ? (bytesToWrite - byteCountdown) / ((double) frameBytes * rate) : prevSecondsWritten;
+  ostringstream s;
+  s << "{"
+    << "\"device\":\"" << portLabel
+    << "\",\"rate\":" << rate
+    << ",\"frames\":" << framesToWrite
+    << ",\"path\":\"" << pathTemplate
+    << "\",\"state\":{"
+    << "\"totalFilesWritten\":" << totalFilesWritten + (current ? 1 : 0)
+    << ",\"totalSecondsWritten\":" << totalSecondsWritten + (current ? (uint64_t) secondsWritten : 0)
+    << std::setprecision(16)
+    << ",\"prevFileTimestamp\":" << prevFileTimestamp
+    << ",\"currFileTimestamp\":" << currFileTimestamp
+    << ",\"prevSecondsWritten\":" << secondsWritten
+    << "}}";
+  return s.str();
+};
+
+void WavFileWriter::restoreCounters(uint32_t totalFilesWritten, uint64_t totalSecondsWritten, double prevFileTimestamp, double currFileTimestamp, double prevSecondsWritten) {
+  this->totalFilesWritten = totalFilesWritten;
+  this->totalSecondsWritten = totalSecondsWritten;
+  this->prevFileTimestamp = prevFileTimestamp;
+  this->currFileTimestamp = currFileTimestamp;
+  this->prevSecondsWritten = prevSecondsWritten;
+};
@@ -10,6 +10,7 @@ using std::istringstream;
 
 #include "Pollable.hpp"
 #include "WavFileHeader.hpp"
+#include "SampleFormat.hpp"
 
 class WavFileWriter;
   
@@ -46,7 +47,7 @@ protected:
   enum {DIR_STATE_NONE, DIR_STATE_WAITING, DIR_STATE_CREATED} ensureDirsState; // state of directory creation
 public:
 
-  WavFileWriter (string &portLabel, string &label, char *pathTemplate, uint32_t framesToWrite, int rate, int channels);
+  WavFileWriter (string &portLabel, string &label, char *pathTemplate, uint32_t framesToWrite, int rate, int channels, SampleFormat::Code sampleFormat = SampleFormat::S16_LE);
   
   int getNumPollFDs();
 
@@ -66,9 +67,17 @@ public:
 
   string toJSON();
 
+  string configJSON(); // this writer as an entry in the "rawFiles" list of a config file; see Config.hpp
+
+  void restoreCounters(uint32_t totalFilesWritten, uint64_t totalSecondsWritten, double prevFileTimestamp, double currFileTimestamp, double prevSecondsWritten); // from a snapshot
+
   int rate;
 
   int channels;
+
+  SampleFormat::Code sampleFormat; // format of samples we receive and write
+
+  int frameBytes; // bytes per frame
 };
 
 #endif // WAVFILEWRITER_HPP
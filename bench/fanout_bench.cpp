@@ -0,0 +1,98 @@
+/*
+  fanout_bench: time the per-batch fan-out of data to a device's
+  listeners, as done now with a ListenerTable, and as it was done with
+  a label-keyed std::map of weak_ptrs.
+
+  Usage: fanout_bench [LISTENERS [BATCHES]]
+
+  Creates LISTENERS (default 16) Pollables whose queueOutput() only
+  counts bytes, so that what is timed is the walk over the listeners:
+  finding each one and checking that it still exists.  Each of BATCHES
+  (default 1000000) batches is offered to every listener, first through
+  a std::map < string, weak_ptr < Pollable > >, walked as
+  DevMinder::handleEvents used to walk its rawListeners, then through
+  a ListenerTable < Pollable >, walked as it is now.  Prints the mean
+  time per batch for each.
+*/
+
+#include "Pollable.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <map>
+
+// before: DevMinder's RawListenerSet
+typedef std::map < string, weak_ptr < Pollable > > WeakListenerMap;
+
+class CountingListener : public Pollable {
+public:
+  long long bytes;
+  CountingListener(const string &label) : Pollable(label), bytes(0) {};
+  string toJSON() {return "{}";};
+  bool queueOutput(const char * p, uint32_t len, double timestamp) {bytes += len; return true;};
+};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, & ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+};
+
+static char batch[4096];
+
+static void fanoutMap(WeakListenerMap &listeners, double ts) {
+  for (WeakListenerMap::iterator ir = listeners.begin(); ir != listeners.end(); /**/) {
+    if (Pollable * ptr = (ir->second).lock().get()) {
+      ptr->queueOutput(batch, sizeof(batch), ts);
+      ++ir;
+    } else {
+      WeakListenerMap::iterator to_delete = ir++;
+      listeners.erase(to_delete);
+    }
+  }
+};
+
+static void fanoutTable(ListenerTable < Pollable > &listeners, double ts) {
+  for (size_t i = 0; i < listeners.size(); /**/) {
+    if (Pollable * ptr = listeners.at(i)) {
+      ptr->queueOutput(batch, sizeof(batch), ts);
+      ++i;
+    } else {
+      listeners.removeAt(i);
+    }
+  }
+};
+
+int main(int argc, char *argv[]) {
+  int numListeners = argc > 1 ? atoi(argv[1]) : 16;
+  long batches = argc > 2 ? atol(argv[2]) : 1000000;
+  if (numListeners < 1 || batches < 1) {
+    fprintf(stderr, "Usage: fanout_bench [LISTENERS [BATCHES]]\n");
+    exit(1);
+  }
+
+  WeakListenerMap before;
+  ListenerTable < Pollable > after;
+  for (int i = 0; i < numListeners; ++i) {
+    char label[32];
+    snprintf(label, sizeof(label), "listener%d", i);
+    new CountingListener(label);
+    before[label] = Pollable::lookupByNameShared(label);
+    after.add(label, Pollable::lookupByName(label));
+  }
+
+  double t = now();
+  for (long b = 0; b < batches; ++b)
+    fanoutMap(before, b);
+  double tBefore = now() - t;
+
+  t = now();
+  for (long b = 0; b < batches; ++b)
+    fanoutTable(after, b);
+  double tAfter = now() - t;
+
+  printf("%d listeners, %ld batches: map of weak_ptrs %.1f ns per batch; ListenerTable %.1f ns per batch\n",
+         numListeners, batches, tBefore / batches * 1e9, tAfter / batches * 1e9);
+  return 0;
+};
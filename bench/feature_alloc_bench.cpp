@@ -0,0 +1,142 @@
+/*
+  feature_alloc_bench: count the heap allocations made by
+  PluginRunner::outputFeatures in the steady state.
+
+  Usage: feature_alloc_bench SONAME:ID:OUTPUT [BLOCKS [FEATURES [VALUES]]]
+
+  Creates a PluginRunner for the plugin, as attach does but with no
+  device, with an output listener which queues output as a connection
+  does.  It then passes one FeatureSet of FEATURES (default 4)
+  timestamped features with VALUES (default 3) values each, for the
+  plugin's OUTPUT, to outputFeatures() BLOCKS (default 10000) times.
+  Every second feature also has a duration.
+
+  malloc, calloc and realloc are replaced with counting versions which
+  call glibc's own; operator new goes through malloc, so this counts
+  what std::string, std::vector and std::map allocate too.  Prints the
+  number of allocations during the first block, which may fill buffers
+  for the first time, and during all later blocks, which should be 0.
+  Exits with status 0 only if it is.
+
+  The FeatureSet returned by Plugin::process() is not counted; the Vamp
+  API returns it by value, so that allocation is the plugin adapter's.
+*/
+
+#include "PluginRunner.hpp"
+#include "PluginCache.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// glibc's allocator, under the names it exports for interposers
+extern "C" {
+  void * __libc_malloc(size_t n);
+  void * __libc_calloc(size_t n, size_t size);
+  void * __libc_realloc(void * p, size_t n);
+}
+
+static bool counting = false;
+static long long allocations = 0;
+
+extern "C" void * malloc(size_t n) {
+  if (counting)
+    ++allocations;
+  return __libc_malloc(n);
+};
+
+extern "C" void * calloc(size_t n, size_t size) {
+  if (counting)
+    ++allocations;
+  return __libc_calloc(n, size);
+};
+
+extern "C" void * realloc(void * p, size_t n) {
+  if (counting)
+    ++allocations;
+  return __libc_realloc(p, n);
+};
+
+// receives output as a TCPConnection does, but has no fd, so output just
+// accumulates in (and wraps around) its outputBuffer
+class NullListener : public Pollable {
+public:
+  NullListener(const string &label) : Pollable(label) {};
+  string toJSON() {return "{}";};
+};
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: feature_alloc_bench SONAME:ID:OUTPUT [BLOCKS [FEATURES [VALUES]]]\n");
+    exit(1);
+  }
+  string key = argv[1];
+  size_t c1 = key.find(':'), c2 = key.find(':', c1 + 1);
+  if (c1 == string::npos || c2 == string::npos) {
+    fprintf(stderr, "feature_alloc_bench: plugin must be given as SONAME:ID:OUTPUT\n");
+    exit(1);
+  }
+  string soname = key.substr(0, c1);
+  string id = key.substr(c1 + 1, c2 - c1 - 1);
+  string output = key.substr(c2 + 1);
+  int blocks = argc > 2 ? atoi(argv[2]) : 10000;
+  int numFeatures = argc > 3 ? atoi(argv[3]) : 4;
+  int numValues = argc > 4 ? atoi(argv[4]) : 3;
+
+  // the index of the output, which is how features are keyed
+  PluginCache::Entry * entry;
+  Plugin * p = PluginCache::loadPlugin(soname, id, 48000, & entry);
+  if (! p) {
+    fprintf(stderr, "feature_alloc_bench: unable to load %s:%s\n", soname.c_str(), id.c_str());
+    exit(2);
+  }
+  delete p;
+  int outputNo = -1;
+  for (size_t i = 0; i < entry->outputs.size(); ++i)
+    if (entry->outputs[i].identifier == output)
+      outputNo = i;
+  if (outputNo < 0) {
+    fprintf(stderr, "feature_alloc_bench: plugin has no output '%s'\n", output.c_str());
+    exit(2);
+  }
+
+  std::vector < int > channelMap(1, 0);
+  ParamSet ps;
+  PluginRunner * pr;
+  try {
+    pr = new PluginRunner("bench", "nodev", 48000, channelMap, 32767, soname, id, output, ps);
+  } catch (std::runtime_error e) {
+    fprintf(stderr, "feature_alloc_bench: %s\n", e.what());
+    exit(2);
+  }
+  new NullListener("listener");
+  pr->addOutputListener("listener");
+
+  Plugin::FeatureSet features;
+  for (int i = 0; i < numFeatures; ++i) {
+    Plugin::Feature f;
+    f.hasTimestamp = true;
+    f.timestamp = RealTime::fromSeconds(1500000000.0 + i * 0.001);
+    f.hasDuration = i & 1;
+    f.duration = RealTime(0, 2500000);
+    for (int j = 0; j < numValues; ++j)
+      f.values.push_back(i * 1.5 + j);
+    features[outputNo].push_back(f);
+  }
+  string prefix = "bench";
+
+  counting = true;
+  pr->outputFeatures(features, prefix);
+  counting = false;
+  long long first = allocations;
+
+  allocations = 0;
+  counting = true;
+  for (int i = 1; i < blocks; ++i)
+    pr->outputFeatures(features, prefix);
+  counting = false;
+
+  printf("allocations: %lld in first block; %lld in the next %d blocks of %d features\n",
+         first, allocations, blocks - 1, numFeatures);
+  return allocations == 0 ? 0 : 3;
+};
@@ -0,0 +1,92 @@
+/*
+  plugin_cache_bench: time the plugin loading done by each attach /
+  detach cycle, with PluginCache and with PluginLoader.
+
+  Usage: plugin_cache_bench SONAME:ID [CYCLES]
+
+  Each cycle creates an instance of plugin ID from library SONAME,
+  fetches its output and parameter descriptors, and deletes it: once
+  through PluginCache, as PluginRunner::loadPlugin now does, and once
+  through PluginLoader::loadPlugin, as it did before.  Prints the time
+  of the first (cold) load through each, and the median and maximum
+  over CYCLES (default 1000) cycles.
+
+  The cold PluginCache load is done first, so the library is already
+  open (and in the OS page cache) for the PluginLoader cycles; that
+  favours PluginLoader, if anything.
+*/
+
+#include "PluginCache.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+static const float RATE = 48000;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, & ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+};
+
+// one cycle through PluginCache; the descriptors are memoized in the entry
+static size_t cacheCycle(const string &soname, const string &id) {
+  PluginCache::Entry * entry;
+  Plugin * p = PluginCache::loadPlugin(soname, id, RATE, & entry);
+  if (! p)
+    return 0;
+  size_t n = entry->outputs.size() + entry->params.size();
+  delete p;
+  return n;
+};
+
+// one cycle through PluginLoader, querying descriptors from the instance
+static size_t loaderCycle(const string &soname, const string &id) {
+  PluginLoader * loader = PluginLoader::getInstance();
+  Plugin * p = loader->loadPlugin(loader->composePluginKey(soname, id), RATE, 0);
+  if (! p)
+    return 0;
+  size_t n = p->getOutputDescriptors().size() + p->getParameterDescriptors().size();
+  delete p;
+  return n;
+};
+
+static void report(const char *what, size_t (*cycle)(const string &, const string &), const string &soname, const string &id, int cycles) {
+  double t = now();
+  if (! cycle(soname, id)) {
+    fprintf(stderr, "plugin_cache_bench: unable to load %s:%s\n", soname.c_str(), id.c_str());
+    exit(2);
+  }
+  double cold = now() - t;
+
+  std::vector < double > times(cycles);
+  for (int i = 0; i < cycles; ++i) {
+    t = now();
+    cycle(soname, id);
+    times[i] = now() - t;
+  }
+  std::sort(times.begin(), times.end());
+  printf("%-12s cold %9.1f us; %d cycles: median %9.1f us, max %9.1f us\n",
+         what, cold * 1e6, cycles, times[cycles / 2] * 1e6, times[cycles - 1] * 1e6);
+};
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || ! strchr(argv[1], ':')) {
+    fprintf(stderr, "Usage: plugin_cache_bench SONAME:ID [CYCLES]\n");
+    exit(1);
+  }
+  string key = argv[1];
+  string soname = key.substr(0, key.find(':'));
+  string id = key.substr(key.find(':') + 1);
+  int cycles = argc > 2 ? atoi(argv[2]) : 1000;
+  if (cycles < 1)
+    cycles = 1;
+
+  report("PluginCache", cacheCycle, soname, id, cycles);
+  report("PluginLoader", loaderCycle, soname, id, cycles);
+  return 0;
+};
@@ -0,0 +1,231 @@
+/*
+  raw_multicast_bench: time the delivery of raw output batches to
+  several listeners, and check that what each TCPConnection writes
+  is intact.
+
+  Usage: raw_multicast_bench [LISTENERS [BATCHES [BATCH_BYTES]]]
+
+  First, each of BATCHES (default 100000) batches of BATCH_BYTES
+  (default 4096) bytes is delivered to LISTENERS (default 3) listeners,
+  once by copying it into each listener's outputBuffer, as
+  DevMinder::handleEvents used to, and once by queueing a reference to
+  a single shared RawChunk, as it does now.  Prints the mean time per
+  batch for each.
+
+  Then LISTENERS TCPConnections are given small socket buffers and
+  read slowly and unevenly, so that chunks are written in pieces, and
+  some are dropped.  Each batch is queued to every connection, and a
+  line of text is queued after every third batch and flushed, as
+  PluginRunner does for low-latency listeners.  Chunk bytes are >= 0x80
+  and text is ASCII, so the reader can tell if text was written into
+  the middle of a chunk, or a chunk was cut short.  Exits with status
+  0 only if every connection's stream parses cleanly.
+*/
+
+#include "TCPConnection.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// before: each listener copies every batch into its own outputBuffer
+class CopyListener : public Pollable {
+public:
+  CopyListener(const string &label) : Pollable(label) {
+    outputBuffer = boost::circular_buffer < char > (TCPConnection::RAW_OUTPUT_BUFFER_SIZE);
+  };
+  string toJSON() {return "{}";};
+};
+
+// what the client end of one connection has seen
+struct Reader {
+  int fd;
+  int state;        // 0: between items; 1: in a chunk; 2: in a line of text
+  unsigned char val; // value of every byte of the current chunk
+  int pos;          // bytes of the current chunk seen so far
+  long chunks, lines, errors;
+};
+
+static string ignoreCommand(string cmd, string connLabel) {
+  return "";
+};
+
+// a connection whose client end is readers[i], with a small send buffer
+// so that chunks are written in pieces
+static TCPConnection * openConnection(int i, std::vector < Reader > &readers) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+    perror("raw_multicast_bench: socketpair");
+    exit(2);
+  }
+  int sndbuf = 4096;
+  setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, & sndbuf, sizeof(sndbuf));
+  fcntl(sv[0], F_SETFL, O_NONBLOCK);
+  fcntl(sv[1], F_SETFL, O_NONBLOCK);
+  char label[32];
+  snprintf(label, sizeof(label), "conn%d", i);
+  Reader r = {sv[1], 0, 0, 0, 0, 0, 0};
+  readers[i] = r;
+  return new TCPConnection(sv[0], label, ignoreCommand, true, 0);
+};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, & ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+};
+
+static void parse(Reader &r, const unsigned char * p, int len, int batchBytes) {
+  for (int i = 0; i < len; ++i) {
+    unsigned char c = p[i];
+    switch (r.state) {
+    case 0:
+      if (c == '{') {
+        r.state = 2;
+      } else if (c >= 0x80) {
+        r.state = 1;
+        r.val = c;
+        r.pos = 1;
+      } else {
+        ++r.errors;
+      }
+      break;
+    case 1:
+      if (c != r.val) {
+        // text or another chunk where the rest of this one should be
+        ++r.errors;
+        r.state = 0;
+        --i;
+        break;
+      }
+      if (++r.pos == batchBytes) {
+        ++r.chunks;
+        r.state = 0;
+      }
+      break;
+    case 2:
+      if (c >= 0x80) {
+        ++r.errors;
+      } else if (c == '\n') {
+        ++r.lines;
+        r.state = 0;
+      }
+      break;
+    }
+    // a chunk of one byte is complete as soon as it starts
+    if (r.state == 1 && r.pos == batchBytes) {
+      ++r.chunks;
+      r.state = 0;
+    }
+  }
+};
+
+int main(int argc, char *argv[]) {
+  int numListeners = argc > 1 ? atoi(argv[1]) : 3;
+  long batches = argc > 2 ? atol(argv[2]) : 100000;
+  int batchBytes = argc > 3 ? atoi(argv[3]) : 4096;
+  if (numListeners < 1 || batches < 1 || batchBytes < 1) {
+    fprintf(stderr, "Usage: raw_multicast_bench [LISTENERS [BATCHES [BATCH_BYTES]]]\n");
+    exit(1);
+  }
+  std::vector < Pollable * > copies, shares;
+  std::vector < Reader > readers(numListeners);
+
+  for (int i = 0; i < numListeners; ++i) {
+    char label[32];
+    snprintf(label, sizeof(label), "copy%d", i);
+    copies.push_back(new CopyListener(label));
+    shares.push_back(openConnection(i, readers));
+  }
+
+  shared_ptr < RawChunk > chunk(new RawChunk());
+  chunk->data.resize(batchBytes, (char) 0x80);
+  chunk->timestamp = 0;
+  RawChunkPtr shared = chunk;
+
+  // cost of the fan-out alone; no reader, so queues just wrap or trim
+
+  double t = now();
+  for (long b = 0; b < batches; ++b)
+    for (int i = 0; i < numListeners; ++i)
+      copies[i]->queueOutput(& chunk->data[0], batchBytes, b);
+  double tCopy = now() - t;
+
+  t = now();
+  for (long b = 0; b < batches; ++b)
+    for (int i = 0; i < numListeners; ++i)
+      shares[i]->queueChunk(shared);
+  double tShare = now() - t;
+
+  printf("%d listeners, %ld batches of %d bytes: copy %.1f ns per batch; shared chunk %.1f ns per batch\n",
+         numListeners, batches, batchBytes, tCopy / batches * 1e9, tShare / batches * 1e9);
+
+  // integrity over real sockets, with slow and uneven readers; start
+  // with fresh connections, as the timing loop's chunks are all alike
+
+  for (int i = 0; i < numListeners; ++i)
+    Pollable::remove(shares[i]->label);
+  for (int i = 0; i < numListeners; ++i) {
+    close(readers[i].fd);
+    shares[i] = openConnection(i, readers);
+  }
+
+  srandom(1);
+  std::vector < unsigned char > rbuf(65536);
+  long sentLines = 0;
+  long rounds = batches / 10 + 1;
+  for (long b = 0; ; ++b) {
+    if (b < rounds) {
+      shared_ptr < RawChunk > c(new RawChunk());
+      c->data.resize(batchBytes, (char) (0x80 | (b & 0x7f)));
+      c->timestamp = b;
+      RawChunkPtr sc = c;
+      for (int i = 0; i < numListeners; ++i)
+        shares[i]->queueChunk(sc);
+      if (b % 3 == 2) {
+        char line[64];
+        int n = snprintf(line, sizeof(line), "{\"batch\":%ld, \"async\":true}\n", b);
+        for (int i = 0; i < numListeners; ++i) {
+          shares[i]->queueOutput(line, n);
+          shares[i]->flushOutput();
+        }
+        ++sentLines;
+      }
+    }
+
+    bool busy = false;
+    for (int i = 0; i < numListeners; ++i) {
+      struct pollfd pfd;
+      shares[i]->getPollFDs(& pfd);
+      if (pfd.events & POLLOUT) {
+        busy = true;
+        pfd.events = POLLOUT;
+        if (poll(& pfd, 1, 0) > 0)
+          shares[i]->handleEvents(& pfd, false, 0);
+      }
+      int want = b < rounds ? 1 + random() % (2 * batchBytes) : (int) rbuf.size();
+      int n = read(readers[i].fd, & rbuf[0], want);
+      if (n > 0) {
+        busy = true;
+        parse(readers[i], & rbuf[0], n, batchBytes);
+      }
+    }
+    if (b >= rounds && ! busy)
+      break;
+  }
+
+  bool ok = true;
+  for (int i = 0; i < numListeners; ++i) {
+    Reader &r = readers[i];
+    printf("connection %d: %ld of %ld chunks, %ld of %ld lines, %ld errors\n",
+           i, r.chunks, rounds, r.lines, sentLines, r.errors);
+    if (r.errors || r.state != 0 || r.lines != sentLines)
+      ok = false;
+  }
+  return ok ? 0 : 3;
+};
@@ -0,0 +1,96 @@
+#!/bin/sh
+#
+# restore-time.sh: measure how long vamp-alsa-host takes to recover
+# from a restart, by way of its snapshot file.
+#
+# Usage: bench/restore-time.sh CONFIGFILE [RUNS]
+#
+# Starts vamp-alsa-host (from this directory's parent, or VAMP_ALSA_HOST
+# if set) with CONFIGFILE and a temporary snapshot file (-r), and waits
+# until it is up: every device is running and has delivered data.  Then,
+# RUNS times (default 5), it notes how many devices and plugins there
+# are, stops the server with SIGTERM, which saves the snapshot, starts a
+# new server, which restores from the snapshot, and waits until it has
+# the same devices running and delivering data, and the same number of
+# plugins.  For each run, it prints the time the old server took to
+# exit, the time the new one spent in Config::load (from its stderr),
+# the time from starting the new server until it was up, and the total.
+#
+# Commands are sent with socat, polling every POLL seconds (default
+# 0.05), so times are good to about twice that.
+
+VAMP_ALSA_HOST=${VAMP_ALSA_HOST:-$(dirname "$0")/../vamp-alsa-host}
+POLL=${POLL:-0.05}
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 CONFIGFILE [RUNS]" >&2
+    exit 1
+fi
+CONFIG=$1
+RUNS=${2:-5}
+
+SOCK=restore-time.$$
+TMP=$(mktemp -d)
+SNAP=$TMP/snapshot.json
+PID=""
+trap '[ -n "$PID" ] && kill $PID 2>/dev/null && wait $PID; rm -rf "$TMP"' EXIT
+trap 'exit 3' INT TERM
+
+now() {
+    date +%s.%N
+}
+
+query() {
+    echo "$1" | socat -t "$POLL" - UNIX-CONNECT:/tmp/$SOCK 2>/dev/null
+}
+
+# print "UP DEVICES PLUGINS": devices running and delivering data, all
+# devices, and plugins
+summary() {
+    query list | awk 'BEGIN {RS = "\"type\":"}
+        /^"DevMinder"/ {d++; if (/"running":true/ && /"totalFrames":[1-9]/) up++}
+        /^"PluginRunner"/ {p++}
+        END {print up + 0, d + 0, p + 0}'
+}
+
+start() {
+    "$VAMP_ALSA_HOST" -q -s "$SOCK" -c "$CONFIG" -r "$SNAP" >/dev/null 2>>"$TMP/stderr" &
+    PID=$!
+}
+
+# wait until the summary is $1, or if $1 is empty, until every device is
+# up; give up after a minute
+waitUp() {
+    DEADLINE=$(awk "BEGIN {printf \"%.3f\", $(now) + 60}")
+    while :; do
+        S=$(summary)
+        if [ -n "$1" ]; then
+            [ "$S" = "$1" ] && return 0
+        else
+            echo "$S" | awk '{exit ! ($1 > 0 && $1 == $2)}' && return 0
+        fi
+        if awk "BEGIN {exit ! ($(now) > $DEADLINE)}"; then
+            echo "vamp-alsa-host not up after 60 s; last summary (up devices plugins): $S" >&2
+            cat "$TMP/stderr" >&2
+            exit 2
+        fi
+        sleep "$POLL"
+    done
+}
+
+start
+waitUp ""
+BASE=$(summary)
+echo "$(echo "$BASE" | awk '{print $2}') devices, $(echo "$BASE" | awk '{print $3}') plugins"
+echo " run   exit_s   load_s     up_s  total_s"
+for R in $(seq "$RUNS"); do
+    T0=$(now)
+    kill -TERM "$PID"
+    wait "$PID"
+    T1=$(now)
+    start
+    waitUp "$BASE"
+    T2=$(now)
+    LOAD=$(grep "^restored from" "$TMP/stderr" | tail -1 | sed 's/.* in \([^ ]*\) s.*/\1/')
+    awk "BEGIN {printf \"%4d  %7.3f  %7.3f  %7.3f  %7.3f\\n\", $R, $T1 - $T0, ${LOAD:-0}, $T2 - $T1, $T2 - $T0}"
+done
@@ -0,0 +1,115 @@
+/*
+  rtlsdr_bench: check and time RTLSDRMinder's ingest of an rtl_tcp
+  stream, using the stand-in server rtltcp_fixture.
+
+  Usage: rtlsdr_bench FIXTURE MBYTES [MAX_WRITE]
+
+  Runs FIXTURE (the path to rtltcp_fixture) on a temporary socket, and
+  reads MBYTES megabytes of sample bytes from it through an RTLSDRMinder,
+  calling hw_handleEvents and hw_getFrames as DevMinder::handleEvents
+  does.  Every sample is checked against what the fixture sent, as is
+  the timestamp of every batch which has one.  MAX_WRITE is passed to
+  the fixture; a small value (e.g. 7) makes it split headers and I/Q
+  pairs across reads.
+
+  Prints the number of wakeups, and the CPU time spent in the two
+  calls, per megabyte of sample bytes.  Exits with status 0 only if all
+  data arrived intact.
+*/
+
+#include "RTLSDRMinder.hpp"
+#include "VampAlsaHost.hpp"
+#include "rtltcp_fixture.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+static const int RATE = 240000; // a valid rtlsdr rate, so no downsampling
+
+static double threadCPU() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, & ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+};
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: rtlsdr_bench FIXTURE MBYTES [MAX_WRITE]\n");
+    exit(1);
+  }
+  const char * maxWrite = argc > 3 ? argv[3] : "0";
+  long long total = fixtureSampleBytes(atof(argv[2]));
+
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/rtlsdr_bench.%d.sock", (int) getpid());
+  char rate[16];
+  snprintf(rate, sizeof(rate), "%d", RATE);
+
+  pid_t child = fork();
+  if (child == 0) {
+    execl(argv[1], argv[1], path, rate, argv[2], maxWrite, (char *) 0);
+    perror("rtlsdr_bench: unable to run fixture");
+    _exit(1);
+  }
+
+  // the fixture creates the socket once it is listening
+  for (int i = 0; i < 500 && access(path, F_OK); ++i)
+    usleep(10000);
+
+  RTLSDRMinder * dev = new RTLSDRMinder(string("rtlsdr:") + path, RATE, 2, "rtlsdr_bench", VampAlsaHost::now());
+  if (dev->hw_open()) {
+    fprintf(stderr, "rtlsdr_bench: unable to connect to fixture\n");
+    kill(child, SIGTERM);
+    exit(2);
+  }
+
+  std::vector < float > buf;
+  long long got = 0;       // sample bytes received
+  long long wakeups = 0;
+  long long bad = 0;       // samples or timestamps not as sent
+  double cpu = 0;
+
+  while (got < total) {
+    struct pollfd pfd;
+    dev->hw_getPollFDs(& pfd);
+    pfd.revents = 0;
+    if (poll(& pfd, 1, 2000) <= 0) {
+      fprintf(stderr, "rtlsdr_bench: timed out after %lld of %lld bytes\n", got, total);
+      break;
+    }
+    double t = threadCPU();
+    int avail = dev->hw_handleEvents(& pfd, false);
+    if (avail <= 0) {
+      if (pfd.revents & (POLLHUP | POLLERR)) {
+        fprintf(stderr, "rtlsdr_bench: fixture hung up after %lld of %lld bytes\n", got, total);
+        break;
+      }
+      continue;
+    }
+    if ((size_t) avail * 2 > buf.size())
+      buf.resize(avail * 2);
+    double frameTimestamp;
+    int frames = dev->hw_getFrames(& buf[0], avail, frameTimestamp);
+    cpu += threadCPU() - t;
+    ++wakeups;
+
+    if (frameTimestamp > 0 && fabs(frameTimestamp - (FIXTURE_T0 + (got / 2.0) / RATE)) > 1e-6)
+      ++bad;
+    for (int i = 0; i < 2 * frames; ++i)
+      if (buf[i] != ((int) fixtureByte(got + i) - 128) * RTLSDRMinder::SAMPLE_SCALE)
+        ++bad;
+    got += 2 * frames;
+  }
+
+  int status;
+  waitpid(child, & status, 0);
+
+  printf("%lld bytes in %lld wakeups (%.0f bytes per wakeup); %.3f ms CPU per MB; %lld errors\n",
+         got, wakeups, wakeups ? (double) got / wakeups : 0.0, cpu * 1e3 / (got / 1e6), bad);
+  return (got == total && bad == 0) ? 0 : 3;
+};
@@ -0,0 +1,135 @@
+/*
+  rtltcp_fixture: a stand-in for our rtl_tcp, for testing and
+  benchmarking RTLSDRMinder without a dongle.
+
+  Usage: rtltcp_fixture SOCKET_PATH RATE MBYTES [MAX_WRITE [SEED]]
+
+  Listens on the unix domain socket SOCKET_PATH, accepts one
+  connection, and sends MBYTES megabytes of I/Q sample bytes with the
+  same framing as rtl_tcp: segments of a stream_segment_hdr_t followed
+  by sample bytes.  Sample bytes and timestamps follow rtltcp_fixture.hpp,
+  with RATE the hardware rate in frames per second.
+
+  Segment lengths are pseudo-random.  If MAX_WRITE is zero, each
+  segment holds whole I/Q pairs and is written with one call, as
+  rtl_tcp does.  Otherwise, segment lengths are odd as often as even,
+  and the stream is written in pseudo-random pieces of 1 to MAX_WRITE
+  bytes regardless of segment boundaries, so that the client sees
+  partial headers and unpaired sample bytes.
+
+  The socket is closed, and SOCKET_PATH removed, once everything has
+  been sent.
+*/
+
+#include "rtltcp_fixture.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+// as in RTLSDRMinder.hpp; this program doesn't otherwise need the host's headers
+typedef struct {
+  uint32_t size;   // size of this header plus number of sample bytes before next header
+  double ts;       // timestamp of first sample in stream
+} stream_segment_hdr_t;
+
+static const int MAX_SEGMENT_BYTES = 65536; // largest number of sample bytes in a segment
+
+static int writeAll(int fd, const char *p, size_t n) {
+  while (n > 0) {
+    ssize_t rv = write(fd, p, n);
+    if (rv < 0) {
+      if (errno == EINTR)
+        continue;
+      return 1;
+    }
+    p += rv;
+    n -= rv;
+  }
+  return 0;
+};
+
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    fprintf(stderr, "Usage: rtltcp_fixture SOCKET_PATH RATE MBYTES [MAX_WRITE [SEED]]\n");
+    exit(1);
+  }
+  const char * path = argv[1];
+  int rate = atoi(argv[2]);
+  long long total = fixtureSampleBytes(atof(argv[3]));
+  int maxWrite = argc > 4 ? atoi(argv[4]) : 0;
+  unsigned int seed = argc > 5 ? atoi(argv[5]) : 1;
+
+  if (rate <= 0 || strlen(path) + 4 >= sizeof(((struct sockaddr_un *) 0)->sun_path)) {
+    fprintf(stderr, "rtltcp_fixture: invalid rate or socket path\n");
+    exit(1);
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  // listen under a temporary name, so that SOCKET_PATH only appears
+  // once a client can connect to it
+  std::string tmpPath = std::string(path) + ".tmp";
+  int lis = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(& addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, tmpPath.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(tmpPath.c_str());
+  if (lis < 0 || bind(lis, (struct sockaddr *) & addr, sizeof(addr)) || listen(lis, 1) || rename(tmpPath.c_str(), path)) {
+    perror("rtltcp_fixture: unable to listen");
+    exit(2);
+  }
+  int fd = accept(lis, 0, 0);
+  if (fd < 0) {
+    perror("rtltcp_fixture: accept failed");
+    exit(2);
+  }
+
+  // one segment at a time: header then samples, contiguous, so that
+  // pieces can straddle the boundary between them
+  std::vector < char > seg(sizeof(stream_segment_hdr_t) + MAX_SEGMENT_BYTES);
+  long long sent = 0;
+  while (sent < total) {
+    int n = 1 + rand_r(& seed) % MAX_SEGMENT_BYTES;
+    if (maxWrite == 0)
+      n += n & 1;
+    if (n > total - sent)
+      n = total - sent;
+    stream_segment_hdr_t hdr;
+    memset(& hdr, 0, sizeof(hdr));
+    hdr.size = sizeof(stream_segment_hdr_t) + n;
+    hdr.ts = FIXTURE_T0 + (sent / 2.0) / rate;
+    memcpy(& seg[0], & hdr, sizeof(hdr));
+    uint8_t * s = (uint8_t *) & seg[sizeof(hdr)];
+    for (int i = 0; i < n; ++i)
+      s[i] = fixtureByte(sent + i);
+
+    const char * p = & seg[0];
+    size_t left = hdr.size;
+    while (left > 0) {
+      size_t piece = left;
+      if (maxWrite > 0)
+        piece = std::min(left, (size_t) (1 + rand_r(& seed) % maxWrite));
+      if (writeAll(fd, p, piece)) {
+        perror("rtltcp_fixture: write failed");
+        exit(3);
+      }
+      p += piece;
+      left -= piece;
+    }
+    sent += n;
+  }
+  close(fd);
+  close(lis);
+  unlink(path);
+  return 0;
+};
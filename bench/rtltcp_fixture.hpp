@@ -0,0 +1,31 @@
+#ifndef RTLTCP_FIXTURE_HPP
+#define RTLTCP_FIXTURE_HPP
+
+/*
+  What the stand-in rtl_tcp server (rtltcp_fixture) sends, so that a
+  client can check every byte it receives.
+
+  The stream is a series of segments, each a stream_segment_hdr_t (see
+  RTLSDRMinder.hpp) followed by I/Q sample bytes.  Sample byte i of the
+  whole stream (counting only sample bytes) is fixtureByte(i), and the
+  header of a segment whose first sample byte is i has timestamp
+  FIXTURE_T0 + (i / 2.0) / rate.
+*/
+
+#include <stdint.h>
+
+static const double FIXTURE_T0 = 1500000000.0;
+
+static inline uint8_t fixtureByte(long long i) {
+  // not periodic in any small power of two, so a slip of a byte shows up
+  return (uint8_t) (i * 131 + (i >> 8));
+};
+
+// sample bytes the fixture sends for a request of mbytes megabytes,
+// rounded up to a whole number of frames
+static inline long long fixtureSampleBytes(double mbytes) {
+  long long n = (long long) (mbytes * 1e6);
+  return n + (n & 1);
+};
+
+#endif // RTLTCP_FIXTURE_HPP
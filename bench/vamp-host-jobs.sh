@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# vamp-host-jobs.sh: measure how vamp-host's --jobs mode scales.
+#
+# Usage: bench/vamp-host-jobs.sh [OPTION VALUE]* PLUGIN INFILE [JOBS ...]
+#
+# Runs vamp-host (from this directory's parent, or VAMP_HOST if set) on
+# INFILE once for each number of jobs in JOBS (default: 1 2 4 8), and
+# prints the wall time and the speedup over the first run.  Options
+# with values, such as -a PARNAME=PARVAL or --overlap SECS, are passed
+# to vamp-host.  The output
+# of each run is compared with that of the first, as sharding must not
+# change the features reported.
+#
+# For a meaningful curve, INFILE should take at least several seconds
+# with one job, and the machine should have at least as many cores as
+# the largest number of jobs.  A plugin whose output depends on more
+# than one block of history needs --overlap to give the same output
+# with more than one job.
+
+VAMP_HOST=${VAMP_HOST:-$(dirname "$0")/../vamp-host}
+
+ARGS=""
+while [ $# -gt 1 ] && [ "${1#-}" != "$1" ]; do
+    ARGS="$ARGS $1 $2"
+    shift 2
+done
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 [OPTION VALUE]* PLUGIN INFILE [JOBS ...]" >&2
+    exit 1
+fi
+PLUGIN=$1
+INFILE=$2
+shift 2
+JOBS=${*:-1 2 4 8}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+echo "$(nproc) cores; $PLUGIN on $INFILE"
+echo "jobs  seconds  speedup  output"
+BASE=""
+for J in $JOBS; do
+    START=$(date +%s.%N)
+    if ! "$VAMP_HOST" $ARGS -j "$J" "$PLUGIN" "$INFILE" -o "$TMP/out.$J" 2>"$TMP/err.$J"; then
+        echo "vamp-host failed with -j $J:" >&2
+        cat "$TMP/err.$J" >&2
+        exit 2
+    fi
+    END=$(date +%s.%N)
+    SECS=$(awk "BEGIN {print $END - $START}")
+    if [ -z "$BASE" ]; then
+        BASE=$SECS
+        BASEOUT=$TMP/out.$J
+    fi
+    if cmp -s "$BASEOUT" "$TMP/out.$J"; then
+        SAME=same
+    else
+        SAME=DIFFERENT
+    fi
+    awk "BEGIN {printf \"%4d  %7.2f  %7.2f  %s\\n\", $J, $SECS, $BASE / $SECS, \"$SAME\"}"
+done
@@ -0,0 +1,129 @@
+/*
+  xcorr_bench: check and time CrossCorrelator on a signal whose delay
+  between channels is known.
+
+  Usage: xcorr_bench [BLOCK_FRAMES [MAX_LAG [SECONDS]]]
+
+  For each of several delays from -(MAX_LAG - 1) to MAX_LAG - 1 frames,
+  makes SECONDS (default 10) of two-channel data at 48000 frames per
+  second: white noise on channel 0, and the same noise delayed by that
+  many frames on channel 1.  The data are passed to a CrossCorrelator
+  with BLOCK_FRAMES (default 4096) frames per block and MAX_LAG (default
+  64) in batches of 1000 frames, as a device would.  Each line of output
+  is checked: the lag must be within 0.05 frames of the delay, the
+  strength above 0.99, and the timestamp that of the block's first
+  frame.
+
+  Prints the CPU time per block and the fraction of real time used.
+  Exits with status 0 only if every line was as expected.
+*/
+
+#include "CrossCorrelator.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static const int RATE = 48000;
+static const int BATCH_FRAMES = 1000;
+static const double T0 = 1500000000.0;
+
+// checks each line of a correlator's output as it is queued
+class CheckingListener : public Pollable {
+public:
+  double delay;            // expected lag, in frames
+  double firstTimestamp;   // expected timestamp of the first block
+  double blockSeconds;     // expected time between blocks
+  long lines, errors;
+  CheckingListener(const string &label) : Pollable(label), lines(0), errors(0) {};
+  string toJSON() {return "{}";};
+  bool queueOutput(const char * p, uint32_t len, double timestamp) {
+    string line(p, len);
+    size_t c1 = line.find(','), c2 = line.find(',', c1 + 1), c3 = line.find(',', c2 + 1);
+    if (c3 == string::npos) {
+      ++errors;
+      return true;
+    }
+    double ts = atof(line.c_str() + c1 + 1);
+    double lag = atof(line.c_str() + c2 + 1);
+    double strength = atof(line.c_str() + c3 + 1);
+    if (fabs(ts - (firstTimestamp + lines * blockSeconds)) > 1e-4 || fabs(lag - delay) > 0.05 || strength < 0.99) {
+      if (errors < 5)
+        fprintf(stderr, "xcorr_bench: delay %g: unexpected line %s", delay, line.c_str());
+      ++errors;
+    }
+    ++lines;
+    return true;
+  };
+};
+
+static double threadCPU() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, & ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+};
+
+int main(int argc, char *argv[]) {
+  int blockFrames = argc > 1 ? atoi(argv[1]) : 4096;
+  int maxLag = argc > 2 ? atoi(argv[2]) : 64;
+  double seconds = argc > 3 ? atof(argv[3]) : 10;
+  try {
+    CrossCorrelator::checkSettings(blockFrames, maxLag);
+  } catch (std::runtime_error e) {
+    fprintf(stderr, "xcorr_bench: %s\n", e.what());
+    exit(1);
+  }
+  int frames = (int) (seconds * RATE);
+  if (maxLag < 2 || frames < blockFrames + 2 * maxLag) {
+    fprintf(stderr, "Usage: xcorr_bench [BLOCK_FRAMES [MAX_LAG [SECONDS]]]; MAX_LAG must be at least 2, and SECONDS hold a block\n");
+    exit(1);
+  }
+
+  // noise, with maxLag frames to spare at each end
+  std::vector < float > noise(frames + 2 * maxLag);
+  srandom(1);
+  for (size_t i = 0; i < noise.size(); ++i)
+    noise[i] = (int) (random() % 65535) - 32767;
+
+  CheckingListener * out = new CheckingListener("xcorr_bench_out");
+  int delays[] = {0, 1, 7, -12, maxLag / 2, -(maxLag - 1), maxLag - 1};
+  int numDelays = sizeof(delays) / sizeof(delays[0]);
+  std::vector < float > buf(2 * frames);
+  long blocks = 0;
+  long errors = 0;
+  double cpu = 0;
+
+  for (int d = 0; d < numDelays; ++d) {
+    for (int i = 0; i < frames; ++i) {
+      buf[2 * i] = noise[maxLag + i];
+      buf[2 * i + 1] = noise[maxLag + i - delays[d]];
+    }
+    char label[32];
+    snprintf(label, sizeof(label), "xc%d", d);
+    CrossCorrelator * xc = new CrossCorrelator(label, "bench", RATE, 0, 1, 32767, blockFrames, maxLag);
+    xc->addOutputListener(out->label);
+    out->delay = delays[d];
+    out->firstTimestamp = T0 + (double) maxLag / RATE;
+    out->blockSeconds = (double) blockFrames / RATE;
+    out->lines = out->errors = 0;
+
+    double t = threadCPU();
+    for (int i = 0; i < frames; i += BATCH_FRAMES)
+      xc->handleData(std::min(BATCH_FRAMES, frames - i), & buf[2 * i], 2, T0 + (double) i / RATE);
+    cpu += threadCPU() - t;
+
+    long expected = (frames - 2 * maxLag) / blockFrames;
+    if (out->lines != expected) {
+      fprintf(stderr, "xcorr_bench: delay %d: %ld blocks, expected %ld\n", delays[d], out->lines, expected);
+      ++errors;
+    }
+    blocks += out->lines;
+    errors += out->errors;
+    Pollable::remove(label);
+  }
+
+  printf("%ld blocks of %d frames, max lag %d: %.1f us CPU per block (%.4f of real time); %ld errors\n",
+         blocks, blockFrames, maxLag, cpu / blocks * 1e6, cpu / (numDelays * seconds), errors);
+  return errors == 0 ? 0 : 3;
+};
@@ -86,8 +86,9 @@
    + funcubedongle), timestamp precision appears to be around 1ms or
    less.
 
-   FIXME:
-   Sample format is hard-coded as S16_LE to match the funcubedongle.
+   The sample format defaults to S16_LE to match the funcubedongle,
+   but devices can also be captured natively as S24_3LE, S32_LE or
+   FLOAT_LE.
 
  */
 
@@ -136,6 +137,8 @@ using Vamp::HostExt::PluginInputDomainAdapter;
 #include "Pollable.hpp"
 #include "VampAlsaHost.hpp"
 #include "TCPListener.hpp"
+#include "FFTPlanCache.hpp"
+#include "Config.hpp"
 
 static VampAlsaHost *host;
 
@@ -162,7 +165,7 @@ usage(string name) {
         "which is licensed under GNU GPL V2.0\n"
          << name << " is freely redistributable under GNU GPL V2.0 or later\n\n"
 
-        "Usage:\n" << name << " [-q] [-s SOCKNAME] &\n"
+        "Usage:\n" << name << " [-q] [-s SOCKNAME] [-w WISDOMFILE] [-c CONFIGFILE] [-r SNAPSHOTFILE] &\n"
         "    -- Runs a server which listens and replies to commands via\n"
         "       unix domain socket SOCKNAME, which is created in /tmp\n"
         "       SOCKNAME defaults to " << serverSocketName << std::endl <<
@@ -170,10 +173,33 @@ usage(string name) {
 
         "    Specifying '-q' tells the server not to print the welcome message to clients.\n\n"
 
+        "    WISDOMFILE is where FFTW wisdom is kept, so that FFT plans made by one run are\n"
+        "       available immediately to the next.  It defaults to " << FFTPlanCache::DEFAULT_WISDOM_FILE << "\n"
+        "       Specifying '-w \"\"' disables saving and loading wisdom.\n\n"
+
+        "    CONFIGFILE is a JSON file of devices to open, plugins to attach and other commands to\n"
+        "       run at startup, before any client connects; see Config.hpp for its format.  Devices\n"
+        "       are opened in parallel.  Problems with individual devices, plugins or commands are\n"
+        "       reported on stderr; a file which can't be read or parsed is fatal.\n\n"
+
+        "    SNAPSHOTFILE is where the server saves its devices, plugins and raw file writers when it\n"
+        "       exits (on SIGTERM, SIGINT or the quit command), and from which it restores them at startup,\n"
+        "       so that a restarted server carries on without being sent any commands.  It is in the same\n"
+        "       format as CONFIGFILE, and if it exists, it is used instead of CONFIGFILE.  A snapshot can\n"
+        "       also be saved at any time with the snapshot command.\n\n"
+
         "    The server accepts the following commands on SOCKNAME:\n\n"
          << VampAlsaHost::commandHelp;
 }
 
+// SIGTERM and SIGINT only ask the main loop to stop, so that the
+// snapshot is saved from there rather than from a signal handler
+
+void requestStop (int p)
+{
+    VampAlsaHost::stopSignal = p;
+}
+
 void terminate (int p)
 {
 
@@ -192,20 +218,28 @@ main(int argc, char **argv)
     enum {
         COMMAND_HELP = 'h',
         COMMAND_SOCKET_NAME = 's',
-        COMMAND_QUIET = 'q'
+        COMMAND_QUIET = 'q',
+        COMMAND_WISDOM_FILE = 'w',
+        COMMAND_CONFIG_FILE = 'c',
+        COMMAND_RESTORE_FILE = 'r'
   };
 
     int option_index;
-    static const char short_options[] = "hs:q";
+    static const char short_options[] = "hs:qw:c:r:";
     static const struct option long_options[] = {
         {"help", 0, 0, COMMAND_HELP},
         {"socket", 1, 0, COMMAND_SOCKET_NAME},
         {"quiet", 0, 0, COMMAND_QUIET},
+        {"wisdom", 1, 0, COMMAND_WISDOM_FILE},
+        {"config", 1, 0, COMMAND_CONFIG_FILE},
+        {"restore", 1, 0, COMMAND_RESTORE_FILE},
         {0, 0, 0, 0}
     };
 
     int c;
     bool quiet = false;
+    string wisdomFile = FFTPlanCache::DEFAULT_WISDOM_FILE;
+    string configFile;
 
     while ((c = getopt_long(argc, argv, short_options, long_options, &option_index)) != -1) {
         switch (c) {
@@ -226,6 +260,15 @@ main(int argc, char **argv)
         case COMMAND_QUIET:
             quiet = true;
             break;
+        case COMMAND_WISDOM_FILE:
+            wisdomFile = string(optarg);
+            break;
+        case COMMAND_CONFIG_FILE:
+            configFile = string(optarg);
+            break;
+        case COMMAND_RESTORE_FILE:
+            Config::snapshotFile = string(optarg);
+            break;
         default:
             usage(appname);
             exit(1);
@@ -252,22 +295,54 @@ main(int argc, char **argv)
 
     // handle signals gracefully
 
-    signal(SIGTERM, terminate);
-    signal(SIGINT, terminate);
+    signal(SIGTERM, requestStop);
+    signal(SIGINT, requestStop);
     signal(SIGSEGV, terminate);
     signal(SIGILL, terminate);
     signal(SIGFPE, terminate);
     signal(SIGABRT, terminate);
 
+    // load any FFTW wisdom from previous runs
+
+    FFTPlanCache::setWisdomFile(wisdomFile);
+
     ostringstream label("Socket:", std::ios_base::app);
     label << serverSocketName;
     host = new VampAlsaHost();
     new TCPListener(serverSocketName, label.str(), quiet);
+
+    // set up devices and plugins from any snapshot or config file; a
+    // snapshot which can't be read is not fatal, since the supervisor
+    // restarting us can't fix it
+
+    if (Config::snapshotFile.length() > 0 && access(Config::snapshotFile.c_str(), F_OK) == 0) {
+        try {
+            double t0 = VampAlsaHost::now(true);
+            int errors = Config::load(Config::snapshotFile);
+            std::cerr << "restored from " << Config::snapshotFile << " in " << VampAlsaHost::now(true) - t0
+                      << " s, with " << errors << " errors" << std::endl;
+            configFile = "";
+        } catch (std::runtime_error e) {
+            std::cerr << "error: " << e.what() << std::endl;
+        }
+    }
+    if (configFile.length() > 0) {
+        try {
+            Config::load(configFile);
+        } catch (std::runtime_error e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            std::cerr.flush();
+            exit(4);
+        }
+    }
     int rv = 0;
     try {
         rv = host->run();
     } catch (std::runtime_error e) {
         std::cerr << "vamp-alsa-host terminated\nWhy: " << e.what();
     };
+    Config::saveSnapshot();
+    if (VampAlsaHost::stopSignal)
+        terminate(VampAlsaHost::stopSignal);
     exit(rv);
 }
@@ -41,7 +41,7 @@
  * now has a lot of options and includes a lot of code to handle the
  * various useful listing modes it supports.
  *
- * However, the runPlugin function still contains a reasonable
+ * However, the runPlugins function still contains a reasonable
  * implementation of a fairly generic Vamp plugin host capable of
  * evaluating a given output on a given plugin for a sound file read
  * via libsndfile.
@@ -61,13 +61,27 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
 #include <set>
 #include <sndfile.h>
 
 #include <cstring>
 #include <cstdlib>
+#include <climits>
 #include <vector>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/barrier.hpp>
+#include <glob.h>
+#include <ctime>
+
 #include "system.h"
 
 #include <cmath>
@@ -90,15 +104,32 @@ enum Verbosity {
     PluginInformationDetailed
 };
 
-void printFeatures(int, int, int, Plugin::FeatureSet, ofstream *, bool frames);
+void printFeatures(sf_count_t, int, int, Plugin::FeatureSet, ostream &, bool frames,
+                   sf_count_t keepFrom = LLONG_MIN, sf_count_t keepTo = LLONG_MAX, double timeOffset = 0);
 void transformInput(float *, size_t);
 void fft(unsigned int, bool, double *, double *, double *, double *);
 void printPluginPath(bool verbose);
 void printPluginCategoryList();
 void enumeratePlugins(Verbosity);
 void listPluginsInLibrary(string soname);
-int runPlugin(string myname, string soname, string id, string output,
-              int outputNo, string infilename, string outfilename, bool frames, std::vector<string> paramNames, std::vector<float> paramValues);
+
+// a plugin output to compute, from a soname:plugin[:output] spec on the command line
+struct PluginSpec
+{
+    string soname;
+    string id;
+    string output;
+    int outputNo;
+    string outfilename;
+};
+
+int runPlugins(string myname, std::vector<PluginSpec> &specs,
+               string infilename, bool frames,
+               std::vector<string> paramNames, std::vector<float> paramValues,
+               int jobs, double overlap);
+int runBatch(string myname, std::vector<PluginSpec> &specs, string source,
+             string tmpl, std::vector<string> paramNames,
+             std::vector<float> paramValues, int workers);
 
 void usage(const char *name)
 {
@@ -108,8 +139,8 @@ void usage(const char *name)
         "Copyright 2006-2009 Chris Cannam and QMUL.\n"
         "Freely redistributable; published under a BSD-style license.\n\n"
         "Usage:\n\n"
-        "  " << name << " [-a PARNAME=PARVAL]* [-s] pluginlibrary[." << PLUGIN_SUFFIX << "]:plugin[:output] infile [-o out.txt]\n"
-        "  " << name << " [-a PARNAME=PARVAL]* [-s] pluginlibrary[." << PLUGIN_SUFFIX << "]:plugin infile [outputno] [-o out.txt]\n\n"
+        "  " << name << " [-a PARNAME=PARVAL]* [-j N [--overlap SECS]] [-s] pluginlibrary[." << PLUGIN_SUFFIX << "]:plugin[:output] infile [-o out.txt]\n"
+        "  " << name << " [-a PARNAME=PARVAL]* [-j N [--overlap SECS]] [-s] pluginlibrary[." << PLUGIN_SUFFIX << "]:plugin infile [outputno] [-o out.txt]\n\n"
         "    -- Load plugin id \"plugin\" from \"pluginlibrary\" and run it on the\n"
         "       raw audio data from infile, which has embedded timestamps, retrieving the named \"output\", or output\n"
         "       number \"outputno\" (the first output by default) and dumping it to\n"
@@ -122,6 +153,30 @@ void usage(const char *name)
         "       with time in seconds.\n\n"
         "       The -a ('assign') option can occur zero or more times, and serves to\n"
         "       set values for the plugin's parameters.\n\n"
+        "       The -j ('jobs') option, also spelled --jobs, splits infile into N\n"
+        "       shards which are processed in parallel by separate instances of the\n"
+        "       plugin.  Each shard also processes one block before and after its\n"
+        "       range, plus SECS seconds if --overlap is given, so that plugins with\n"
+        "       longer memory see the same data near shard boundaries as they would\n"
+        "       in a single pass.  Features are merged in timestamp order, with each\n"
+        "       feature reported only by the shard that owns its timestamp.\n\n"
+        "  " << name << " [-a [PLUGIN:]PARNAME=PARVAL]* [-j N [--overlap SECS]] [-s] pluginlibrary:plugin[:output],pluginlibrary:plugin[:output][,...] infile -o out\n\n"
+        "    -- Run several plugins in a single pass over infile, each on its own\n"
+        "       thread and with its own block and step sizes.  The results for each\n"
+        "       are written to \"out.PLUGIN.OUTPUT\", where OUTPUT is 0 if not given.\n"
+        "       A parameter assignment of the form PLUGIN:PARNAME=PARVAL applies\n"
+        "       only to the plugin whose id is PLUGIN.\n\n"
+        "  " << name << " [-a [PLUGIN:]PARNAME=PARVAL]* [-j N] --batch FILES [--template PATH_TEMPLATE] pluginlibrary:plugin[:output][,...] [outputno] [-o out]\n\n"
+        "    -- Run the plugin(s) on each of many input files, using N worker threads,\n"
+        "       each of which keeps its plugin instances loaded from one file to the next.\n"
+        "       FILES is either a glob pattern (quote it to protect it from the shell),\n"
+        "       or the name of a file listing one input file per line (\"-\" for stdin).\n"
+        "       Results are written in the order of the input files, with times offset\n"
+        "       by the start time of each file, taken from its name.  PATH_TEMPLATE is\n"
+        "       the template given to vamp-alsa-host's rawFile command when the files\n"
+        "       were recorded; without it, the first date and time in the file name of\n"
+        "       the form YYYY-MM-DD?HH?MM?SS[.FFF] is used.  Times are UTC.\n"
+        "       The -s option can't be used in batch mode.\n\n"
         "  " << name << " -l\n"
         "  " << name << " --list\n\n"
         "    -- List the plugin libraries and Vamp plugins in the library search path\n"
@@ -207,10 +262,42 @@ int main(int argc, char **argv)
     std::vector<float> paramValues;
 
     bool useFrames = false;
+    int jobs = 1;
+    double overlap = 0;
+    string batch;
+    string tmpl;
     
     int base = 1;
     while (base < argc) {
-        if (0 == strcmp(argv[base], "-a")) {
+        if (0 == strcmp(argv[base], "--batch")) {
+            ++base;
+            if (base == argc)
+                usage(name);
+            batch = argv[base];
+            ++base;
+        } else if (0 == strcmp(argv[base], "--template")) {
+            ++base;
+            if (base == argc)
+                usage(name);
+            tmpl = argv[base];
+            ++base;
+        } else if (0 == strcmp(argv[base], "-j") || 0 == strcmp(argv[base], "--jobs")) {
+            ++base;
+            if (base == argc)
+                usage(name);
+            jobs = atoi(argv[base]);
+            if (jobs < 1)
+                usage(name);
+            ++base;
+        } else if (0 == strcmp(argv[base], "--overlap")) {
+            ++base;
+            if (base == argc)
+                usage(name);
+            overlap = atof(argv[base]);
+            if (overlap < 0)
+                usage(name);
+            ++base;
+        } else if (0 == strcmp(argv[base], "-a")) {
             ++base;
             if (base == argc)
                 usage(name);
@@ -227,21 +314,28 @@ int main(int argc, char **argv)
         }
     }
 
+    // in batch mode, there is no infile argument
+
+    int numFileArgs = batch == "" ? 1 : 0;
+
+    if (base + numFileArgs >= argc) usage(name);
+
     if (!strcmp(argv[base], "-s")) {
+        // frame numbers are meaningless across files
+        if (batch != "") usage(name);
         useFrames = true;
-        base = 2;
+        ++base;
+        if (base + 1 >= argc) usage(name);
     }
 
-    string soname = argv[base];
-    string infilename = argv[base+1];
-    string plugid = "";
-    string output = "";
+    string specs = argv[base];
+    string infilename = numFileArgs ? argv[base+1] : "";
     int outputNo = -1;
     string outfilename;
 
-    if (argc >= base+3) {
+    if (argc >= base + numFileArgs + 2) {
 
-        int idx = base+2;
+        int idx = base + numFileArgs + 1;
 
         if (isdigit(*argv[idx])) {
             outputNo = atoi(argv[idx++]);
@@ -256,286 +350,1186 @@ int main(int argc, char **argv)
         }
     }
 
+    // split the comma-separated list of soname:plugin[:output] specs
+
+    std::vector<PluginSpec> plugins;
+    string::size_type start = 0;
+    for (;;) {
+        string::size_type comma = specs.find(',', start);
+        string soname = specs.substr(start, comma == string::npos ? string::npos : comma - start);
+        PluginSpec ps;
+        ps.outputNo = -1;
+
+        string::size_type sep = soname.find(':');
+
+        if (sep != string::npos) {
+            ps.id = soname.substr(sep + 1);
+            soname = soname.substr(0, sep);
+
+            sep = ps.id.find(':');
+            if (sep != string::npos) {
+                ps.output = ps.id.substr(sep + 1);
+                ps.id = ps.id.substr(0, sep);
+            }
+        }
+        ps.soname = soname;
+
+        if (ps.id == "") {
+            usage(name);
+        }
+        plugins.push_back(ps);
+        if (comma == string::npos)
+            break;
+        start = comma + 1;
+    }
+
+    if (plugins.size() == 1) {
+        PluginSpec &ps = plugins[0];
+        if (ps.output != "" && outputNo != -1) {
+            usage(name);
+        }
+        ps.outputNo = outputNo;
+        if (ps.output == "" && ps.outputNo == -1) {
+            ps.outputNo = 0;
+        }
+        ps.outfilename = outfilename;
+    } else {
+        // each plugin gets its own output file
+        if (outfilename == "" || outputNo != -1) {
+            usage(name);
+        }
+        for (size_t i = 0; i < plugins.size(); ++i) {
+            PluginSpec &ps = plugins[i];
+            if (ps.output == "") {
+                ps.outputNo = 0;
+            }
+            ps.outfilename = outfilename + "." + ps.id + "." + (ps.output == "" ? "0" : ps.output);
+        }
+    }
+
     cerr << endl << name << ": Running..." << endl;
 
-    cerr << "Reading file: \"" << infilename << "\", writing to ";
+    if (batch == "") {
+        cerr << "Reading file: \"" << infilename << "\", writing to ";
+    } else {
+        cerr << "Reading files from: \"" << batch << "\", writing to ";
+    }
     if (outfilename == "") {
         cerr << "standard output" << endl;
-    } else {
+    } else if (plugins.size() == 1) {
         cerr << "\"" << outfilename << "\"" << endl;
+    } else {
+        cerr << "\"" << outfilename << ".*\"" << endl;
+    }
+
+    if (batch != "") {
+        return runBatch(name, plugins, batch, tmpl, paramNames, paramValues, jobs);
     }
 
-    string::size_type sep = soname.find(':');
+    return runPlugins(name, plugins, infilename, useFrames,
+                      paramNames, paramValues, jobs, overlap);
+}
 
-    if (sep != string::npos) {
-        plugid = soname.substr(sep + 1);
-        soname = soname.substr(0, sep);
 
-        sep = plugid.find(':');
-        if (sep != string::npos) {
-            output = plugid.substr(sep + 1);
-            plugid = plugid.substr(0, sep);
-        }
-    }
+/*
+ * Supplies overlapping blocks of de-interleaved samples from the
+ * input file to one or more plugins, each with its own block and
+ * step sizes, stepping forward through the file.  Each frame is read
+ * and decoded only once: frames are read from libsndfile in large
+ * chunks into a per-channel sliding window, from which blocks are
+ * copied into each plugin's buffers.  The window keeps only those
+ * frames still needed by some plugin.
+ *
+ * For 16-bit PCM .WAV files, such as those written by vamp-alsa-host,
+ * the file is instead mapped into memory, and samples are converted
+ * straight from the mapping into the plugins' buffers.
+ */
+
+class BlockReader
+{
+public:
+    static const int READ_CHUNK_FRAMES = 65536;
+
+    BlockReader(SNDFILE *sndfile, const SF_INFO &sfinfo,
+                string filename, int maxBlockSize);
+    ~BlockReader();
+
+    // Begin reading at frame start.  Returns -1 on error.
+    int begin(sf_count_t start);
+
+    // Discard frames before keepFrom, then read another chunk from
+    // the file.  Returns -1 on error.
+    int fill(sf_count_t keepFrom);
+
+    // Is the block of blockSize frames beginning at frame start
+    // available?  Blocks that extend past the end of the file are
+    // available once the end has been read.
+    bool has(sf_count_t start, int blockSize) {
+        return samples || start + blockSize <= winStart + winLen || readPos >= frames;
+    };
+
+    // Fill plugbuf with the blockSize frames beginning at frame
+    // start, padding with zeroes past the end of the file.  Returns
+    // the number of frames taken from the file.
+    int copyBlock(sf_count_t start, int blockSize, float **plugbuf);
+
+    sf_count_t getFrames() { return frames; }
+    sf_count_t getReadPos() { return samples ? frames : readPos; }
+    bool isMapped() { return samples != 0; }
+
+protected:
+    SNDFILE *sndfile;
+    sf_count_t frames;              // frames in file
+    int channels;
 
-    if (plugid == "") {
-        usage(name);
+    void *mapped;                   // mapping of whole file, if any
+    size_t mappedLen;               // size of mapping, in bytes
+    const int16_t *samples;         // start of sample data in mapping, if any
+
+    vector<float> filebuf;          // interleaved frames from sndfile
+    vector< vector<float> > window; // de-interleaved frames, one vector per channel
+    sf_count_t winStart;            // file frame corresponding to window[c][0]
+    int winLen;                     // number of frames in window
+    sf_count_t readPos;             // file frame that sndfile will read next
+
+    bool mapWav(string filename);
+};
+
+const int BlockReader::READ_CHUNK_FRAMES;
+
+BlockReader::BlockReader(SNDFILE *sndfile, const SF_INFO &sfinfo,
+                         string filename, int maxBlockSize) :
+    sndfile(sndfile),
+    frames(sfinfo.frames),
+    channels(sfinfo.channels),
+    mapped(0),
+    mappedLen(0),
+    samples(0),
+    winStart(0),
+    winLen(0),
+    readPos(0)
+{
+    if ((sfinfo.format & SF_FORMAT_TYPEMASK) == SF_FORMAT_WAV &&
+        (sfinfo.format & SF_FORMAT_SUBMASK) == SF_FORMAT_PCM_16 &&
+        mapWav(filename)) {
+        return;
+    }
+    filebuf.resize(READ_CHUNK_FRAMES * channels);
+    window.resize(channels);
+    for (int c = 0; c < channels; ++c) {
+        window[c].resize(maxBlockSize + READ_CHUNK_FRAMES);
     }
+}
+
+BlockReader::~BlockReader()
+{
+    if (mapped) munmap(mapped, mappedLen);
+}
+
+bool
+BlockReader::mapWav(string filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
 
-    if (output != "" && outputNo != -1) {
-        usage(name);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 12) {
+        close(fd);
+        return false;
+    }
+    mappedLen = st.st_size;
+    mapped = mmap(0, mappedLen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        mapped = 0;
+        return false;
     }
 
-    if (output == "" && outputNo == -1) {
-        outputNo = 0;
+    // walk the RIFF chunks, looking for a 16-bit PCM format chunk
+    // followed by the data chunk; we assume a little-endian host
+
+    const char *p = (const char *) mapped;
+    bool fmtOK = false;
+
+    if (!memcmp(p, "RIFF", 4) && !memcmp(p + 8, "WAVE", 4)) {
+        size_t off = 12;
+        while (off + 8 <= mappedLen) {
+            uint32_t size;
+            memcpy(&size, p + off + 4, 4);
+            if (!memcmp(p + off, "fmt ", 4) && off + 24 <= mappedLen) {
+                uint16_t fmtCode, numChan, bits;
+                memcpy(&fmtCode, p + off + 8, 2);
+                memcpy(&numChan, p + off + 10, 2);
+                memcpy(&bits, p + off + 22, 2);
+                fmtOK = fmtCode == 1 && numChan == channels && bits == 16;
+            } else if (!memcmp(p + off, "data", 4)) {
+                // the data chunk size isn't reliable in a file whose
+                // recording was interrupted, so we also limit the
+                // frame count by the file size
+                off += 8;
+                if (!fmtOK || (off & 1)) break;
+                samples = (const int16_t *) (p + off);
+                frames = std::min(frames, (sf_count_t) ((mappedLen - off) / (2 * channels)));
+                madvise(mapped, mappedLen, MADV_SEQUENTIAL);
+                return true;
+            }
+            off += 8 + size + (size & 1);
+        }
     }
 
-    return runPlugin(name, soname, plugid, output, outputNo,
-                     infilename, outfilename, useFrames, paramNames, paramValues);
+    munmap(mapped, mappedLen);
+    mapped = 0;
+    return false;
 }
 
-
-int runPlugin(string myname, string soname, string id,
-              string output, int outputNo, string infilename,
-              string outfilename, bool useFrames,
-              std::vector<string> paramNames, std::vector<float> paramValues)
+int
+BlockReader::begin(sf_count_t start)
 {
-    PluginLoader *loader = PluginLoader::getInstance();
+    if (samples) return 0;
+    if (start != readPos && sf_seek(sndfile, start, SEEK_SET) < 0) {
+        cerr << "ERROR: sf_seek failed: " << sf_strerror(sndfile) << endl;
+        return -1;
+    }
+    winStart = readPos = start;
+    winLen = 0;
+    return 0;
+}
 
-    PluginLoader::PluginKey key = loader->composePluginKey(soname, id);
+int
+BlockReader::fill(sf_count_t keepFrom)
+{
+    if (samples || readPos >= frames) return 0;
 
-    SNDFILE *sndfile;
-    SF_INFO sfinfo;
-    memset(&sfinfo, 0, sizeof(SF_INFO));
+    if (keepFrom > winStart) {
+        int drop = std::min(keepFrom - winStart, (sf_count_t) winLen);
+        winLen -= drop;
+        for (int c = 0; c < channels; ++c) {
+            memmove(&window[c][0], &window[c][drop], winLen * sizeof(float));
+        }
+        winStart += drop;
+    }
 
-    sndfile = sf_open(infilename.c_str(), SFM_READ, &sfinfo);
-    if (!sndfile) {
-	cerr << myname << ": ERROR: Failed to open input file \""
-             << infilename << "\": " << sf_strerror(sndfile) << endl;
-	return 1;
+    int want = std::min(READ_CHUNK_FRAMES, int(window[0].size()) - winLen);
+    sf_count_t got = sf_readf_float(sndfile, &filebuf[0], want);
+    if (got < 0) {
+        cerr << "ERROR: sf_readf_float failed: " << sf_strerror(sndfile) << endl;
+        return -1;
+    }
+    if (got == 0) {
+        // file is shorter than its header claims
+        frames = readPos;
+        return 0;
     }
+    for (int c = 0; c < channels; ++c) {
+        float *dst = &window[c][winLen];
+        for (sf_count_t j = 0; j < got; ++j) {
+            dst[j] = filebuf[j * channels + c];
+        }
+    }
+    winLen += got;
+    readPos += got;
+    return 0;
+}
 
-    ofstream *out = 0;
-    if (outfilename != "") {
-        out = new ofstream(outfilename.c_str(), ios::out);
-        if (!*out) {
-            cerr << myname << ": ERROR: Failed to open output file \""
-                 << outfilename << "\" for writing" << endl;
-            delete out;
-            return 1;
+int
+BlockReader::copyBlock(sf_count_t start, int blockSize, float **plugbuf)
+{
+    int count;
+
+    if (samples) {
+        count = std::max((sf_count_t) 0, std::min((sf_count_t) blockSize, frames - start));
+        for (int c = 0; c < channels; ++c) {
+            const int16_t *src = samples + start * channels + c;
+            float *dst = plugbuf[c];
+            for (int j = 0; j < count; ++j) {
+                dst[j] = src[j * channels] * (1.0f / 32768.0f);
+            }
+            for (int j = count; j < blockSize; ++j) {
+                dst[j] = 0.0f;
+            }
         }
+        return count;
     }
 
-    Plugin *plugin = loader->loadPlugin
-        (key, sfinfo.samplerate, PluginLoader::ADAPT_ALL_SAFE);
-    if (!plugin) {
-        cerr << myname << ": ERROR: Failed to load plugin \"" << id
-             << "\" from library \"" << soname << "\"" << endl;
-        sf_close(sndfile);
-        if (out) {
-            out->close();
-            delete out;
+    int offset = start - winStart;
+    count = std::max(0, std::min(blockSize, winLen - offset));
+    for (int c = 0; c < channels; ++c) {
+        if (count > 0) {
+            memcpy(plugbuf[c], &window[c][offset], count * sizeof(float));
+        }
+        for (int j = count; j < blockSize; ++j) {
+            plugbuf[c][j] = 0.0f;
         }
-        return 1;
     }
+    return count;
+}
 
-    // assign parameter values
+/*
+ * One plugin instance, stepping through part of the input file.
+ *
+ * With --jobs N > 1, the file is split into N shards, each with its
+ * own instance of every plugin.  A runner also processes some context
+ * before and after its shard, so that the plugin's state is warmed
+ * up at the start, and so that features which straddle the end are
+ * still detected; but it keeps only those features whose frames lie
+ * within [keepFrom, keepTo).  Adjacent shards share these boundaries,
+ * so concatenating the output of all shards gives each feature
+ * exactly once, in timestamp order.
+ */
 
-    for (size_t i=0; i < paramNames.size(); ++i)
-        plugin->setParameter(paramNames[i], paramValues[i]);
+struct Runner
+{
+    Plugin *plugin;
+    int outputNo;
+    int blockSize;
+    int stepSize;
+    int sampleRate;
+    RealTime adjustment;
+    bool useFrames;
+    double timeOffset;      // seconds added to feature times; in batch mode, the start time of the file
+    sf_count_t next;        // first frame of next block to process
+    sf_count_t to;          // don't process blocks starting at or after this frame
+    sf_count_t keepFrom;    // keep features at or after this frame...
+    sf_count_t keepTo;      // ...and before this frame
+    bool last;              // is this runner's shard the last?  If so, it reports the plugin's remaining features
+    ostream *out;           // where features are printed
+    vector< vector<float> > buf;  // per-channel input buffers for plugin
+    vector<float *> plugbuf;      // pointers into buf
+
+    bool done(BlockReader &reader) {
+        return next >= to || next >= reader.getFrames();
+    };
+
+    // process all steps whose blocks are available from reader
+    void processAvailable(BlockReader &reader);
+
+    // print the plugin's remaining features, if this is the last shard
+    void finish(BlockReader &reader);
+};
 
-    cerr << "Running plugin: \"" << plugin->getIdentifier() << "\"..." << endl;
+void
+Runner::processAvailable(BlockReader &reader)
+{
+    while (!done(reader) && reader.has(next, blockSize)) {
 
-    // Note that the following would be much simpler if we used a
-    // PluginBufferingAdapter as well -- i.e. if we had passed
-    // PluginLoader::ADAPT_ALL to loader->loadPlugin() above, instead
-    // of ADAPT_ALL_SAFE.  Then we could simply specify our own block
-    // size, keep the step size equal to the block size, and ignore
-    // the plugin's bleatings.  However, there are some issues with
-    // using a PluginBufferingAdapter that make the results sometimes
-    // technically different from (if effectively the same as) the
-    // un-adapted plugin, so we aren't doing that here.  See the
-    // PluginBufferingAdapter documentation for details.
+        reader.copyBlock(next, blockSize, &plugbuf[0]);
 
-    int blockSize = plugin->getPreferredBlockSize();
-    int stepSize = plugin->getPreferredStepSize();
+        RealTime rt = RealTime::frame2RealTime(next, sampleRate);
 
-    if (blockSize == 0) {
-        blockSize = 1024;
+        printFeatures
+            (RealTime::realTime2Frame(rt + adjustment, sampleRate),
+             sampleRate, outputNo, plugin->process(&plugbuf[0], rt),
+             *out, useFrames, keepFrom, keepTo, timeOffset);
+
+        next += stepSize;
     }
-    if (stepSize == 0) {
-        if (plugin->getInputDomain() == Plugin::FrequencyDomain) {
-            stepSize = blockSize/2;
-        } else {
-            stepSize = blockSize;
+}
+
+void
+Runner::finish(BlockReader &reader)
+{
+    if (!last) return;
+
+    RealTime rt = RealTime::frame2RealTime(reader.getFrames(), sampleRate);
+
+    printFeatures(RealTime::realTime2Frame(rt + adjustment, sampleRate),
+                  sampleRate, outputNo,
+                  plugin->getRemainingFeatures(), *out, useFrames,
+                  keepFrom, keepTo, timeOffset);
+}
+
+struct Shard
+{
+    vector<Runner> runners; // one for each plugin
+    bool showProgress;      // report progress to stderr?
+    int returnValue;
+};
+
+void runShard(string infilename, Shard &shard);
+void runShardOn(SNDFILE *sndfile, const SF_INFO &sfinfo, string infilename, Shard &shard);
+
+// the plugin loader is not thread-safe
+static boost::mutex loaderMutex;
+
+/*
+ * Load and configure one instance of the plugin for spec ps, setting
+ * its parameters and initialising it.  If blockSize and stepSize are
+ * zero, they are set from the plugin's preferences, and if verbose,
+ * details are reported to stderr.  Returns 0 on error.
+ */
+
+Plugin *
+loadPlugin(string myname, const PluginSpec &ps, int sampleRate, int channels,
+           std::vector<string> paramNames, std::vector<float> paramValues,
+           int &blockSize, int &stepSize, bool verbose)
+{
+    Plugin *plugin;
+    {
+        boost::mutex::scoped_lock lock(loaderMutex);
+
+        PluginLoader *loader = PluginLoader::getInstance();
+
+        PluginLoader::PluginKey key = loader->composePluginKey(ps.soname, ps.id);
+
+        plugin = loader->loadPlugin
+            (key, sampleRate, PluginLoader::ADAPT_ALL_SAFE);
+    }
+    if (!plugin) {
+        cerr << myname << ": ERROR: Failed to load plugin \"" << ps.id
+             << "\" from library \"" << ps.soname << "\"" << endl;
+        return 0;
+    }
+
+    // assign parameter values; a parameter name of the form
+    // PLUGIN:PARNAME applies only to the plugin with that id
+
+    for (size_t i=0; i < paramNames.size(); ++i) {
+        string::size_type sep = paramNames[i].find(':');
+        if (sep == string::npos)
+            plugin->setParameter(paramNames[i], paramValues[i]);
+        else if (paramNames[i].substr(0, sep) == ps.id)
+            plugin->setParameter(paramNames[i].substr(sep + 1), paramValues[i]);
+    }
+
+    if (blockSize == 0) {
+
+        if (verbose) cerr << "Running plugin: \"" << plugin->getIdentifier() << "\"..." << endl;
+
+        // Note that the following would be much simpler if we used a
+        // PluginBufferingAdapter as well -- i.e. if we had passed
+        // PluginLoader::ADAPT_ALL to loader->loadPlugin() above, instead
+        // of ADAPT_ALL_SAFE.  Then we could simply specify our own block
+        // size, keep the step size equal to the block size, and ignore
+        // the plugin's bleatings.  However, there are some issues with
+        // using a PluginBufferingAdapter that make the results sometimes
+        // technically different from (if effectively the same as) the
+        // un-adapted plugin, so we aren't doing that here.  See the
+        // PluginBufferingAdapter documentation for details.
+
+        blockSize = plugin->getPreferredBlockSize();
+        stepSize = plugin->getPreferredStepSize();
+
+        if (blockSize == 0) {
+            blockSize = 1024;
         }
-    } else if (stepSize > blockSize) {
-        cerr << "WARNING: stepSize " << stepSize << " > blockSize " << blockSize << ", resetting blockSize to ";
-        if (plugin->getInputDomain() == Plugin::FrequencyDomain) {
-            blockSize = stepSize * 2;
-        } else {
-            blockSize = stepSize;
+        if (stepSize == 0) {
+            if (plugin->getInputDomain() == Plugin::FrequencyDomain) {
+                stepSize = blockSize/2;
+            } else {
+                stepSize = blockSize;
+            }
+        } else if (stepSize > blockSize) {
+            if (verbose) cerr << "WARNING: stepSize " << stepSize << " > blockSize " << blockSize << ", resetting blockSize to ";
+            if (plugin->getInputDomain() == Plugin::FrequencyDomain) {
+                blockSize = stepSize * 2;
+            } else {
+                blockSize = stepSize;
+            }
+            if (verbose) cerr << blockSize << endl;
         }
-        cerr << blockSize << endl;
-    }
 
-    int channels = sfinfo.channels;
+        if (verbose) {
+            cerr << "Using block size = " << blockSize << ", step size = "
+                 << stepSize << endl;
 
-    float *filebuf = new float[blockSize * channels];
-    float **plugbuf = new float*[channels];
-    for (int c = 0; c < channels; ++c) plugbuf[c] = new float[blockSize + 2];
+            // The channel queries here are for informational purposes only --
+            // a PluginChannelAdapter is being used automatically behind the
+            // scenes, and it will take case of any channel mismatch
 
-    cerr << "Using block size = " << blockSize << ", step size = "
-              << stepSize << endl;
+            int minch = plugin->getMinChannelCount();
+            int maxch = plugin->getMaxChannelCount();
+            cerr << "Plugin accepts " << minch << " -> " << maxch << " channel(s)" << endl;
+            cerr << "Sound file has " << channels << " (will mix/augment if necessary)" << endl;
+        }
+    }
 
-    // The channel queries here are for informational purposes only --
-    // a PluginChannelAdapter is being used automatically behind the
-    // scenes, and it will take case of any channel mismatch
+    if (!plugin->initialise(channels, stepSize, blockSize)) {
+        cerr << "ERROR: Plugin initialise (channels = " << channels
+             << ", stepSize = " << stepSize << ", blockSize = "
+             << blockSize << ") failed." << endl;
+        delete plugin;
+        return 0;
+    }
 
-    int minch = plugin->getMinChannelCount();
-    int maxch = plugin->getMaxChannelCount();
-    cerr << "Plugin accepts " << minch << " -> " << maxch << " channel(s)" << endl;
-    cerr << "Sound file has " << channels << " (will mix/augment if necessary)" << endl;
+    return plugin;
+}
 
-    Plugin::OutputList outputs = plugin->getOutputDescriptors();
-    Plugin::OutputDescriptor od;
+/*
+ * Load the first instance of the plugin for spec ps into runner r,
+ * choosing its block and step sizes and finding the index of the
+ * requested output.  Returns 0 on success, 1 on error.
+ */
 
-    int returnValue = 1;
-    int progress = 0;
+int
+setupRunner(string myname, const PluginSpec &ps, int sampleRate, int channels,
+            std::vector<string> paramNames, std::vector<float> paramValues,
+            bool useFrames, bool verbose, Runner &r)
+{
+    r.blockSize = r.stepSize = 0;
+    r.plugin = loadPlugin(myname, ps, sampleRate, channels,
+                          paramNames, paramValues, r.blockSize, r.stepSize, verbose);
+    if (!r.plugin) {
+        return 1;
+    }
 
-    RealTime rt;
-    PluginWrapper *wrapper = 0;
-    RealTime adjustment = RealTime::zeroTime;
+    Plugin::OutputList outputs = r.plugin->getOutputDescriptors();
+    int outputNo = ps.outputNo;
 
     if (outputs.empty()) {
 	cerr << "ERROR: Plugin has no outputs!" << endl;
-        goto done;
+        goto fail;
     }
 
     if (outputNo < 0) {
 
         for (size_t oi = 0; oi < outputs.size(); ++oi) {
-            if (outputs[oi].identifier == output) {
+            if (outputs[oi].identifier == ps.output) {
                 outputNo = oi;
                 break;
             }
         }
 
         if (outputNo < 0) {
-            cerr << "ERROR: Non-existent output \"" << output << "\" requested" << endl;
-            goto done;
+            cerr << "ERROR: Non-existent output \"" << ps.output << "\" requested" << endl;
+            goto fail;
         }
 
     } else {
 
         if (int(outputs.size()) <= outputNo) {
             cerr << "ERROR: Output " << outputNo << " requested, but plugin has only " << outputs.size() << " output(s)" << endl;
-            goto done;
+            goto fail;
         }        
     }
 
-    od = outputs[outputNo];
-    cerr << "Output is: \"" << od.identifier << "\"" << endl;
+    if (verbose) cerr << "Output is: \"" << outputs[outputNo].identifier << "\"" << endl;
+
+    r.outputNo = outputNo;
+    r.sampleRate = sampleRate;
+    r.useFrames = useFrames;
+    r.timeOffset = 0;
+    r.adjustment = RealTime::zeroTime;
+
+    {
+        PluginWrapper *wrapper = dynamic_cast<PluginWrapper *>(r.plugin);
+        if (wrapper) {
+            // See documentation for
+            // PluginInputDomainAdapter::getTimestampAdjustment
+            PluginInputDomainAdapter *ida =
+                wrapper->getWrapper<PluginInputDomainAdapter>();
+            if (ida) r.adjustment = ida->getTimestampAdjustment();
+        }
+    }
+    return 0;
 
-    if (!plugin->initialise(channels, stepSize, blockSize)) {
-        cerr << "ERROR: Plugin initialise (channels = " << channels
-             << ", stepSize = " << stepSize << ", blockSize = "
-             << blockSize << ") failed." << endl;
-        goto done;
+fail:
+    delete r.plugin;
+    r.plugin = 0;
+    return 1;
+}
+
+int runPlugins(string myname, std::vector<PluginSpec> &specs,
+               string infilename, bool useFrames,
+               std::vector<string> paramNames, std::vector<float> paramValues,
+               int jobs, double overlap)
+{
+    SNDFILE *sndfile;
+    SF_INFO sfinfo;
+    memset(&sfinfo, 0, sizeof(SF_INFO));
+
+    sndfile = sf_open(infilename.c_str(), SFM_READ, &sfinfo);
+    if (!sndfile) {
+	cerr << myname << ": ERROR: Failed to open input file \""
+             << infilename << "\": " << sf_strerror(sndfile) << endl;
+	return 1;
     }
 
-    wrapper = dynamic_cast<PluginWrapper *>(plugin);
-    if (wrapper) {
-        // See documentation for
-        // PluginInputDomainAdapter::getTimestampAdjustment
-        PluginInputDomainAdapter *ida =
-            wrapper->getWrapper<PluginInputDomainAdapter>();
-        if (ida) adjustment = ida->getTimestampAdjustment();
+    // each shard opens the file for itself
+
+    sf_close(sndfile);
+
+    int numPlugins = specs.size();
+    int channels = sfinfo.channels;
+    int returnValue = 1;
+
+    std::vector<ofstream *> outs(numPlugins, (ofstream *) 0);
+    std::vector<Runner> proto(numPlugins);  // first instance of each plugin, and its settings
+    std::vector<sf_count_t> context(numPlugins);
+    std::vector<Shard> shards;
+    std::vector<ostringstream *> bufs;
+    boost::thread_group threads;
+    sf_count_t maxContext = 0;
+
+    for (int p = 0; p < numPlugins; ++p) {
+        proto[p].plugin = 0;
     }
 
-    for (sf_count_t i = 0; i < sfinfo.frames; i += stepSize) {
+    for (int p = 0; p < numPlugins; ++p) {
+        PluginSpec &ps = specs[p];
+        Runner &r = proto[p];
 
-        int count;
+        if (ps.outfilename != "") {
+            outs[p] = new ofstream(ps.outfilename.c_str(), ios::out);
+            if (!*outs[p]) {
+                cerr << myname << ": ERROR: Failed to open output file \""
+                     << ps.outfilename << "\" for writing" << endl;
+                goto done;
+            }
+        }
 
-        if (sf_seek(sndfile, i, SEEK_SET) < 0) {
-            cerr << "ERROR: sf_seek failed: " << sf_strerror(sndfile) << endl;
-            break;
+        if (setupRunner(myname, ps, sfinfo.samplerate, channels,
+                        paramNames, paramValues, useFrames, true, r)) {
+            goto done;
         }
-        
-        if ((count = sf_readf_float(sndfile, filebuf, blockSize)) < 0) {
-            cerr << "ERROR: sf_readf_float failed: " << sf_strerror(sndfile) << endl;
-            break;
+        r.out = outs[p] ? (ostream *) outs[p] : &cout;
+
+        // context needed on each side of a shard, in frames
+
+        context[p] = r.blockSize + (sf_count_t) ceil(overlap * sfinfo.samplerate);
+        maxContext = std::max(maxContext, context[p]);
+    }
+
+    // there's no point in having shards shorter than their context
+
+    if (jobs > 1 && sfinfo.frames < jobs * maxContext) {
+        jobs = sfinfo.frames / maxContext;
+        if (jobs < 1)
+            jobs = 1;
+        cerr << "File is short, so only using " << jobs << " job(s)" << endl;
+    }
+    if (jobs > 1) {
+        cerr << "Using " << jobs << " jobs, each with " << maxContext
+             << " frame(s) of context" << endl;
+    }
+
+    // Split the file into shards of (nearly) equal numbers of frames.
+    // Each runner begins at a multiple of its step size, so that it
+    // processes the same blocks as it would in a single pass.
+
+    shards.resize(jobs);
+    for (int k = 0; k < jobs; ++k) {
+        Shard &s = shards[k];
+        sf_count_t first = sfinfo.frames * k / jobs;
+        sf_count_t last = sfinfo.frames * (k + 1) / jobs;
+        s.showProgress = jobs == 1 && outs[0] != 0;
+        s.returnValue = 1;
+        s.runners = proto;
+        for (int p = 0; p < numPlugins; ++p) {
+            Runner &r = s.runners[p];
+            int adjustFrames = RealTime::realTime2Frame(r.adjustment, sfinfo.samplerate);
+            if (k > 0) {
+                // each additional shard needs its own plugin instances; these
+                // are loaded here, as the plugin loader is not thread-safe
+                r.plugin = loadPlugin(myname, specs[p], sfinfo.samplerate, channels,
+                                      paramNames, paramValues, r.blockSize, r.stepSize, false);
+                if (!r.plugin) {
+                    goto done;
+                }
+            }
+            r.next = std::max(first - context[p], (sf_count_t) 0) / r.stepSize * r.stepSize;
+            r.to = k == jobs - 1 ? sfinfo.frames : last + context[p];
+            r.keepFrom = k == 0 ? LLONG_MIN : first + adjustFrames;
+            r.keepTo = k == jobs - 1 ? LLONG_MAX : last + adjustFrames;
+            r.last = k == jobs - 1;
+            if (jobs > 1) {
+                bufs.push_back(new ostringstream());
+                r.out = bufs.back();
+            }
         }
+    }
 
-        for (int c = 0; c < channels; ++c) {
-            int j = 0;
-            while (j < count) {
-                plugbuf[c][j] = filebuf[j * sfinfo.channels + c];
-                ++j;
+    if (jobs == 1) {
+        runShard(infilename, shards[0]);
+    } else {
+        for (int k = 0; k < jobs; ++k)
+            threads.create_thread(boost::bind(runShard, infilename, boost::ref(shards[k])));
+        threads.join_all();
+    }
+
+    returnValue = 0;
+    for (int k = 0; k < jobs; ++k) {
+        if (shards[k].returnValue)
+            returnValue = shards[k].returnValue;
+    }
+
+    // merge: shards are in timestamp order, and don't overlap in
+    // the features they keep
+
+    for (size_t i = 0; i < bufs.size(); ++i) {
+        int p = i % numPlugins;
+        (outs[p] ? *outs[p] : cout) << bufs[i]->str();
+    }
+
+done:
+    for (size_t k = 1; k < shards.size(); ++k)
+        for (size_t p = 0; p < shards[k].runners.size(); ++p)
+            if (shards[k].runners[p].plugin != proto[p].plugin)
+                delete shards[k].runners[p].plugin;
+    for (size_t i = 0; i < bufs.size(); ++i)
+        delete bufs[i];
+    for (int p = 0; p < numPlugins; ++p) {
+        delete proto[p].plugin;
+        if (outs[p]) {
+            outs[p]->close();
+            delete outs[p];
+        }
+    }
+    return returnValue;
+}
+
+/*
+ * Get the timestamp of the first frame in a file written by
+ * vamp-alsa-host's rawFile command, from the file's name.
+ *
+ * Given the PATH_TEMPLATE used by rawFile, the final path components
+ * of the name and template are matched: strftime codes are parsed
+ * with strptime, and a '%' followed by n 'Q's matches the '.' and n
+ * digits of fractional seconds that rawFile substitutes for it.
+ *
+ * Without a template, we look for the first date and time of the
+ * form YYYY-MM-DD?HH?MM?SS[.FFF], where each '?' is any non-digit.
+ *
+ * Times are UTC.  Returns false if no timestamp is found.
+ */
+
+bool
+fileTimestamp(string filename, string tmpl, double &ts)
+{
+    string name = filename.substr(filename.find_last_of('/') + 1);
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    double frac = 0;
+    const char *p = name.c_str();
+
+    if (tmpl != "") {
+        string t = tmpl.substr(tmpl.find_last_of('/') + 1);
+        const char *q = t.c_str();
+        while (*q) {
+            if (q[0] == '%' && q[1] == 'Q') {
+                if (*p++ != '.') return false;
+                double scale = 0.1;
+                for (++q; *q == 'Q'; ++q, ++p, scale /= 10) {
+                    if (!isdigit(*p)) return false;
+                    frac += (*p - '0') * scale;
+                }
+            } else if (q[0] == '%' && q[1]) {
+                char fmt[3] = {'%', q[1], 0};
+                p = strptime(p, fmt, &tm);
+                if (!p) return false;
+                q += 2;
+            } else {
+                if (*p++ != *q++) return false;
             }
-            while (j < blockSize) {
-                plugbuf[c][j] = 0.0f;
-                ++j;
+        }
+        ts = timegm(&tm) + frac;
+        return true;
+    }
+
+    static const char pattern[] = "DDDD?DD?DD?DD?DD?DD";
+    int patLen = sizeof(pattern) - 1;
+    for (; *p; ++p) {
+        int i;
+        for (i = 0; i < patLen && p[i]; ++i) {
+            if ((pattern[i] == 'D') != (isdigit(p[i]) != 0)) break;
+        }
+        if (i < patLen) continue;
+        int year, mon;
+        sscanf(p, "%4d", &year);
+        sscanf(p + 5, "%2d", &mon);
+        sscanf(p + 8, "%2d", &tm.tm_mday);
+        sscanf(p + 11, "%2d", &tm.tm_hour);
+        sscanf(p + 14, "%2d", &tm.tm_min);
+        sscanf(p + 17, "%2d", &tm.tm_sec);
+        tm.tm_year = year - 1900;
+        tm.tm_mon = mon - 1;
+        p += patLen;
+        if (*p == '.') {
+            double scale = 0.1;
+            for (++p; isdigit(*p); ++p, scale /= 10)
+                frac += (*p - '0') * scale;
+        }
+        ts = timegm(&tm) + frac;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * State shared by the workers in batch mode.  Each worker takes the
+ * next file from the list, and leaves its results in results[i],
+ * from which the main thread writes them to the outputs in list
+ * order.
+ */
+
+struct Batch
+{
+    string myname;
+    std::vector<PluginSpec> *specs;
+    std::vector<string> files;
+    string tmpl;
+    std::vector<string> paramNames;
+    std::vector<float> paramValues;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    size_t nextFile;                              // index of next file to be processed
+    std::vector< std::vector<string> > results;   // results[i][p]: output of plugin p for file i
+    std::vector<bool> ready;                      // ready[i]: have results for file i been stored?
+    int returnValue;
+};
+
+/*
+ * A batch worker keeps one warm instance of each plugin, loaded the
+ * first time it is needed, and reset() between files.  Plugins are
+ * only reloaded if the sample rate or channel count changes.
+ */
+
+static void
+batchWorker(Batch *b)
+{
+    int numPlugins = b->specs->size();
+    Shard shard;
+    shard.runners.resize(numPlugins);
+    shard.showProgress = false;
+    for (int p = 0; p < numPlugins; ++p)
+        shard.runners[p].plugin = 0;
+    int rate = 0;
+    int channels = 0;
+    std::vector<ostringstream *> outs(numPlugins);
+    for (int p = 0; p < numPlugins; ++p)
+        outs[p] = new ostringstream();
+
+    for (;;) {
+        size_t i;
+        {
+            boost::mutex::scoped_lock lock(b->mutex);
+            if (b->nextFile >= b->files.size())
+                break;
+            i = b->nextFile++;
+        }
+        string &infilename = b->files[i];
+        int returnValue = 1;
+        double ts = 0;
+
+        SF_INFO sfinfo;
+        memset(&sfinfo, 0, sizeof(SF_INFO));
+        SNDFILE *sndfile = sf_open(infilename.c_str(), SFM_READ, &sfinfo);
+
+        if (!sndfile) {
+            cerr << b->myname << ": ERROR: Failed to open input file \""
+                 << infilename << "\": " << sf_strerror(sndfile) << endl;
+            goto stored;
+        }
+
+        if (!fileTimestamp(infilename, b->tmpl, ts)) {
+            cerr << b->myname << ": WARNING: No timestamp in file name \""
+                 << infilename << "\"; times will be relative to its start" << endl;
+        }
+
+        if (sfinfo.samplerate != rate || sfinfo.channels != channels) {
+            rate = sfinfo.samplerate;
+            channels = sfinfo.channels;
+            for (int p = 0; p < numPlugins; ++p) {
+                delete shard.runners[p].plugin;
+                shard.runners[p].plugin = 0;
             }
         }
 
-        rt = RealTime::frame2RealTime(i, sfinfo.samplerate);
+        for (int p = 0; p < numPlugins; ++p) {
+            Runner &r = shard.runners[p];
+            if (r.plugin) {
+                r.plugin->reset();
+            } else if (setupRunner(b->myname, (*b->specs)[p], rate, channels,
+                                   b->paramNames, b->paramValues, false, false, r)) {
+                rate = 0;
+                goto closed;
+            }
+            outs[p]->str("");
+            r.out = outs[p];
+            r.timeOffset = ts;
+            r.next = 0;
+            r.to = sfinfo.frames;
+            r.keepFrom = LLONG_MIN;
+            r.keepTo = LLONG_MAX;
+            r.last = true;
+        }
 
-        printFeatures
-            (RealTime::realTime2Frame(rt + adjustment, sfinfo.samplerate),
-             sfinfo.samplerate, outputNo, plugin->process(plugbuf, rt),
-             out, useFrames);
+        runShardOn(sndfile, sfinfo, infilename, shard);
+        returnValue = shard.returnValue;
 
-        int pp = progress;
-        progress = lrintf((float(i) / sfinfo.frames) * 100.f);
-        if (progress != pp && out) {
-            cerr << "\r" << progress << "%";
+    closed:
+        sf_close(sndfile);
+
+    stored:
+        boost::mutex::scoped_lock lock(b->mutex);
+        b->results[i].resize(numPlugins);
+        if (returnValue == 0) {
+            for (int p = 0; p < numPlugins; ++p)
+                b->results[i][p] = outs[p]->str();
+        } else {
+            b->returnValue = returnValue;
         }
+        b->ready[i] = true;
+        b->cond.notify_all();
     }
-    if (out) cerr << "\rDone" << endl;
 
-    rt = RealTime::frame2RealTime(sfinfo.frames, sfinfo.samplerate);
+    for (int p = 0; p < numPlugins; ++p) {
+        delete shard.runners[p].plugin;
+        delete outs[p];
+    }
+}
 
-    printFeatures(RealTime::realTime2Frame(rt + adjustment, sfinfo.samplerate),
-                  sfinfo.samplerate, outputNo,
-                  plugin->getRemainingFeatures(), out, useFrames);
+/*
+ * Expand source, which is either a glob pattern, or the name of a
+ * file listing one input file per line ("-" for stdin).
+ */
 
-    returnValue = 0;
+bool
+batchFiles(string source, std::vector<string> &files)
+{
+    if (source.find_first_of("*?[") != string::npos) {
+        glob_t g;
+        if (glob(source.c_str(), 0, 0, &g) == 0) {
+            for (size_t i = 0; i < g.gl_pathc; ++i)
+                files.push_back(g.gl_pathv[i]);
+        }
+        globfree(&g);
+        return true;
+    }
+    ifstream list;
+    if (source != "-") {
+        list.open(source.c_str());
+        if (!list) return false;
+    }
+    istream &in = source == "-" ? cin : list;
+    string line;
+    while (getline(in, line)) {
+        if (line != "")
+            files.push_back(line);
+    }
+    return true;
+}
 
-done:
-    delete plugin;
-    if (out) {
-        out->close();
-        delete out;
+int runBatch(string myname, std::vector<PluginSpec> &specs, string source,
+             string tmpl, std::vector<string> paramNames,
+             std::vector<float> paramValues, int workers)
+{
+    Batch b;
+    b.myname = myname;
+    b.specs = &specs;
+    b.tmpl = tmpl;
+    b.paramNames = paramNames;
+    b.paramValues = paramValues;
+    b.nextFile = 0;
+    b.returnValue = 0;
+
+    if (!batchFiles(source, b.files)) {
+        cerr << myname << ": ERROR: Failed to read list of input files from \""
+             << source << "\"" << endl;
+        return 1;
     }
+    cerr << "Processing " << b.files.size() << " file(s) with "
+         << workers << " worker(s)" << endl;
+
+    b.results.resize(b.files.size());
+    b.ready.resize(b.files.size(), false);
+
+    int numPlugins = specs.size();
+    std::vector<ofstream *> outs(numPlugins, (ofstream *) 0);
+    for (int p = 0; p < numPlugins; ++p) {
+        if (specs[p].outfilename != "") {
+            outs[p] = new ofstream(specs[p].outfilename.c_str(), ios::out);
+            if (!*outs[p]) {
+                cerr << myname << ": ERROR: Failed to open output file \""
+                     << specs[p].outfilename << "\" for writing" << endl;
+                for (int q = 0; q <= p; ++q)
+                    delete outs[q];
+                return 1;
+            }
+        }
+    }
+
+    boost::thread_group threads;
+    for (int w = 0; w < workers; ++w)
+        threads.create_thread(boost::bind(batchWorker, &b));
+
+    // write results in list order, as they become available
+
+    for (size_t i = 0; i < b.files.size(); ++i) {
+        std::vector<string> res;
+        {
+            boost::mutex::scoped_lock lock(b.mutex);
+            while (!b.ready[i])
+                b.cond.wait(lock);
+            res.swap(b.results[i]);
+        }
+        for (int p = 0; p < numPlugins && p < int(res.size()); ++p)
+            (outs[p] ? *outs[p] : cout) << res[p];
+        if (outs[0]) {
+            cerr << "\r" << i + 1 << " / " << b.files.size();
+        }
+    }
+    if (outs[0]) cerr << "\rDone" << endl;
+
+    threads.join_all();
+
+    for (int p = 0; p < numPlugins; ++p) {
+        if (outs[p]) {
+            outs[p]->close();
+            delete outs[p];
+        }
+    }
+    return b.returnValue;
+}
+
+
+/*
+ * Worker for one runner in a shard with several plugins: processes
+ * whatever the reader has available each time the shard's main
+ * thread has filled it, until told to finish.
+ */
+
+static void
+runnerThread(Runner *r, BlockReader *reader, boost::barrier *filled, bool *finished)
+{
+    for (;;) {
+        filled->wait();
+        if (*finished) break;
+        r->processAvailable(*reader);
+        filled->wait();
+    }
+}
+
+void
+runShard(string infilename, Shard &shard)
+{
+    SNDFILE *sndfile;
+    SF_INFO sfinfo;
+    memset(&sfinfo, 0, sizeof(SF_INFO));
+
+    sndfile = sf_open(infilename.c_str(), SFM_READ, &sfinfo);
+    if (!sndfile) {
+	cerr << "ERROR: Failed to open input file \""
+             << infilename << "\": " << sf_strerror(sndfile) << endl;
+	return;
+    }
+
+    runShardOn(sndfile, sfinfo, infilename, shard);
+
     sf_close(sndfile);
-    return returnValue;
 }
 
 void
-printFeatures(int frame, int sr, int output,
-              Plugin::FeatureSet features, ofstream *out, bool useFrames)
+runShardOn(SNDFILE *sndfile, const SF_INFO &sfinfo, string infilename, Shard &shard)
 {
-    for (unsigned int i = 0; i < features[output].size(); ++i) {
+    int channels = sfinfo.channels;
+    int numRunners = shard.runners.size();
+    int maxBlockSize = 0;
+    sf_count_t start = sfinfo.frames;
+
+    for (int p = 0; p < numRunners; ++p) {
+        Runner &r = shard.runners[p];
+        r.buf.resize(channels);
+        r.plugbuf.resize(channels);
+        for (int c = 0; c < channels; ++c) {
+            r.buf[c].resize(r.blockSize + 2);
+            r.plugbuf[c] = &r.buf[c][0];
+        }
+        maxBlockSize = std::max(maxBlockSize, r.blockSize);
+        start = std::min(start, r.next);
+    }
 
-        if (useFrames) {
+    BlockReader reader(sndfile, sfinfo, infilename, maxBlockSize);
 
-            int displayFrame = frame;
+    // with more than one plugin, each gets its own thread; these
+    // all work from the same frames in the reader, which is refilled
+    // when they have all finished with it
 
-            if (features[output][i].hasTimestamp) {
-                displayFrame = RealTime::realTime2Frame
-                    (features[output][i].timestamp, sr);
+    boost::barrier filled(numRunners + 1);
+    bool finished = false;
+    boost::thread_group threads;
+    if (numRunners > 1) {
+        for (int p = 0; p < numRunners; ++p)
+            threads.create_thread(boost::bind(runnerThread, &shard.runners[p], &reader, &filled, &finished));
+    }
+
+    int progress = 0;
+    int err = reader.begin(start);
+
+    while (!err) {
+
+        // keep only frames still needed by some runner
+
+        sf_count_t keepFrom = reader.getReadPos();
+        bool allDone = true;
+        for (int p = 0; p < numRunners; ++p) {
+            Runner &r = shard.runners[p];
+            if (!r.done(reader)) {
+                allDone = false;
+                keepFrom = std::min(keepFrom, r.next);
             }
+        }
+        if (allDone) break;
+
+        if ((err = reader.fill(keepFrom))) break;
+
+        if (numRunners > 1) {
+            filled.wait();
+            filled.wait();
+        } else {
+            shard.runners[0].processAvailable(reader);
+        }
+
+        int pp = progress;
+        progress = lrintf((float(reader.getReadPos()) / sfinfo.frames) * 100.f);
+        if (progress != pp && shard.showProgress) {
+            cerr << "\r" << progress << "%";
+        }
+    }
+    if (numRunners > 1) {
+        finished = true;
+        filled.wait();
+        threads.join_all();
+    }
+    if (shard.showProgress) cerr << "\rDone" << endl;
+
+    for (int p = 0; p < numRunners; ++p) {
+        shard.runners[p].finish(reader);
+    }
+
+    shard.returnValue = err ? 1 : 0;
+}
+
+void
+printFeatures(sf_count_t frame, int sr, int output,
+              Plugin::FeatureSet features, ostream &out, bool useFrames,
+              sf_count_t keepFrom, sf_count_t keepTo, double timeOffset)
+{
+    for (unsigned int i = 0; i < features[output].size(); ++i) {
+
+        sf_count_t featureFrame = frame;
+        if (features[output][i].hasTimestamp) {
+            featureFrame = RealTime::realTime2Frame
+                (features[output][i].timestamp, sr);
+        }
+        if (featureFrame < keepFrom || featureFrame >= keepTo) {
+            // belongs to a neighbouring shard
+            continue;
+        }
+
+        if (useFrames) {
+
+            sf_count_t displayFrame = featureFrame;
 
-            (out ? *out : cout) << displayFrame;
+            out << displayFrame;
 
             if (features[output][i].hasDuration) {
                 displayFrame = RealTime::realTime2Frame
                     (features[output][i].duration, sr);
-                (out ? *out : cout) << "," << displayFrame;
+                out << "," << displayFrame;
             }
 
-            (out ? *out : cout)  << ":";
+            out  << ":";
 
         } else {
 
@@ -545,21 +1539,21 @@ printFeatures(int frame, int sr, int output,
                 rt = features[output][i].timestamp;
             }
 
-            (out ? *out : cout) << setprecision(14);
-            (out ? *out : cout) << (rt.sec + rt.nsec / 1.0e9);
-            (out ? *out : cout) << setprecision(7);
+            out << setprecision(14);
+            out << (timeOffset + rt.sec + rt.nsec / 1.0e9);
+            out << setprecision(7);
 
             if (features[output][i].hasDuration) {
                 rt = features[output][i].duration;
-                (out ? *out : cout) << "," << rt.toString();
+                out << "," << rt.toString();
             }
         }
 
         for (unsigned int j = 0; j < features[output][i].values.size(); ++j) {
-            (out ? *out : cout) << "," << features[output][i].values[j];
+            out << "," << features[output][i].values[j];
         }
 
-        (out ? *out : cout) << endl;
+        out << endl;
     }
 }
 